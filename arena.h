@@ -0,0 +1,81 @@
+#pragma once
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifndef ARENA_BLOCK_SIZE
+#define ARENA_BLOCK_SIZE (64 * 1024)
+#endif // ARENA_BLOCK_SIZE
+
+// Bump allocator: allocations are cut from large blocks and only released all at once,
+// by `arena_free` or by `arena_reset`, which keeps the newest block for reuse.
+// A zero-initialized Arena is empty and ready to use.
+typedef struct ArenaBlock {
+  struct ArenaBlock *prev;
+  size_t used;
+  size_t cap;
+  max_align_t data[]; // `cap` bytes
+} ArenaBlock;
+typedef struct {
+  ArenaBlock *head;
+} Arena;
+
+#define ARENA_ALIGN(n) (((n) + sizeof(max_align_t) - 1) & ~(sizeof(max_align_t) - 1))
+
+static inline void *arena_alloc(Arena *arena, size_t size) {
+  ArenaBlock *block = arena->head;
+  if (block == NULL || ARENA_ALIGN(block->used) + size > block->cap) {
+    const size_t cap = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+    block = malloc(sizeof(ArenaBlock) + cap);
+    if (block == NULL) {
+      perror("malloc arena_alloc");
+      exit(1);
+    }
+    block->prev = arena->head;
+    block->used = 0;
+    block->cap = cap;
+    arena->head = block;
+  }
+  char *ptr = (char *)block->data + ARENA_ALIGN(block->used);
+  block->used = ARENA_ALIGN(block->used) + size;
+  return ptr;
+}
+
+// grows the newest allocation in place if there is room, otherwise moves it
+static inline void *arena_realloc(Arena *arena, void *ptr, size_t old_size, size_t size) {
+  ArenaBlock *block = arena->head;
+  if (ptr != NULL && block != NULL && (char *)ptr + old_size == (char *)block->data + block->used
+      && block->used - old_size + size <= block->cap) {
+    block->used = block->used - old_size + size;
+    return ptr;
+  }
+  void *moved = arena_alloc(arena, size);
+  if (old_size) memcpy(moved, ptr, old_size < size ? old_size : size);
+  return moved;
+}
+
+static inline char *arena_strndup(Arena *arena, const char *str, size_t n) {
+  char *copy = arena_alloc(arena, n + 1);
+  memcpy(copy, str, n);
+  copy[n] = 0;
+  return copy;
+}
+
+static inline void arena_reset(Arena *arena) {
+  if (arena->head == NULL) return;
+  for (ArenaBlock *block = arena->head->prev, *prev; block; block = prev) {
+    prev = block->prev;
+    free(block);
+  }
+  arena->head->prev = NULL;
+  arena->head->used = 0;
+}
+
+static inline void arena_free(Arena *arena) {
+  for (ArenaBlock *block = arena->head, *prev; block; block = prev) {
+    prev = block->prev;
+    free(block);
+  }
+  arena->head = NULL;
+}
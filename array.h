@@ -5,6 +5,8 @@
 #include <errno.h>
 #include <stdio.h>
 #include <assert.h>
+#include <string.h>
+#include "arena.h"
 
 #ifndef ARRAY_INIT_CAP
 #define ARRAY_INIT_CAP 100
@@ -15,20 +17,25 @@
   size_t name ## _count;      \
   size_t name ## _cap;
 
+// elements are sized by the array, not by the pushed expression (`0` into a char array)
 #define ARRAY_PUSH(arr, name, item) do                                        \
   {                                                                           \
     size_t __i = _array_extend((void **)&(arr).name, &(arr).name ## _count,   \
-        &(arr).name ## _cap, sizeof(item));                                   \
+        &(arr).name ## _cap, sizeof(*(arr).name));                            \
     (arr).name[__i] = item;                                                   \
   } while (0);
+// makes room for `n` more items
 #define ARRAY_EXTEND(arr, name, n) _array_extend_n((void **)&(arr).name, &(arr).name ## _count, \
-    &(arr).name ## _cap, sizeof((arr).items[0]), n)
+    &(arr).name ## _cap, sizeof(*(arr).name), n)
+// releases the capacity beyond the current items
+#define ARRAY_SHRINK(arr, name) _array_shrink((void **)&(arr).name, (arr).name ## _count, \
+    &(arr).name ## _cap, sizeof(*(arr).name))
 
-void _array_extend_n(void **arr, size_t *cnt, size_t *cap, size_t size, size_t n) {
+static inline void _array_extend_n(void **arr, size_t *cnt, size_t *cap, size_t size, size_t n) {
   assert(*cnt <= *cap);
   if (*cnt + n > *cap) {
     size_t ncap = *cap < ARRAY_INIT_CAP ? ARRAY_INIT_CAP : *cap * 2;
-    if (ncap < n) ncap = n * 2;
+    if (ncap < *cnt + n) ncap = (*cnt + n) * 2;
     void **ptr = (void **)realloc(*arr, ncap * size);
     if (ptr == NULL) {
       perror("realloc _array_extend");
@@ -39,8 +46,127 @@ void _array_extend_n(void **arr, size_t *cnt, size_t *cap, size_t size, size_t n
   }
 }
 
-size_t _array_extend(void **arr, size_t *cnt, size_t *cap, size_t size) {
+static inline size_t _array_extend(void **arr, size_t *cnt, size_t *cap, size_t size) {
   _array_extend_n(arr, cnt, cap, size, 1);
   return (*cnt)++;
 }
 
+static inline void _array_shrink(void **arr, size_t cnt, size_t *cap, size_t size) {
+  if (cnt == *cap) return;
+  if (cnt == 0) {
+    free(*arr);
+    *arr = NULL;
+    *cap = 0;
+    return;
+  }
+  void *ptr = realloc(*arr, cnt * size);
+  if (ptr == NULL) return; // the old block is still valid, just larger
+  *arr = ptr;
+  *cap = cnt;
+}
+
+// like ARRAY_PUSH and ARRAY_EXTEND, but the items live in `arena` and are freed with it
+#define ARENA_PUSH(arena, arr, name, item) do                                           \
+  {                                                                                     \
+    size_t __i = _arena_array_extend((arena), (void **)&(arr).name, &(arr).name ## _count, \
+        &(arr).name ## _cap, sizeof(*(arr).name));                                      \
+    (arr).name[__i] = item;                                                             \
+  } while (0);
+#define ARENA_EXTEND(arena, arr, name, n) _arena_array_extend_n((arena), (void **)&(arr).name, \
+    &(arr).name ## _count, &(arr).name ## _cap, sizeof(*(arr).name), n)
+
+static inline void _arena_array_extend_n(Arena *arena, void **arr, size_t *cnt, size_t *cap, size_t size, size_t n) {
+  assert(*cnt <= *cap);
+  if (*cnt + n > *cap) {
+    size_t ncap = *cap < ARRAY_INIT_CAP ? ARRAY_INIT_CAP : *cap * 2;
+    if (ncap < *cnt + n) ncap = (*cnt + n) * 2;
+    *arr = arena_realloc(arena, *arr, *cap * size, ncap * size);
+    *cap = ncap;
+  }
+}
+
+static inline size_t _arena_array_extend(Arena *arena, void **arr, size_t *cnt, size_t *cap, size_t size) {
+  _arena_array_extend_n(arena, arr, cnt, cap, size, 1);
+  return (*cnt)++;
+}
+
+// Small arrays keep up to `N` items inline, in the enclosing struct itself, and only move
+// to the heap (or into `arena`, if not NULL) once they outgrow them. `name ## _cap` is 0
+// while the items are inline, so a zero-initialized small array is empty. Items are only
+// reachable through SMALL_ARRAY_ITEMS, which stays valid when the struct is copied.
+#define MAKE_SMALL_ARRAY(T, name, N)  \
+  union {                             \
+    T name ## _inline[N];             \
+    T *name ## _heap;                 \
+  };                                  \
+  size_t name ## _count;              \
+  size_t name ## _cap;
+
+#define SMALL_ARRAY_ITEMS(arr, name) ((arr).name ## _cap ? (arr).name ## _heap : (arr).name ## _inline)
+#define SMALL_ARRAY_INLINE_CAP(arr, name) (sizeof((arr).name ## _inline) / sizeof(*(arr).name ## _inline))
+// makes room for `n` more items
+#define SMALL_ARRAY_RESERVE(arena, arr, name, n) _small_array_reserve((arena), (void *)&(arr).name ## _heap, \
+    (arr).name ## _count, &(arr).name ## _cap, SMALL_ARRAY_INLINE_CAP(arr, name), sizeof(*(arr).name ## _inline), n)
+#define SMALL_ARRAY_PUSH(arena, arr, name, item) do                 \
+  {                                                                 \
+    SMALL_ARRAY_RESERVE(arena, arr, name, 1);                       \
+    SMALL_ARRAY_ITEMS(arr, name)[(arr).name ## _count++] = item;    \
+  } while (0);
+// moves the items back inline if they fit, heap arrays also release unused capacity
+#define SMALL_ARRAY_SHRINK(arena, arr, name) _small_array_shrink((arena), (void *)&(arr).name ## _heap, \
+    (arr).name ## _count, &(arr).name ## _cap, SMALL_ARRAY_INLINE_CAP(arr, name), sizeof(*(arr).name ## _inline))
+// only for heap arrays, items in an arena are freed with it
+#define SMALL_ARRAY_FREE(arr, name) do                    \
+  {                                                       \
+    if ((arr).name ## _cap) free((arr).name ## _heap);    \
+    (arr).name ## _count = (arr).name ## _cap = 0;        \
+  } while (0);
+
+// `storage` is the union of inline items and heap pointer
+static inline void _small_array_reserve(Arena *arena, void *storage, size_t cnt, size_t *cap, size_t inline_cap, size_t size, size_t n) {
+  const size_t current = *cap ? *cap : inline_cap;
+  if (cnt + n <= current) return;
+  size_t ncap = current * 2;
+  if (ncap < cnt + n) ncap = cnt + n;
+  void *items;
+  if (*cap == 0) {
+    items = arena ? arena_alloc(arena, ncap * size) : malloc(ncap * size);
+    if (items == NULL) {
+      perror("malloc _small_array_reserve");
+      exit(1);
+    }
+    memcpy(items, storage, cnt * size); // before the pointer overwrites the inline items
+  } else if (arena) {
+    items = arena_realloc(arena, *(void **)storage, *cap * size, ncap * size);
+  } else {
+    items = realloc(*(void **)storage, ncap * size);
+    if (items == NULL) {
+      perror("realloc _small_array_reserve");
+      exit(1);
+    }
+  }
+  *(void **)storage = items;
+  *cap = ncap;
+}
+
+static inline void _small_array_shrink(Arena *arena, void *storage, size_t cnt, size_t *cap, size_t inline_cap, size_t size) {
+  if (*cap == 0 || cnt == *cap) return;
+  void *items = *(void **)storage;
+  if (cnt <= inline_cap) {
+    memcpy(storage, items, cnt * size); // overwrites the pointer
+    if (!arena) free(items);
+    *cap = 0;
+  } else if (!arena) {
+    _array_shrink((void **)storage, cnt, cap, size);
+  }
+}
+
+typedef struct {
+  MAKE_ARRAY(char, items)
+} StringBuilder;
+
+static inline void sb_append(StringBuilder *sb, const char *data, size_t count) {
+  ARRAY_EXTEND(*sb, items, count);
+  memcpy(sb->items + sb->items_count, data, count);
+  sb->items_count += count;
+}
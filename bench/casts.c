@@ -0,0 +1,125 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <time.h>
+#define NO_MAIN
+#include "../cest.c"
+
+// Generates the CEST_AS_ cast macros for hierarchies of 1k+ types, from the descendant
+// ranges of `order_descendants` and, for comparison, by walking the tree of every struct.
+// Usage: casts.exe
+
+#define ROUNDS 5
+
+typedef enum {
+  SHAPE_WIDE, // parents picked among the previous 50 types
+  SHAPE_TREE, // complete tree of fan-out 8
+  SHAPE_CHAIN, // every type inherits from the one before
+} Shape;
+
+static String_View generate(Shape shape, size_t types) {
+  StringBuilder sb = {0};
+  char line[256];
+  unsigned seed = 1;
+  snprintf(line, sizeof(line), "struct s0 { int f0; };\n");
+  sb_append(&sb, line, strlen(line));
+  for (size_t i = 1; i < types; ++i) {
+    size_t parent = 0;
+    switch (shape) {
+    case SHAPE_WIDE: parent = i - 1 - rand_r(&seed) % (i < 50 ? i : 50); break;
+    case SHAPE_TREE: parent = (i - 1) / 8; break;
+    case SHAPE_CHAIN: parent = i - 1; break;
+    }
+    snprintf(line, sizeof(line), "typedef struct s%zu (struct s%zu) { int f%zu; } t%zu;\n", i, parent, i, i);
+    sb_append(&sb, line, strlen(line));
+  }
+  ARRAY_PUSH(sb, items, 0);
+  return sv_from_parts(sb.items, sb.items_count - 1);
+}
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// the cast macros as built before descendant ranges: one tree walk per struct and variant
+static void walk_child_casts(const StructArr *data, const StructDef *in, String_View name, bool is_struct, bool ptr, FILE *outfile) {
+  dump_child_cast(in, name, is_struct, ptr, outfile);
+  for (size_t i = 0; i < in->inherits_count; ++i)
+    walk_child_casts(data, &data->items[SMALL_ARRAY_ITEMS(*in, inherits)[i]], name, is_struct, ptr, outfile);
+}
+
+static void walk_cast(const StructArr *data, const StructDef *def, String_View name, bool is_struct, bool ptr, FILE *outfile) {
+  if (!def->inherits_count) return;
+  fprintf(outfile, "#define CEST_AS_%s" SV_Fmt "%s(T) _Generic((T), %s" SV_Fmt "%s: (T)",
+      is_struct ? "struct_" : "", SV_Arg(name), ptr ? "S" : "", is_struct ? "struct " : "", SV_Arg(name), ptr ? "*" : "");
+  for (size_t i = 0; i < def->inherits_count; ++i)
+    walk_child_casts(data, &data->items[SMALL_ARRAY_ITEMS(*def, inherits)[i]], name, is_struct, ptr, outfile);
+  fprintf(outfile, ")\n");
+}
+
+static void walk_casts(const StructArr *data, FILE *outfile) {
+  for (size_t i = 0; i < data->items_count; ++i) {
+    const StructDef *def = &data->items[i];
+    if (def->strt.count) walk_cast(data, def, def->strt, true, false, outfile);
+    if (def->strt.count) walk_cast(data, def, def->strt, true, true, outfile);
+    if (def->tdef.count) walk_cast(data, def, def->tdef, false, false, outfile);
+    if (def->tdef.count) walk_cast(data, def, def->tdef, false, true, outfile);
+  }
+}
+
+static String_View run(StructArr *structs, bool ranges, double *best) {
+  char *data = NULL;
+  size_t size = 0;
+  *best = 1e30;
+  for (int r = 0; r < ROUNDS; ++r) {
+    free(data);
+    FILE *outfile = open_memstream(&data, &size);
+    if (outfile == NULL) {
+      perror("open_memstream");
+      exit(1);
+    }
+    double start = now();
+    if (ranges) {
+      order_descendants(structs);
+      output_casts(structs, NULL, outfile);
+    } else {
+      walk_casts(structs, outfile);
+    }
+    POSIX_WORK(fclose, outfile);
+    double t = now() - start;
+    if (t < *best) *best = t;
+  }
+  return sv_from_parts(data, size);
+}
+
+static void bench(const char *name, Shape shape, size_t types) {
+  String_View input = generate(shape, types);
+  TokenBuffer tokens = tokens_lex(SV("bench"), input);
+  StructArr structs = {0};
+  collect_inherits(&structs, &tokens);
+
+  double ranges_time, walk_time;
+  String_View ranges = run(&structs, true, &ranges_time);
+  String_View walk = run(&structs, false, &walk_time);
+  if (!sv_eq(ranges, walk)) {
+    fprintf(stderr, "%s: cast macros differ between descendant ranges and tree walks!\n", name);
+    exit(1);
+  }
+  printf("%s (%zu types, %.1f MiB of macros)\n", name, types, ranges.count / 1024.0 / 1024.0);
+  printf("  ranges %9.3f ms %8.1f MB/s\n", ranges_time * 1e3, ranges.count / ranges_time / 1e6);
+  printf("  walk   %9.3f ms %8.1f MB/s\n", walk_time * 1e3, walk.count / walk_time / 1e6);
+
+  free((void *)ranges.data);
+  free((void *)walk.data);
+  structs_free(&structs);
+  tokens_free(&tokens);
+  free((void *)input.data);
+}
+
+int main(void) {
+  bench("wide", SHAPE_WIDE, 2000);
+  bench("tree", SHAPE_TREE, 4681); // five complete levels
+  bench("chain", SHAPE_CHAIN, 1000);
+  return 0;
+}
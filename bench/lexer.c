@@ -0,0 +1,93 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../array.h"
+#include "../lexer.h"
+
+#define SV_IMPLEMENTATION
+#include "../sv.h"
+
+// Compares the throughput of the classic and the table-driven lexer.
+// Usage: lexer.exe [<file>...], without files a generated header is lexed.
+
+#define ROUNDS 5
+
+static String_View generate(size_t structs) {
+  StringBuilder buf = {0};
+  char line[256];
+  for (size_t i = 0; i < structs; ++i) {
+    snprintf(line, sizeof(line), "#define FIELD_%zu(x) ((x) * %zu)\n", i, i);
+    sb_append(&buf, line, strlen(line));
+    snprintf(line, sizeof(line), "/* struct number %zu */\ntypedef struct s%zu (struct s%zu) {\n", i, i, i ? i - 1 : 0);
+    sb_append(&buf, line, strlen(line));
+    snprintf(line, sizeof(line), "  const char *name; // \"s%zu\"\n  unsigned long long id;\n", i);
+    sb_append(&buf, line, strlen(line));
+    snprintf(line, sizeof(line), "  int values[%zu]; double ratio;\n  enum { A%zu = 0x%zx, B%zu = 'b' } kind;\n", i % 16 + 1, i, i, i);
+    sb_append(&buf, line, strlen(line));
+    const char *tail = "  void (*callback)(struct s0 *self, int flags);\n} __attribute__((packed));\n\n";
+    sb_append(&buf, tail, strlen(tail));
+  }
+  ARRAY_PUSH(buf, items, 0);
+  return sv_from_parts(buf.items, buf.items_count - 1);
+}
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static size_t lex_all(String_View input, LexerFlags flags) {
+  Lexer lexer = lexer_create(SV("bench"), input);
+  lexer.flags = flags;
+  size_t tokens = 0;
+  for (TokenOrEnd t = lexer_get_token(&lexer); t.has_value; t = lexer_get_token(&lexer)) tokens += 1;
+  return tokens;
+}
+
+static void bench(const char *name, String_View input) {
+  static const struct { const char *name; LexerFlags flags; } modes[] = {
+    { "classic", 0 },
+    { "table", LEXER_TABLE },
+  };
+  printf("%s (%.1f MiB)\n", name, input.count / 1024.0 / 1024.0);
+  for (size_t m = 0; m < sizeof(modes) / sizeof(*modes); ++m) {
+    double best = 1e30;
+    size_t tokens = 0;
+    for (int r = 0; r < ROUNDS; ++r) {
+      double start = now();
+      tokens = lex_all(input, modes[m].flags);
+      double t = now() - start;
+      if (t < best) best = t;
+    }
+    printf("  %-8s %8.1f MB/s %8.2f Mtokens/s  (%zu tokens, best of %d)\n", modes[m].name,
+           input.count / best / 1e6, tokens / best / 1e6, tokens, ROUNDS);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    String_View input = generate(20000);
+    bench("generated", input);
+    free((void *)input.data);
+    return 0;
+  }
+  for (int i = 1; i < argc; ++i) {
+    FILE *f = fopen(argv[i], "rb");
+    if (f == NULL) {
+      perror(argv[i]);
+      exit(1);
+    }
+    StringBuilder buf = {0};
+    char chunk[4096];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) sb_append(&buf, chunk, n);
+    fclose(f);
+    ARRAY_PUSH(buf, items, 0);
+    bench(argv[i], sv_from_parts(buf.items, buf.items_count - 1));
+    free(buf.items);
+  }
+  return 0;
+}
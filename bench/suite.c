@@ -0,0 +1,321 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "../array.h"
+
+#define SV_IMPLEMENTATION
+#include "../sv.h"
+
+// Runs cest end to end over generated corpora of different shapes and sizes and reports
+// wall time, throughput and peak memory, one tab-separated line per corpus.
+// Usage: suite.exe [options]
+//   --cest <path>         binary to measure (default: ./cest)
+//   --dir <dir>           where corpora are generated (default: bench/corpus)
+//   --max-size <KiB>      skip corpora larger than this
+//   --only <name>         only run this corpus, may be repeated
+//   --save <file>         also write the results to <file>, to be used as a baseline
+//   --baseline <file>     compare against earlier results, fail on regressions
+//   --threshold <percent> allowed slowdown or growth of peak memory (default: 10)
+
+#define ROUNDS 3
+#define ROUNDS_TIME 2.0 // stop repeating a corpus after this many seconds
+#define SLACK 0.005 // seconds, timings below are too noisy to compare relatively
+#define KiB 1024
+#define MiB (1024 * KiB)
+
+typedef struct {
+  const char *name;
+  size_t depth; // levels of each inheritance tree
+  size_t fanout; // children of every struct above the last level
+  size_t fields; // members per struct
+  size_t includes; // headers with base structs included by the input
+  size_t size; // bytes of the input and its includes
+} Corpus;
+
+static const Corpus corpora[] = {
+  { "tiny",     3,  2,  2,  0,   1 * KiB },
+  { "small",    4,  4,  4,  1,  64 * KiB },
+  { "chain",   64,  1,  2,  0,   1 * MiB },
+  { "wide",     2, 64,  2,  0,   1 * MiB },
+  { "fields",   3,  4, 64,  0,   1 * MiB },
+  { "includes", 3,  4,  4, 16,   1 * MiB },
+  { "medium",   4,  4,  8,  4,  10 * MiB },
+  { "large",    4,  4,  8,  8, 100 * MiB },
+};
+#define CORPORA (sizeof(corpora) / sizeof(*corpora))
+
+typedef struct {
+  const char *name;
+  size_t bytes;
+  size_t structs;
+  double wall; // seconds, best of all rounds
+  long rss; // KiB, peak of all rounds
+} Result;
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void write_file(const char *path, const StringBuilder *sb) {
+  FILE *f = fopen(path, "wb");
+  if (f == NULL || fwrite(sb->items, 1, sb->items_count, f) != sb->items_count || fclose(f) != 0) {
+    perror(path);
+    exit(1);
+  }
+}
+
+static void append_fmt(StringBuilder *sb, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+static void append_fmt(StringBuilder *sb, const char *fmt, ...) {
+  char line[256];
+  va_list args;
+  va_start(args, fmt);
+  int n = vsnprintf(line, sizeof(line), fmt, args);
+  va_end(args);
+  sb_append(sb, line, n);
+}
+
+static void append_fields(StringBuilder *sb, size_t fields) {
+  static const char *types[] = { "int", "unsigned long", "double", "const char *", "struct timespec" };
+  for (size_t f = 0; f < fields; ++f)
+    append_fmt(sb, "  %s f%zu;\n", types[f % (sizeof(types) / sizeof(*types))], f);
+}
+
+// appends structs until `sb` has `size` bytes, returns their number
+// trees of the input inherit from the bases of the includes in turn, if there are any
+static size_t generate_file(StringBuilder *sb, const Corpus *c, size_t file, size_t size) {
+  size_t structs = 0;
+  for (size_t tree = 0; sb->items_count < size; ++tree) {
+    if (file > 0) {
+      // an include: plain base structs, as from a library
+      append_fmt(sb, "struct base%zu_%zu {\n", file, tree);
+      append_fields(sb, c->fields);
+      append_fmt(sb, "};\n");
+      structs += 1;
+      continue;
+    }
+    // the input: level by level, every struct inherits from one of the level above
+    size_t level_start = 0, level_count = 1;
+    for (size_t level = 0; level < c->depth; ++level) {
+      for (size_t i = 0; i < level_count; ++i) {
+        size_t node = level_start + i;
+        bool tdef = node % 2;
+        append_fmt(sb, "%sstruct s%zu_%zu", tdef ? "typedef " : "", tree, node);
+        if (level > 0)
+          append_fmt(sb, " (struct s%zu_%zu)", tree, level_start - level_count / c->fanout + i / c->fanout);
+        else if (c->includes)
+          append_fmt(sb, " (struct base%zu_%zu)", tree % c->includes + 1, tree / c->includes);
+        append_fmt(sb, " {\n");
+        append_fields(sb, c->fields);
+        if (tdef) append_fmt(sb, "} t%zu_%zu;\n", tree, node);
+        else append_fmt(sb, "};\n");
+      }
+      structs += level_count;
+      level_start += level_count;
+      level_count *= c->fanout;
+    }
+  }
+  return structs;
+}
+
+// writes `<dir>/<name>.h.in` and its includes, returns the path of the input
+static char *generate(const Corpus *c, const char *dir, Result *result) {
+  char path[4096];
+  StringBuilder sb = {0};
+  const size_t share = c->size / (c->includes + 1);
+  for (size_t file = 1; file <= c->includes; ++file) {
+    sb.items_count = 0;
+    result->structs += generate_file(&sb, c, file, share);
+    result->bytes += sb.items_count;
+    snprintf(path, sizeof(path), "%s/%s_%zu.h", dir, c->name, file);
+    write_file(path, &sb);
+  }
+  sb.items_count = 0;
+  append_fmt(&sb, "#include <time.h>\n");
+  for (size_t file = 1; file <= c->includes; ++file) append_fmt(&sb, "#include \"%s_%zu.h\"\n", c->name, file);
+  result->structs += generate_file(&sb, c, 0, share + sb.items_count);
+  append_fmt(&sb, "\nCEST_MACROS_HERE\n");
+  result->bytes += sb.items_count;
+  snprintf(path, sizeof(path), "%s/%s.h.in", dir, c->name);
+  write_file(path, &sb);
+  free(sb.items);
+  return strdup(path);
+}
+
+// runs cest once, returns its wall time and adds its peak memory to `result`
+static double run(const char *cest, const char *in, Result *result) {
+  char out[4096];
+  snprintf(out, sizeof(out), "%.*s", (int)(strlen(in) - 3), in); // drop `.in`
+  fflush(stdout);
+  double start = now();
+  pid_t child = fork();
+  if (child < 0) {
+    perror("fork");
+    exit(1);
+  } else if (child == 0) {
+    // the struct listings of debug builds are not part of the measurement
+    int null = open("/dev/null", O_WRONLY);
+    if (null < 0 || dup2(null, STDOUT_FILENO) < 0) exit(127);
+    execl(cest, cest, "--no-cache", in, out, (char *)NULL);
+    perror(cest);
+    exit(127);
+  }
+  int status;
+  struct rusage usage;
+  if (wait4(child, &status, 0, &usage) < 0) {
+    perror("wait4");
+    exit(1);
+  }
+  double wall = now() - start;
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    fprintf(stderr, "%s failed on %s\n", cest, in);
+    exit(1);
+  }
+  if (usage.ru_maxrss > result->rss) result->rss = usage.ru_maxrss;
+  return wall;
+}
+
+static void print_header(FILE *f) {
+  fprintf(f, "corpus\tbytes\tstructs\twall_ms\tmb_per_s\tstructs_per_s\tpeak_rss_kib\n");
+}
+
+static void print_result(FILE *f, const Result *r) {
+  fprintf(f, "%s\t%zu\t%zu\t%.3f\t%.2f\t%.0f\t%ld\n", r->name, r->bytes, r->structs, r->wall * 1e3,
+          r->bytes / r->wall / 1e6, r->structs / r->wall, r->rss);
+}
+
+// reads the lines written by `print_result`, returns their number
+static size_t load_baseline(const char *path, Result *baseline, size_t cap) {
+  FILE *f = fopen(path, "r");
+  if (f == NULL) {
+    perror(path);
+    exit(1);
+  }
+  char line[512], name[128];
+  size_t count = 0;
+  while (count < cap && fgets(line, sizeof(line), f)) {
+    Result r = {0};
+    double wall;
+    if (sscanf(line, "%127s %zu %zu %lf %*f %*f %ld", name, &r.bytes, &r.structs, &wall, &r.rss) != 5) continue;
+    r.name = strdup(name);
+    r.wall = wall / 1e3;
+    baseline[count++] = r;
+  }
+  fclose(f);
+  return count;
+}
+
+static bool compare(const Result *r, const Result *baseline, size_t baseline_count, double threshold) {
+  for (size_t i = 0; i < baseline_count; ++i) {
+    const Result *b = &baseline[i];
+    if (strcmp(b->name, r->name) != 0) continue;
+    if (b->bytes != r->bytes) {
+      fprintf(stderr, "%s: corpus differs from the baseline (%zu instead of %zu bytes), not compared\n", r->name, r->bytes, b->bytes);
+      return true;
+    }
+    bool ok = true;
+    if (r->wall > b->wall * (1 + threshold) + SLACK) {
+      fprintf(stderr, "REGRESSION %s: %.3f ms instead of %.3f ms (%+.1f%%)\n", r->name, r->wall * 1e3, b->wall * 1e3, (r->wall / b->wall - 1) * 100);
+      ok = false;
+    }
+    if (r->rss > b->rss * (1 + threshold)) {
+      fprintf(stderr, "REGRESSION %s: peak RSS %ld KiB instead of %ld KiB (%+.1f%%)\n", r->name, r->rss, b->rss, ((double)r->rss / b->rss - 1) * 100);
+      ok = false;
+    }
+    return ok;
+  }
+  return true;
+}
+
+static const char *next_arg(int argc, char *argv[], int *i) {
+  if (*i + 1 >= argc) {
+    fprintf(stderr, "%s needs an argument\n", argv[*i]);
+    exit(1);
+  }
+  return argv[++*i];
+}
+
+int main(int argc, char *argv[]) {
+  const char *cest = "./cest";
+  const char *dir = "bench/corpus";
+  const char *save = NULL;
+  const char *baseline_path = NULL;
+  double threshold = 0.10;
+  size_t max_size = (size_t)-1;
+  struct { MAKE_ARRAY(const char *, items) } only = {0};
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--cest") == 0) {
+      cest = next_arg(argc, argv, &i);
+    } else if (strcmp(argv[i], "--dir") == 0) {
+      dir = next_arg(argc, argv, &i);
+    } else if (strcmp(argv[i], "--max-size") == 0) {
+      max_size = strtoull(next_arg(argc, argv, &i), NULL, 10) * KiB;
+    } else if (strcmp(argv[i], "--only") == 0) {
+      ARRAY_PUSH(only, items, next_arg(argc, argv, &i));
+    } else if (strcmp(argv[i], "--save") == 0) {
+      save = next_arg(argc, argv, &i);
+    } else if (strcmp(argv[i], "--baseline") == 0) {
+      baseline_path = next_arg(argc, argv, &i);
+    } else if (strcmp(argv[i], "--threshold") == 0) {
+      threshold = atof(next_arg(argc, argv, &i)) / 100;
+    } else {
+      fprintf(stderr, "Unknown option `%s`\n", argv[i]);
+      return 1;
+    }
+  }
+  if (mkdir(dir, 0777) < 0 && errno != EEXIST) {
+    perror(dir);
+    return 1;
+  }
+  Result baseline[CORPORA];
+  size_t baseline_count = baseline_path ? load_baseline(baseline_path, baseline, CORPORA) : 0;
+  FILE *saved = NULL;
+  if (save) {
+    saved = fopen(save, "w");
+    if (saved == NULL) {
+      perror(save);
+      return 1;
+    }
+    print_header(saved);
+  }
+
+  bool ok = true;
+  print_header(stdout);
+  for (size_t c = 0; c < CORPORA; ++c) {
+    if (corpora[c].size > max_size) continue;
+    bool selected = only.items_count == 0;
+    for (size_t i = 0; i < only.items_count; ++i) selected |= strcmp(only.items[i], corpora[c].name) == 0;
+    if (!selected) continue;
+    Result r = { .name = corpora[c].name, .wall = 1e30 };
+    char *in = generate(&corpora[c], dir, &r);
+    double total = 0;
+    for (int round = 0; round < ROUNDS && total < ROUNDS_TIME; ++round) {
+      double t = run(cest, in, &r);
+      if (t < r.wall) r.wall = t;
+      total += t;
+    }
+    free(in);
+    print_result(stdout, &r);
+    fflush(stdout);
+    if (saved) print_result(saved, &r);
+    ok &= compare(&r, baseline, baseline_count, threshold);
+  }
+  if (saved && fclose(saved) != 0) {
+    perror(save);
+    return 1;
+  }
+  for (size_t i = 0; i < baseline_count; ++i) free((void *)baseline[i].name);
+  free(only.items);
+  return ok ? 0 : 1;
+}
@@ -4,16 +4,30 @@
 #include <regex.h>
 #include <errno.h>
 #include <string.h>
+#include <ctype.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/wait.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <glob.h>
 
 #define DEBUG
 
+#include "arena.h"
 #include "array.h"
 #include "lexer.h"
+#include "preproc.h"
+#include "resultcache.h"
+#include "stats.h"
+#include "symtab.h"
 #define SV_IMPLEMENTATION
 #include "sv.h"
 
@@ -26,68 +40,427 @@
       exit(1);                                             \
     }                                                      \
   } while(0);
+#define PTHREAD_WORK(name, ...) do                                                          \
+  {                                                                                         \
+    int __err = name(__VA_ARGS__);                                                          \
+    if (__err != 0) {                                                                       \
+      fprintf(stderr, __FILE__ ":" TOSTRING(__LINE__) ":" #name ": %s\n", strerror(__err)); \
+      exit(1);                                                                              \
+    }                                                                                       \
+  } while(0);
 #define UNREACHABLE do { assert(0 && "unreachable"); exit(99); } while(0);
 
 #define INSERT_STR "CEST_MACROS_HERE"
+#define SEGMENT_STR "CEST_SEGMENT" // marks code of a file in its prelude, see `extract_prelude`
+#define DEFAULT_SOCKET "/tmp/cest.sock"
+#define CEST_BUILD __DATE__ " " __TIME__ // part of result cache keys, outputs may change between builds
 
 // TODO: does not consider typedef`s without body (i.e. forward defs)
 // TODO: implement multiple inheritance
 
 
+typedef enum {
+  FIELD_MEMBER,
+  FIELD_BITFIELD, // has no offset
+  FIELD_NO_TYPE, // declaration does not start with a type
+  FIELD_NO_NAME, // declaration without a recognizable member name
+} FieldKind;
+typedef struct {
+  FieldKind kind;
+  String_View name;
+  size_t token; // of the name, or of the start of an invalid declaration
+} Field;
+
 typedef struct {
   String_View defn;
+  TokenBuffer *tokens; // of the file the struct is defined in
+  size_t body_start, body_end; // tokens of defn
+  String_View body; // defn preceded by the members of all ancestors, see `flatten_structs`
   String_View strt;
   String_View tdef;
+  Symbol strt_sym;
+  Symbol tdef_sym;
   bool hasParent;
   size_t parent;
-  MAKE_ARRAY(size_t, inherits)
+  MAKE_SMALL_ARRAY(size_t, inherits, 3) // most structs have few children
+  MAKE_ARRAY(Field, fields) // own members in order of declaration, see `parse_fields`
+  size_t pre; // position in `StructArr.preorder`, see `order_descendants`
+  size_t descendants;
   const char *loc_start;
   const char *loc_end;
   const char *loc_after;
 } StructDef;
 typedef struct {
   MAKE_ARRAY(StructDef, items)
-  const char *orig;
+  SymbolTable symbols;
+  // struct tags and typedef names are separate namespaces, both map symbols to indices
+  // into items (SIZE_MAX if there is no struct with this name)
+  MAKE_ARRAY(size_t, tags)
+  MAKE_ARRAY(size_t, typedefs)
+  size_t shared; // leading items copied from an include table, which owns their fields
+  // all structs reachable through `inherits`, depth first: the descendants of a struct
+  // directly follow it, `preorder[def.pre + 1 .. def.pre + def.descendants]`
+  MAKE_ARRAY(size_t, preorder)
+  MAKE_ARRAY(const char *, markers) // INSERT_STR names in the file, in order, see `collect_inherits`
+  MAKE_ARRAY(size_t, skipped) // token ranges `[start, end)` of the file its preprocessor left out, see `skip_inactive`
+  size_t diagnostics; // warnings and errors printed about the file by `collect_inherits`
+  Arena arena; // all arrays above and of the items, names and flattened bodies
 } StructArr;
 
+// position of a parser in a token buffer, handing out tokens like a Lexer
+typedef struct {
+  TokenBuffer *tokens;
+  size_t pos;
+  size_t end;
+  const char *lexed; // end of the last token looked at, where a Lexer would continue
+} TokenCursor;
+
+// Structs of the included headers only depend on the preprocessor directives of a file
+// (and the directory quoted includes are resolved from, as well as the preprocessor
+// settings), so they are shared between all files with the same prelude
+typedef struct {
+  char *path;
+  struct timespec mtime;
+} Dependency;
+typedef struct {
+  char *dir;
+  String_View config; // see `Options.pp_key`
+  String_View prelude;
+  char *name;
+  String_View text;
+  TokenBuffer tokens; // of text, referred to by structs
+  StructArr structs;
+  MAKE_ARRAY(Dependency, deps)
+  MAKE_ARRAY(size_t, segments) // SEGMENT_STR markers of the prelude found in text, in order
+  bool text_mapped; // text is a --preprocessed file
+  bool ready;
+  bool inherited; // built by the server process, see `serve_client`
+} IncludeTable;
+typedef struct {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  MAKE_ARRAY(IncludeTable *, items)
+  bool revalidate; // check dependencies for changes on every lookup
+} IncludeCache;
+
+// Names in the sources given with --used-by: only the cast macros used there are generated,
+// and only with associations for the types named there
+typedef struct {
+  MAKE_ARRAY(char *, paths)
+  MAKE_ARRAY(String_View, files) // contents, names point into them
+  SymbolTable names;
+  MAKE_ARRAY(Location, uses) // per symbol, first use of a cast macro (empty filename for other names)
+  bool *generated; // per symbol, a cast macro was written to some output, see `used_by_mark`
+  uint64_t key; // identifies the names in result cache keys
+  pthread_mutex_t lock;
+} UsedBy;
+
+// settings of one invocation, shared by all of its files
+typedef struct {
+  PPConfig pp;
+  String_View pp_key; // identifies the preprocessor settings in include tables
+  bool populate; // read inputs completely when mapping them
+  const char *preprocessed; // absolute path of a file used instead of preprocessing
+  ResultCache *results; // NULL with --no-cache
+  UsedBy *used; // NULL without --used-by, then all cast macros are generated
+  bool depfiles; // -MD, write a make rule with all dependencies next to every output
+  const char *depfile; // -MF, instead of `<out file>.d` (only for a single input file)
+  const char *dep_target; // -MT, instead of the output name (only for a single input file)
+  bool stream; // --stream-includes, only keep the declarations of included text that may define structs
+  size_t lex_threads; // --lex-threads, lex included text in that many pieces at once (0 or 1: sequentially)
+  Stats *stats; // NULL without --stats and --trace
+} Options;
+
+// Extracts the declarations of preprocessed text that may define structs, while it is
+// still arriving: a top-level declaration (up to `;`, or a function body) is only copied
+// to `store` if it names `struct` or `typedef`, all other text is dropped once scanned.
+// Only the current declaration is buffered, so memory follows the structs kept instead
+// of the size of the text.
+typedef enum {
+  SF_CODE,
+  SF_LINE_COMMENT,
+  SF_BLOCK_COMMENT,
+  SF_STRING,
+  SF_CHAR,
+  SF_DIRECTIVE,
+} FilterState;
+typedef struct {
+  FilterState state;
+  StringBuilder store; // declarations kept so far, each followed by a newline
+  StringBuilder decl; // current declaration, from earlier chunks
+  StringBuilder directive; // current directive, for linemarkers
+  StringBuilder deps; // paths of all linemarkers, each followed by a NUL
+  bool in_decl;
+  bool keep; // the current declaration names struct or typedef
+  bool in_line; // code other than whitespace since the last newline
+  bool slash; // a `/` that may start a comment, not processed yet
+  bool star; // `*` in a block comment
+  bool escaped; // backslash in a literal or directive
+  bool function; // the outermost block of the declaration is a function body
+  size_t depth;
+  char last; // last code character that was not whitespace
+  char prev; // last code character
+  char word[8]; // start of the current identifier
+  size_t word_count;
+  size_t text_size; // all text scanned, for statistics
+} StructFilter;
+
+static bool filter_is_ident(char c) {
+  return isalnum((unsigned char)c) || c == '_';
+}
+
+// the current word is the encoding prefix of a character literal: L'x', u'x', U'x' or u8'x'
+static bool filter_is_prefix(const StructFilter *filter) {
+  if (filter->word_count == 1) return filter->word[0] == 'L' || filter->word[0] == 'u' || filter->word[0] == 'U';
+  return filter->word_count == 2 && filter->word[0] == 'u' && filter->word[1] == '8';
+}
+
+static void filter_end_word(StructFilter *filter) {
+  if ((filter->word_count == 6 && memcmp(filter->word, "struct", 6) == 0)
+      || (filter->word_count == 7 && memcmp(filter->word, "typedef", 7) == 0))
+    filter->keep = true;
+  filter->word_count = 0;
+}
+
+// `from` is where the declaration continues in the current chunk, `to` where it ends
+static void filter_end_decl(StructFilter *filter, const char *from, const char *to) {
+  if (filter->keep) {
+    if (filter->decl.items_count) sb_append(&filter->store, filter->decl.items, filter->decl.items_count);
+    sb_append(&filter->store, from, to - from);
+    sb_append(&filter->store, "\n", 1);
+  }
+  filter->decl.items_count = 0;
+  filter->in_decl = false;
+  filter->keep = false;
+  filter->function = false;
+}
+
+// every header the preprocessor entered is announced by a linemarker `# <line> "<path>" <flags>`
+static bool linemarker_path(String_View line, String_View *path) {
+  if (!sv_starts_with(line, SV("# ")) || line.count < 3 || !isdigit(line.data[2])) return false;
+  sv_chop_by_delim(&line, '"');
+  *path = sv_chop_by_delim(&line, '"');
+  return true;
+}
+
+static void filter_end_directive(StructFilter *filter) {
+  String_View path;
+  if (linemarker_path(sv_from_parts(filter->directive.items, filter->directive.items_count), &path)) {
+    sb_append(&filter->deps, path.data, path.count);
+    sb_append(&filter->deps, "", 1);
+  }
+  filter->directive.items_count = 0;
+}
+
+// the code character at `at`, `*start` is where the current declaration starts in this chunk
+static void filter_code(StructFilter *filter, const char *at, const char **start) {
+  const char c = *at;
+  const char prev = filter->prev;
+  const bool prefixed = c == '\'' && filter_is_prefix(filter);
+  filter->prev = c;
+  if (filter_is_ident(c)) {
+    if (filter->word_count < sizeof(filter->word)) filter->word[filter->word_count] = c;
+    filter->word_count += filter->word_count < sizeof(filter->word);
+  } else if (filter->word_count) {
+    filter_end_word(filter);
+  }
+  if (c == '\n') filter->in_line = false;
+  if (isspace((unsigned char)c)) return;
+  if (c == '#' && !filter->in_line) {
+    filter->state = SF_DIRECTIVE;
+    filter->escaped = false;
+    sb_append(&filter->directive, "#", 1);
+    return;
+  }
+  filter->in_line = true;
+  if (!filter->in_decl) {
+    filter->in_decl = true;
+    *start = at;
+  }
+  if (c == '"' || (c == '\'' && (!filter_is_ident(prev) || prefixed))) { // `1'000` is no character literal
+    filter->state = c == '"' ? SF_STRING : SF_CHAR;
+    filter->escaped = false;
+  } else if (c == '{') {
+    // `struct child (struct base) {` is no function, neither is one returning a struct (until its `;` is found)
+    if (filter->depth++ == 0) filter->function = filter->last == ')' && !filter->keep;
+  } else if (c == '}') {
+    if (filter->depth == 0) {
+      fprintf(stderr, "Unmatched `}` in preprocessed includes\n");
+      exit(1);
+    }
+    if (--filter->depth == 0 && filter->function) filter_end_decl(filter, *start, at + 1);
+  } else if (c == ';' && filter->depth == 0) {
+    filter_end_decl(filter, *start, at + 1);
+  }
+  filter->last = c;
+}
+
+static void filter_comment(StructFilter *filter, char c) {
+  if (filter->word_count) filter_end_word(filter);
+  filter->state = c == '/' ? SF_LINE_COMMENT : SF_BLOCK_COMMENT;
+  filter->escaped = false;
+  filter->star = false;
+}
+
+void filter_feed(StructFilter *filter, const char *data, size_t count) {
+  const char *start = data; // of the current declaration in this chunk
+  const char *end = data + count;
+  const char *at = data;
+  filter->text_size += count;
+  if (filter->slash && count) {
+    // `/` ending the previous chunk, held back until it was clear whether it starts a comment
+    filter->slash = false;
+    if (filter->in_decl) sb_append(&filter->decl, "/", 1);
+    if (*at == '/' || *at == '*') {
+      filter_comment(filter, *at);
+      at += 1;
+    } else {
+      if (filter->word_count) filter_end_word(filter);
+      if (!filter->in_decl) sb_append(&filter->decl, "/", 1);
+      filter->in_decl = true;
+      filter->in_line = true;
+      filter->prev = filter->last = '/';
+    }
+  }
+  for (; at < end; ++at) {
+    const char c = *at;
+    switch (filter->state) {
+    case SF_CODE:
+      if (c == '/' && at + 1 == end) {
+        filter->slash = true;
+        end -= 1; // not part of this chunk's declaration yet
+      } else if (c == '/' && (at[1] == '/' || at[1] == '*')) {
+        filter_comment(filter, at[1]);
+        at += 1;
+      } else {
+        filter_code(filter, at, &start);
+      }
+      break;
+    case SF_LINE_COMMENT:
+      if (c == '\n' && !filter->escaped) {
+        filter->state = SF_CODE;
+        filter_code(filter, at, &start);
+      }
+      filter->escaped = c == '\\';
+      break;
+    case SF_BLOCK_COMMENT:
+      if (filter->star && c == '/') filter->state = SF_CODE;
+      filter->star = c == '*';
+      break;
+    case SF_STRING:
+    case SF_CHAR:
+      if (!filter->escaped && c == (filter->state == SF_STRING ? '"' : '\'')) {
+        filter->state = SF_CODE;
+        filter->prev = filter->last = c;
+      }
+      filter->escaped = !filter->escaped && c == '\\';
+      break;
+    case SF_DIRECTIVE:
+      if (c == '\n' && !filter->escaped) {
+        filter->state = SF_CODE;
+        filter->in_line = false;
+        filter->prev = c;
+        filter_end_directive(filter);
+      } else {
+        sb_append(&filter->directive, at, 1);
+      }
+      filter->escaped = !filter->escaped && c == '\\';
+      break;
+    }
+  }
+  if (filter->in_decl) sb_append(&filter->decl, start, end - start);
+}
+
+// returns the kept declarations, NUL-terminated, to be freed by the caller
+String_View filter_finish(StructFilter *filter, const char *name) {
+  if (filter->slash) filter_feed(filter, " ", 1);
+  if (filter->word_count) filter_end_word(filter);
+  if (filter->state == SF_DIRECTIVE) filter_end_directive(filter);
+  if (filter->depth != 0) {
+    fprintf(stderr, "%s: Unclosed block\n", name);
+    exit(1);
+  }
+  if (filter->in_decl) filter_end_decl(filter, "", "");
+  free(filter->decl.items);
+  free(filter->directive.items);
+  ARRAY_PUSH(filter->store, items, 0);
+  return sv_from_parts(filter->store.items, filter->store.items_count - 1);
+}
+
 #define INITIAL_FILE_CAP 1000
-String_View preprocess_file(const char *filename) {
-  int fd[2];
-  POSIX_WORK(pipe, fd);
+#define FILTER_CHUNK_SIZE (64 * 1024)
+// runs the external preprocessor over `prelude` as if it was a file in `dir`
+// with a `filter`, the output is fed to it while it is read and nothing is returned
+String_View preprocess_prelude_cc(const PPConfig *config, const char *dir, String_View prelude, StructFilter *filter) {
+  struct { MAKE_ARRAY(const char *, items) } args = {0};
+  const char *base[] = { "cc", "-x", "c", "-fdirectives-only", "-w", "-E" };
+  for (size_t i = 0; i < sizeof(base) / sizeof(base[0]); ++i) ARRAY_PUSH(args, items, base[i]);
+  for (size_t i = 0; i < config->includes_count; ++i) {
+    ARRAY_PUSH(args, items, "-I");
+    ARRAY_PUSH(args, items, config->includes[i]);
+  }
+  for (size_t i = 0; i < config->system_includes_count; ++i) {
+    ARRAY_PUSH(args, items, "-isystem");
+    ARRAY_PUSH(args, items, config->system_includes[i]);
+  }
+  ARRAY_PUSH(args, items, "-");
+  ARRAY_PUSH(args, items, NULL);
+  int in[2], out[2];
+  // close-on-exec: other workers may fork concurrently and must not keep our pipes open
+  POSIX_WORK(pipe2, in, O_CLOEXEC);
+  POSIX_WORK(pipe2, out, O_CLOEXEC);
   pid_t child = fork();
   if (child < 0) {
     perror("fork");
     exit(1);
   } else if (child == 0) {
     // child process
-    POSIX_WORK(close, fd[0]); // close read end
-    POSIX_WORK(dup2, fd[1], STDOUT_FILENO); // use pipe as stdout to read in parent process
-    POSIX_WORK(execlp, "cc", "cc", "-x", "c", "-fdirectives-only", "-w", "-E", filename, NULL);
+    POSIX_WORK(dup2, in[0], STDIN_FILENO); // read prelude from pipe
+    POSIX_WORK(dup2, out[1], STDOUT_FILENO); // use pipe as stdout to read in parent process
+    POSIX_WORK(chdir, dir); // resolve quoted includes relative to the original file
+    POSIX_WORK(execvp, "cc", (char **)args.items);
     UNREACHABLE
   }
+  free((void *)args.items);
   // parent process
-  POSIX_WORK(close, fd[1]); // close write end
-  
+  POSIX_WORK(close, in[0]); // close read end
+  POSIX_WORK(close, out[1]); // close write end
+  // the preprocessor reads its whole input before producing output, so this cannot block indefinitely
+  for (size_t written = 0; written < prelude.count;) {
+    ssize_t n = write(in[1], prelude.data + written, prelude.count - written);
+    if (n < 0 && errno == EPIPE) break; // child died, reported below
+    if (n < 0) {
+      perror("write");
+      exit(1);
+    }
+    written += n;
+  }
+  POSIX_WORK(close, in[1]);
+
   size_t size = 0;
   char *ptr = NULL;
   size_t total = 0;
   ssize_t nread = 0;
   do {
+    if (filter) {
+      filter_feed(filter, ptr, nread);
+      nread = 0;
+    }
     total += nread;
     if (total >= size) {
-      size = size == 0 ? INITIAL_FILE_CAP : size * 2; // new size double
+      size = size == 0 ? (filter ? FILTER_CHUNK_SIZE : INITIAL_FILE_CAP) : size * 2; // new size double
       ptr = realloc(ptr, size);
       if (ptr == NULL) {
-        perror("realloc preprocess_file");
+        perror("realloc preprocess_prelude");
         exit(1);
       }
     }
-  } while ((nread = read(fd[0], ptr + total, size - total)) > 0);
+  } while ((nread = read(out[0], ptr + total, size - total)) > 0);
   if (nread < 0) {
     perror("read");
     exit(1);
   }
-  POSIX_WORK(close, fd[0]);
+  POSIX_WORK(close, out[0]);
   int status;
   POSIX_WORK(waitpid, child, &status, 0);
   if (!WIFEXITED(status)) {
@@ -97,6 +470,10 @@ String_View preprocess_file(const char *filename) {
     fprintf(stderr, "child did not exit normally\n");
     exit(1);
   }
+  if (filter) {
+    free(ptr);
+    return (String_View) {0};
+  }
   ptr[total] = 0;
   return (String_View) {
     .count = total,
@@ -104,147 +481,482 @@ String_View preprocess_file(const char *filename) {
   };
 }
 
-String_View load_file(const char *filename) {
-  FILE *f = fopen(filename, "r");
-  if (f == NULL) {
-    perror("fopen load_file");
+// runs the configured preprocessor over `prelude` as if it was a file in `dir`
+// with a `filter`, the output is fed to it and nothing is returned
+String_View preprocess_prelude(const PPConfig *config, const char *dir, String_View prelude, StructFilter *filter) {
+  String_View text = {0};
+  switch (config->engine) {
+  case PP_ENGINE_CC: text = preprocess_prelude_cc(config, dir, prelude, filter); break;
+  case PP_ENGINE_BUILTIN: text = pp_builtin(config, dir, prelude); break;
+  }
+  if (filter && text.data) {
+    // the builtin preprocessor produces all text at once, it can only be compacted afterwards
+    filter_feed(filter, text.data, text.count);
+    free((void *)text.data);
+    return (String_View) {0};
+  }
+  return text;
+}
+
+static bool is_type_word(String_View name) {
+  static const String_View words[] = {
+    SV_STATIC("void"), SV_STATIC("char"), SV_STATIC("short"), SV_STATIC("int"), SV_STATIC("long"),
+    SV_STATIC("float"), SV_STATIC("double"), SV_STATIC("signed"), SV_STATIC("unsigned"),
+    SV_STATIC("_Bool"), SV_STATIC("_Complex"), SV_STATIC("union"), SV_STATIC("volatile"),
+    SV_STATIC("restrict"), SV_STATIC("_Atomic"),
+  };
+  for (size_t i = 0; i < sizeof(words) / sizeof(words[0]); ++i)
+    if (sv_eq(name, words[i])) return true;
+  return false;
+}
+
+static bool token_is(const TokenBuffer *tokens, size_t i, TokenKind kind, char c) {
+  return tokens->kinds[i] == kind && tokens->lengths[i] == 1 && tokens->lexer.source.data[tokens->offsets[i]] == c;
+}
+
+// index after the group opened at `i`, brackets are assumed to be balanced
+static size_t skip_group(const TokenBuffer *tokens, size_t i, size_t end) {
+  size_t depth = 0;
+  for (; i < end; ++i) {
+    if (tokens->kinds[i] != TK_PAREN) continue;
+    const char c = tokens->lexer.source.data[tokens->offsets[i]];
+    if (c == '(' || c == '[' || c == '{') depth += 1;
+    else if (--depth == 0) return i + 1;
+  }
+  return end;
+}
+
+// Collects the members declared by the tokens [start, end) of a struct body. The name of a
+// declarator is its last identifier outside of array sizes, parameter lists and member
+// blocks, e.g. `x` in `int x[N]`, `int x : 3`, `void (*x)(int y)` and `struct { int y; } x`.
+// Members of anonymous structs and unions belong to the enclosing struct.
+void parse_fields(Arena *arena, StructDef *def, size_t start, size_t end) {
+  const TokenBuffer *tokens = def->tokens;
+  size_t i = start;
+  while (i < end) {
+    const TokenKind kind = tokens->kinds[i];
+    if (kind == TK_COMMENT || kind == TK_DIRECTIVE || token_is(tokens, i, TK_SEP, ';')) {
+      i += 1;
+      continue;
+    }
+    const size_t decl = i;
+    if (kind != TK_NAME && kind != TK_STRUCT && kind != TK_ENUM && kind != TK_ATTRIB) {
+      ARENA_PUSH(arena, *def, fields, ((Field) { .kind = FIELD_NO_TYPE, .token = decl }));
+      while (i < end && !token_is(tokens, i, TK_SEP, ';')) i += 1;
+      continue;
+    }
+    // one declaration, its declarators are separated by `,`
+    bool first = true;
+    bool has_type = false; // as opposed to a lone typedef name
+    size_t names = 0;
+    size_t block = SIZE_MAX;
+    while (i < end) {
+      size_t name = SIZE_MAX;
+      bool bitfield = false;
+      while (i < end && !token_is(tokens, i, TK_SEP, ',') && !token_is(tokens, i, TK_SEP, ';')) {
+        const Token t = tokens_at(tokens, i);
+        if (t.kind == TK_PAREN && sv_eq(t.content, SV("{"))) {
+          // everything before a member block names its type
+          block = i;
+          name = SIZE_MAX;
+          has_type = true;
+          i = skip_group(tokens, i, end);
+        } else if (t.kind == TK_PAREN && sv_eq(t.content, SV("["))) {
+          i = skip_group(tokens, i, end);
+        } else if (t.kind == TK_PAREN && sv_eq(t.content, SV("("))) {
+          // `(*x)` groups a declarator, anything else is a parameter list or attribute
+          const bool grouping = i + 1 < end && (token_is(tokens, i + 1, TK_OP, '*') || token_is(tokens, i + 1, TK_PAREN, '('));
+          i = grouping ? i + 1 : skip_group(tokens, i, end);
+        } else if ((t.kind == TK_SEP && sv_eq(t.content, SV(":"))) || (t.kind == TK_OP && sv_eq(t.content, SV("=")))) {
+          bitfield = t.kind == TK_SEP;
+          while (i < end && !token_is(tokens, i, TK_SEP, ',') && !token_is(tokens, i, TK_SEP, ';')) {
+            if (tokens->kinds[i] == TK_PAREN) i = skip_group(tokens, i, end);
+            else i += 1;
+          }
+        } else {
+          if (t.kind == TK_STRUCT || t.kind == TK_ENUM) has_type = true;
+          if (t.kind == TK_NAME && is_type_word(t.content)) has_type = true;
+          else if (t.kind == TK_NAME) {
+            name = i;
+            names += 1;
+          }
+          i += 1;
+        }
+      }
+      // in `T : 3` or `T;`, the only name is the type
+      if (name != SIZE_MAX && (!first || has_type || names >= 2)) {
+        ARENA_PUSH(arena, *def, fields, ((Field) {
+          .kind = bitfield ? FIELD_BITFIELD : FIELD_MEMBER,
+          .name = tokens_at(tokens, name).content,
+          .token = name,
+        }));
+      } else if (block != SIZE_MAX) {
+        // anonymous struct or union, unless it has a tag (then it only declares the type)
+        if (first && names == 0) parse_fields(arena, def, block + 1, skip_group(tokens, block, end) - 1);
+      } else if (!bitfield) {
+        ARENA_PUSH(arena, *def, fields, ((Field) { .kind = FIELD_NO_NAME, .token = decl }));
+      }
+      first = false;
+      if (i >= end || token_is(tokens, i, TK_SEP, ';')) break;
+      i += 1; // ,
+    }
+  }
+}
+
+// adds `def`, making it findable by its names; the first definition of a name wins
+void structs_push(StructArr *structs, StructDef def) {
+  const size_t index = structs->items_count;
+  if (def.tokens) parse_fields(&structs->arena, &def, def.body_start, def.body_end);
+  if (def.strt.count) {
+    def.strt_sym = symtab_intern(&structs->symbols, def.strt);
+    while (structs->tags_count <= def.strt_sym) ARENA_PUSH(&structs->arena, *structs, tags, SIZE_MAX);
+    if (structs->tags[def.strt_sym] == SIZE_MAX) structs->tags[def.strt_sym] = index;
+  }
+  if (def.tdef.count) {
+    def.tdef_sym = symtab_intern(&structs->symbols, def.tdef);
+    while (structs->typedefs_count <= def.tdef_sym) ARENA_PUSH(&structs->arena, *structs, typedefs, SIZE_MAX);
+    if (structs->typedefs[def.tdef_sym] == SIZE_MAX) structs->typedefs[def.tdef_sym] = index;
+  }
+  ARENA_PUSH(&structs->arena, *structs, items, def);
+}
+
+// index of the struct with tag (`is_struct`) or typedef name `name`, SIZE_MAX if unknown
+size_t structs_find(const StructArr *structs, String_View name, bool is_struct) {
+  Symbol symbol = symtab_find(&structs->symbols, name);
+  if (is_struct) return symbol < structs->tags_count ? structs->tags[symbol] : SIZE_MAX;
+  return symbol < structs->typedefs_count ? structs->typedefs[symbol] : SIZE_MAX;
+}
+
+// Children are always added after their parent, so a single pass in order builds every
+// body from its parent's finished one, without walking the chain again for each child
+void flatten_structs(StructArr *structs) {
+  for (size_t i = 0; i < structs->items_count; ++i) {
+    StructDef *def = &structs->items[i];
+    if (!def->hasParent) {
+      def->body = def->defn;
+      continue;
+    }
+    assert(def->parent < i);
+    const String_View parent = structs->items[def->parent].body;
+    char *body = arena_alloc(&structs->arena, parent.count + def->defn.count);
+    memcpy(body, parent.data, parent.count);
+    memcpy(body + parent.count, def->defn.data, def->defn.count);
+    def->body = sv_from_parts(body, parent.count + def->defn.count);
+  }
+}
+
+// Numbers the inheritance forest depth first, so every descendant closure is one
+// contiguous range instead of a tree walk per struct and cast variant
+void order_descendants(StructArr *structs) {
+  structs->preorder_count = 0;
+  struct { MAKE_ARRAY(size_t, items) } stack = {0};
+  for (size_t root = 0; root < structs->items_count; ++root) {
+    if (structs->items[root].hasParent) continue;
+    ARRAY_PUSH(stack, items, root);
+    while (stack.items_count) {
+      const size_t index = stack.items[--stack.items_count];
+      StructDef *def = &structs->items[index];
+      def->pre = structs->preorder_count;
+      def->descendants = 0;
+      ARENA_PUSH(&structs->arena, *structs, preorder, index);
+      for (size_t i = def->inherits_count; i-- > 0;) ARRAY_PUSH(stack, items, SMALL_ARRAY_ITEMS(*def, inherits)[i]);
+    }
+  }
+  free(stack.items);
+  // children follow their parent, so in reverse every subtree is complete before its parent
+  for (size_t i = structs->preorder_count; i-- > 0;) {
+    const StructDef *def = &structs->items[structs->preorder[i]];
+    if (def->hasParent) structs->items[def->parent].descendants += def->descendants + 1;
+  }
+}
+
+// fields of shared items belong to the include table, so they are freed with its arena
+void structs_free(StructArr *structs) {
+  arena_free(&structs->arena);
+  symtab_free(&structs->symbols);
+}
+
+// reads a file that cannot be mapped (pipe, character device) into anonymous memory
+String_View read_unmappable(int fd, const char *filename) {
+  const size_t page = sysconf(_SC_PAGESIZE);
+  size_t cap = 16 * page;
+  size_t count = 0;
+  char *data = mmap(NULL, cap, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (data == MAP_FAILED) {
+    perror("mmap");
     exit(1);
   }
-  POSIX_WORK(fseek, f, 0, SEEK_END);
-  long size = ftell(f);
-  if (size < 0) {
-    perror("ftell");
+  ssize_t n;
+  while ((n = read(fd, data + count, cap - count)) > 0) {
+    count += n;
+    if (count < cap) continue;
+    data = mremap(data, cap, cap * 2, MREMAP_MAYMOVE);
+    if (data == MAP_FAILED) {
+      perror("mremap");
+      exit(1);
+    }
+    cap *= 2;
+  }
+  if (n < 0) {
+    fprintf(stderr, "Could not read file `%s`: %s\n", filename, strerror(errno));
     exit(1);
   }
-  POSIX_WORK(fseek, f, 0, SEEK_SET);
+  // drop unused pages, so `unload_file` can unmap by count; the rest of the last page stays zero
+  const size_t used = (count / page + 1) * page;
+  if (used < cap) POSIX_WORK(munmap, data + used, cap - used);
+  return (String_View) {
+    .count = count,
+    .data = data,
+  };
+}
 
-  char *ptr = malloc(size + 1);
-  if (fread(ptr, size, 1, f) != 1 && ferror(f)) { // read one entire buffer or fail
-    perror("fread");
+// maps `filename` private and writable, guaranteeing a NUL byte after its end
+// with `populate`, the whole file is read in right away instead of faulting page by page
+String_View load_file(const char *filename, bool populate) {
+  int fd = open(filename, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    fprintf(stderr, "Could not open file `%s`: %s\n", filename, strerror(errno));
+    exit(1);
+  }
+  struct stat st;
+  POSIX_WORK(fstat, fd, &st);
+  if (!S_ISREG(st.st_mode)) {
+    String_View file = read_unmappable(fd, filename);
+    POSIX_WORK(close, fd);
+    return file;
+  }
+  const size_t size = st.st_size;
+  const size_t page = sysconf(_SC_PAGESIZE);
+  const int flags = MAP_PRIVATE | (populate ? MAP_POPULATE : 0);
+  char *data;
+  if (size % page != 0) {
+    // the kernel zero-fills the rest of the last page
+    data = mmap(NULL, size, PROT_READ | PROT_WRITE, flags, fd, 0);
+  } else {
+    // no room for a terminator: reserve a zero page behind the file and map the file before it
+    data = mmap(NULL, size + page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (data != MAP_FAILED && size) data = mmap(data, size, PROT_READ | PROT_WRITE, flags | MAP_FIXED, fd, 0);
+  }
+  if (data == MAP_FAILED) {
+    fprintf(stderr, "Could not map file `%s`: %s\n", filename, strerror(errno));
     exit(1);
   }
-  POSIX_WORK(fclose, f);
-  ptr[size] = 0;
+  if (size) madvise(data, size, MADV_SEQUENTIAL); // only a hint, failure does not matter
+  POSIX_WORK(close, fd);
+  assert(data[size] == 0);
   return (String_View) {
     .count = size,
-    .data = ptr,
+    .data = data,
   };
 }
 
-char *struct_to_name(StructDef def, bool include_struct_body) {
+void unload_file(String_View file) {
+  POSIX_WORK(munmap, (void *)file.data, file.count + 1); // includes the terminator page
+}
+
+TokenCursor cursor_create(TokenBuffer *tokens, size_t start, size_t end) {
+  return (TokenCursor) {
+    .tokens = tokens,
+    .pos = start,
+    .end = end,
+    .lexed = tokens->lexer.source.data + (start < tokens->count ? tokens->offsets[start] : tokens->lexer.source.count),
+  };
+}
+
+TokenOrEnd cursor_peek(TokenCursor *cur) {
+  if (cur->pos >= cur->end) {
+    const TokenBuffer *tokens = cur->tokens;
+    cur->lexed = tokens->lexer.source.data + (cur->end < tokens->count ? tokens->offsets[cur->end] : tokens->lexer.source.count);
+    return (TokenOrEnd) {0};
+  }
+  TokenOrEnd token = { .has_value = true, .token = tokens_at(cur->tokens, cur->pos) };
+  cur->lexed = token.token.content.data + token.token.content.count;
+  return token;
+}
+
+TokenOrEnd cursor_get(TokenCursor *cur) {
+  TokenOrEnd token = cursor_peek(cur);
+  if (token.has_value) cur->pos += 1;
+  return token;
+}
+
+Location cursor_loc(TokenCursor *cur, const char *at) {
+  return lexer_loc(&cur->tokens->lexer, at);
+}
+
+Token cursor_expect(TokenCursor *cur) {
+  TokenOrEnd token = cursor_get(cur);
+  if (!token.has_value)
+    lexer_exit_err(cursor_loc(cur, cur->lexed), stderr, "Expected token but got end of file");
+  return token.token;
+}
+
+char *struct_to_name(Arena *arena, StructDef def) {
   const size_t n = def.strt.count ? sizeof("struct ") - 1 + def.strt.count : 0;
   const size_t m = n && def.tdef.count ? 3 : 0;
-  char *fname = malloc(n + def.tdef.count + m + 1 + include_struct_body ? sizeof(" struct body") - 1 : 0);
-  if (fname == NULL) {
-    perror("malloc filename");
-    exit(1);
-  }
+  char *fname = arena_alloc(arena, n + def.tdef.count + m + 1);
+  fname[0] = 0;
   if (n) {
     strcpy(fname, "struct ");
     strncat(fname, def.strt.data, def.strt.count);
   }
   if (m) strcat(fname, " / ");
-  strncat(fname, def.tdef.data, def.tdef.count);
-  if (include_struct_body) strcat(fname, " struct body");
+  if (def.tdef.count) strncat(fname, def.tdef.data, def.tdef.count);
   return fname;
 }
 
-bool parse_structdef(Lexer *lexer, String_View *strt, String_View *def, bool *is_struct, String_View *who) {
+// parses `[name] [(parent)] { body }` into `def`
+bool parse_structdef(TokenCursor *cur, StructDef *def, bool *is_struct, String_View *who) {
   bool is_inherit = false;
-  TokenOrEnd nameOrParen = lexer_peek_token(lexer);
+  TokenOrEnd nameOrParen = cursor_peek(cur);
   if (nameOrParen.has_value && nameOrParen.token.kind == TK_NAME) {
-    *strt = nameOrParen.token.content;
-    lexer_expect_token(lexer);
+    def->strt = nameOrParen.token.content;
+    cursor_expect(cur);
   }
-  Token paren = lexer_expect_token(lexer);
+  Token paren = cursor_expect(cur);
   if (paren.kind != TK_PAREN)
-    lexer_exit_err(paren.loc, stderr, "Expected identifier or `{'");
+    lexer_exit_err(cursor_loc(cur, paren.content.data), stderr, "Expected identifier or `{'");
   if (sv_eq(paren.content, SV("("))) {
     is_inherit = true;
-    TokenOrEnd nameOrStruct = lexer_peek_token(lexer);
+    TokenOrEnd nameOrStruct = cursor_peek(cur);
     if (nameOrStruct.has_value && nameOrStruct.token.kind == TK_STRUCT) {
       if (is_struct) *is_struct = true;
-      lexer_expect_token(lexer);
+      cursor_expect(cur);
     }
-    Token name = lexer_expect_token(lexer);
+    Token name = cursor_expect(cur);
     if (name.kind != TK_NAME)
-      lexer_exit_err(paren.loc, stderr, "Expected identifier or `struct'");
+      lexer_exit_err(cursor_loc(cur, paren.content.data), stderr, "Expected identifier or `struct'");
     if (who) *who = name.content;
-    Token closeParen = lexer_expect_token(lexer);
+    Token closeParen = cursor_expect(cur);
     if (closeParen.kind != TK_PAREN || !sv_eq(closeParen.content, SV(")")))
-      lexer_exit_err(closeParen.loc, stderr, "Expected `)'");
-    paren = lexer_expect_token(lexer);
+      lexer_exit_err(cursor_loc(cur, closeParen.content.data), stderr, "Expected `)'");
+    paren = cursor_expect(cur);
   }
   if (paren.kind != TK_PAREN || !sv_eq(paren.content, SV("{")))
-    lexer_exit_err(paren.loc, stderr, "Expected identifier or `{'");
+    lexer_exit_err(cursor_loc(cur, paren.content.data), stderr, "Expected identifier or `{'");
   
-  *def = lexer->content;
-  TokenOrEnd ntoken = lexer_peek_token(lexer);
+  def->defn = sv_from_parts(cur->lexed, 0);
+  def->tokens = cur->tokens;
+  def->body_start = cur->pos;
+  size_t depth = 0;
+  TokenOrEnd ntoken = cursor_peek(cur);
   while (ntoken.has_value) {
     // TODO: maybe error check definition contents
-    if (ntoken.token.kind == TK_PAREN && sv_eq(ntoken.token.content, SV("}")))
-      break;
-    lexer_expect_token(lexer);
-    ntoken = lexer_peek_token(lexer);
+    if (ntoken.token.kind == TK_PAREN && sv_eq(ntoken.token.content, SV("{")))
+      depth += 1;
+    if (ntoken.token.kind == TK_PAREN && sv_eq(ntoken.token.content, SV("}"))) {
+      if (depth == 0) break;
+      depth -= 1;
+    }
+    cursor_expect(cur);
+    ntoken = cursor_peek(cur);
   }
-  Token closeParen = lexer_expect_token(lexer);
+  def->body_end = cur->pos;
+  Token closeParen = cursor_expect(cur);
   if (closeParen.kind != TK_PAREN || !sv_eq(closeParen.content, SV("}")))
-    lexer_exit_err(closeParen.loc, stderr, "Expected `}'");
-  def->count = closeParen.content.data - def->data;
+    lexer_exit_err(cursor_loc(cur, closeParen.content.data), stderr, "Expected `}'");
+  def->defn.count = closeParen.content.data - def->defn.data;
   return is_inherit;
 }
 
-void parse_struct(StructArr *structs, Lexer *lexer) {
-  String_View strt = {0}, def = {0};
-  if (parse_structdef(lexer, &strt, &def, NULL, NULL)) return;
-  
-  StructDef item = (StructDef) {
-    .defn = def,
-    .strt = strt,
-  };
-  ARRAY_PUSH(*structs, items, item);
+// Only `struct [name] {` (or `struct [name] (parent) {` with `allow_parent`) starts a definition,
+// everything else (forward declarations, `struct foo *ptr`, ...) merely uses the type
+bool struct_has_body(TokenCursor cur, bool allow_parent) {
+  TokenOrEnd token = cursor_peek(&cur);
+  if (token.has_value && token.token.kind == TK_NAME) {
+    cursor_get(&cur);
+    token = cursor_peek(&cur);
+  }
+  if (!token.has_value || token.token.kind != TK_PAREN) return false;
+  return sv_eq(token.token.content, SV("{")) || (allow_parent && sv_eq(token.token.content, SV("(")));
+}
+
+void parse_struct(StructArr *structs, TokenCursor *cur) {
+  if (!struct_has_body(*cur, false)) return;
+  StructDef item = {0};
+  if (parse_structdef(cur, &item, NULL, NULL)) return;
+  structs_push(structs, item);
 }
 
-void parse_typedef(StructArr *structs, Lexer *lexer) {
-  Token token = lexer_expect_token(lexer);
+void parse_typedef(StructArr *structs, TokenCursor *cur) {
+  Token token = cursor_expect(cur);
   if (token.kind != TK_STRUCT) return;
-  String_View strt = {0}, def = {0};
-  if (parse_structdef(lexer, &strt, &def, NULL, NULL)) return;
+  if (!struct_has_body(*cur, false)) return;
+  StructDef item = {0};
+  if (parse_structdef(cur, &item, NULL, NULL)) return;
   
-  TokenOrEnd nameOrSemi = lexer_peek_token(lexer);
-  String_View tpdef;
+  TokenOrEnd nameOrSemi = cursor_peek(cur);
   if (nameOrSemi.has_value && nameOrSemi.token.kind == TK_NAME) {
-    tpdef = nameOrSemi.token.content;
-    lexer_expect_token(lexer);
+    item.tdef = nameOrSemi.token.content;
+    cursor_expect(cur);
   }
-  
-  StructDef item = (StructDef) {
-    .defn = def,
-    .strt = strt,
-    .tdef = tpdef,
-  };
-  ARRAY_PUSH(*structs, items, item);
+  structs_push(structs, item);
 }
 
-StructArr collect_structs(const char *filename) {
-  String_View file = preprocess_file(filename);
-  assert(file.data[file.count] == 0);
+#define LEX_CHUNK_SIZE (1024 * 1024) // smallest piece worth a thread of its own
 
-  StructArr structs = {
-    .orig = file.data,
-  };
-  char *fname = malloc(strlen(filename) + sizeof(" (preprocessed)"));
-  if (fname == NULL) {
-    perror("malloc filename");
+typedef struct {
+  String_View name;
+  String_View text;
+  size_t start;
+  size_t end;
+  TokenBuffer *tokens;
+} LexChunk;
+
+static void *lex_chunk(void *arg) {
+  LexChunk *chunk = arg;
+  *chunk->tokens = tokens_lex_range(chunk->name, chunk->text, chunk->start, chunk->end);
+  return NULL;
+}
+
+// Lexes `text` split at safe line starts on up to `threads` threads, the tokens are the
+// same as of tokens_lex: any lexer error can only be in the last piece, which is lexed
+// on the calling thread, so it is reported like when lexing sequentially.
+TokenBuffer lex_parallel(String_View name, String_View text, size_t threads) {
+  if (threads <= 1 || text.count < 2 * LEX_CHUNK_SIZE) return tokens_lex(name, text);
+  size_t *splits = malloc((threads - 1) * sizeof(size_t));
+  if (splits == NULL) {
+    perror("malloc splits");
     exit(1);
   }
-  strcpy(fname, filename);
-  strcat(fname, " (preprocessed)");
-  Lexer lexer = lexer_create(sv_from_cstr(fname), file);
+  const size_t chunk = text.count / threads > LEX_CHUNK_SIZE ? text.count / threads : LEX_CHUNK_SIZE;
+  const size_t pieces = 1 + tokens_split(text, chunk, splits, threads - 1);
+  LexChunk *chunks = malloc(pieces * sizeof(LexChunk));
+  TokenBuffer *buffers = malloc(pieces * sizeof(TokenBuffer));
+  pthread_t *workers = malloc(pieces * sizeof(pthread_t));
+  if (chunks == NULL || buffers == NULL || workers == NULL) {
+    perror("malloc chunks");
+    exit(1);
+  }
+  for (size_t i = 0; i < pieces; ++i) {
+    chunks[i] = (LexChunk) {
+      .name = name,
+      .text = text,
+      .start = i == 0 ? 0 : splits[i - 1],
+      .end = i == pieces - 1 ? text.count : splits[i],
+      .tokens = &buffers[i],
+    };
+  }
+  for (size_t i = 0; i + 1 < pieces; ++i) PTHREAD_WORK(pthread_create, &workers[i], NULL, lex_chunk, &chunks[i]);
+  lex_chunk(&chunks[pieces - 1]);
+  for (size_t i = 0; i + 1 < pieces; ++i) PTHREAD_WORK(pthread_join, workers[i], NULL);
+  TokenBuffer tokens = tokens_join(buffers, pieces);
+  free(workers);
+  free(buffers);
+  free(chunks);
+  free(splits);
+  return tokens;
+}
+
+StructArr collect_structs(TokenBuffer *tokens) {
+  assert(tokens->lexer.source.data[tokens->lexer.source.count] == 0);
+
+  StructArr structs = {0};
+  TokenCursor cur = cursor_create(tokens, 0, tokens->count);
   size_t depth = 0;
 
-  TokenOrEnd token = lexer_get_token(&lexer);
-  for (; token.has_value; token = lexer_get_token(&lexer)) {
+  TokenOrEnd token = cursor_get(&cur);
+  for (; token.has_value; token = cursor_get(&cur)) {
     Token t = token.token;
     if (t.kind == TK_PAREN && sv_eq(t.content, SV("}"))) {
       depth -= 1;
@@ -255,45 +967,337 @@ StructArr collect_structs(const char *filename) {
       continue;
     }
     if (t.kind == TK_TYPEDF) {
-      parse_typedef(&structs, &lexer);
+      parse_typedef(&structs, &cur);
       continue;
     }
     if (t.kind == TK_STRUCT) {
-      parse_struct(&structs, &lexer);
+      parse_struct(&structs, &cur);
       continue;
     }
     // ignore everything else
   }
   if (depth != 0)
-    lexer_exit_err(lexer.loc, stderr, "Unclosed block");
+    lexer_exit_err(cursor_loc(&cur, cur.lexed), stderr, "Unclosed block");
   
-  free(fname);
   return structs;
 }
 
-bool parse_struct_inherit(Lexer *lexer, String_View *strt, String_View *def, bool *is_struct, String_View *who) {
-  return parse_structdef(lexer, strt, def, is_struct, who);
+char *dir_of(const char *filename) {
+  const char *slash = strrchr(filename, '/');
+  char *dir = slash == NULL ? strdup(".") : slash == filename ? strdup("/") : strndup(filename, slash - filename);
+  char *real = realpath(dir, NULL); // tables are shared between different working directories in server mode
+  if (real == NULL) {
+    fprintf(stderr, "Could not resolve directory `%s`: %s\n", dir, strerror(errno));
+    exit(1);
+  }
+  free(dir);
+  return real;
+}
+
+// whether the file has `#if`, `#ifdef`, `#elif`, `#else`, ...
+static bool has_conditionals(const TokenBuffer *tokens) {
+  for (size_t i = 0; i < tokens->count; ++i) {
+    if (tokens->kinds[i] != TK_DIRECTIVE) continue;
+    String_View name = sv_trim_left(sv_from_parts(tokens->lexer.source.data + tokens->offsets[i] + 1, tokens->lengths[i] - 1));
+    if (sv_starts_with(name, SV("if")) || sv_starts_with(name, SV("el"))) return true;
+  }
+  return false;
+}
+
+// collects all preprocessor directives of `file`, this is all that influences the included structs
+// If the file has conditionals, every run of its code between directives is replaced by
+// `typedef CEST_SEGMENT <n>;`: only those of active runs reach the preprocessed text.
+String_View extract_prelude(const TokenBuffer *tokens) {
+  StringBuilder sb = {0};
+  const bool segments = has_conditionals(tokens);
+  size_t segment = 0;
+  bool in_code = false;
+  for (size_t i = 0; i < tokens->count; ++i) {
+    if (tokens->kinds[i] == TK_COMMENT) continue;
+    if (tokens->kinds[i] != TK_DIRECTIVE) {
+      if (segments && !in_code) {
+        char marker[64];
+        const int n = snprintf(marker, sizeof(marker), "typedef " SEGMENT_STR " %zu;\n", segment++);
+        sb_append(&sb, marker, n);
+      }
+      in_code = true;
+      continue;
+    }
+    in_code = false;
+    Token token = tokens_at(tokens, i);
+    sb_append(&sb, token.content.data, token.content.count);
+    sb_append(&sb, "\n", 1);
+  }
+  return (String_View) {
+    .count = sb.items_count,
+    .data = sb.items,
+  };
+}
+
+void table_add_dep(IncludeTable *table, String_View path) {
+  if (path.count == 0 || path.data[0] == '<') return; // <stdin>, <built-in>, <command-line>
+  char *full;
+  if (path.data[0] == '/') {
+    full = strndup(path.data, path.count);
+  } else {
+    full = malloc(strlen(table->dir) + 1 + path.count + 1);
+    if (full) sprintf(full, "%s/" SV_Fmt, table->dir, SV_Arg(path));
+  }
+  if (full == NULL) {
+    perror("malloc dependency");
+    exit(1);
+  }
+  for (size_t i = 0; i < table->deps_count; ++i) {
+    if (strcmp(table->deps[i].path, full) == 0) {
+      free(full);
+      return;
+    }
+  }
+  Dependency dep = { .path = full };
+  struct stat st;
+  if (stat(full, &st) == 0) dep.mtime = st.st_mtim;
+  ARRAY_PUSH(*table, deps, dep);
+}
+
+// finds the markers of active code in the text, see `extract_prelude`
+void collect_segments(IncludeTable *table) {
+  if (memmem(table->prelude.data, table->prelude.count, SEGMENT_STR, sizeof(SEGMENT_STR) - 1) == NULL) return;
+  const TokenBuffer *tokens = &table->tokens;
+  for (size_t i = 0; i + 2 < tokens->count; ++i) {
+    if (tokens->kinds[i] != TK_TYPEDF || tokens->kinds[i + 1] != TK_NAME || tokens->kinds[i + 2] != TK_LIT) continue;
+    if (!sv_eq(tokens_at(tokens, i + 1).content, SV(SEGMENT_STR))) continue;
+    ARRAY_PUSH(*table, segments, strtoul(tokens_at(tokens, i + 2).content.data, NULL, 10));
+  }
+}
+
+void collect_deps(IncludeTable *table) {
+  String_View text = table->text;
+  while (text.count) {
+    String_View path;
+    if (linemarker_path(sv_chop_by_delim(&text, '\n'), &path)) table_add_dep(table, path);
+  }
+}
+
+bool table_is_fresh(const IncludeTable *table) {
+  for (size_t i = 0; i < table->deps_count; ++i) {
+    struct stat st;
+    if (stat(table->deps[i].path, &st) < 0) return false;
+    if (st.st_mtim.tv_sec != table->deps[i].mtime.tv_sec || st.st_mtim.tv_nsec != table->deps[i].mtime.tv_nsec)
+      return false;
+  }
+  return true;
+}
+
+void include_table_free(IncludeTable *table) {
+  free(table->dir);
+  free((void *)table->config.data);
+  free(table->name);
+  free((void *)table->prelude.data);
+  structs_free(&table->structs);
+  tokens_free(&table->tokens);
+  if (table->text_mapped) unload_file(table->text);
+  else free((void *)table->text.data);
+  for (size_t i = 0; i < table->deps_count; ++i) free(table->deps[i].path);
+  free((void *)table->deps);
+  free((void *)table->segments);
+  free(table);
+}
+
+void include_cache_init(IncludeCache *cache) {
+  *cache = (IncludeCache) {0};
+  PTHREAD_WORK(pthread_mutex_init, &cache->lock, NULL);
+  PTHREAD_WORK(pthread_cond_init, &cache->cond, NULL);
+}
+
+IncludeTable *include_cache_find(IncludeCache *cache, const char *dir, String_View config, String_View prelude) {
+  for (size_t i = 0; i < cache->items_count; ++i) {
+    IncludeTable *table = cache->items[i];
+    if (strcmp(table->dir, dir) == 0 && sv_eq(table->config, config) && sv_eq(table->prelude, prelude)) return table;
+  }
+  return NULL;
+}
+
+void include_cache_remove(IncludeCache *cache, IncludeTable *table) {
+  for (size_t i = 0; i < cache->items_count; ++i) {
+    if (cache->items[i] != table) continue;
+    cache->items[i] = cache->items[--cache->items_count];
+    return;
+  }
+}
+
+// returns the table for the includes of `filename`, takes ownership of `prelude`
+// the first caller builds the table, concurrent callers with the same prelude wait for it
+IncludeTable *include_cache_get(IncludeCache *cache, const Options *opts, const char *filename, String_View prelude) {
+  char *dir = dir_of(filename);
+  PTHREAD_WORK(pthread_mutex_lock, &cache->lock);
+  IncludeTable *table = include_cache_find(cache, dir, opts->pp_key, prelude);
+  if (table) {
+    while (!table->ready) PTHREAD_WORK(pthread_cond_wait, &cache->cond, &cache->lock);
+    if (!cache->revalidate || table_is_fresh(table)) {
+      PTHREAD_WORK(pthread_mutex_unlock, &cache->lock);
+      free(dir);
+      free((void *)prelude.data);
+      return table;
+    }
+    // other workers may still use the stale table, it is only dropped from the cache
+    include_cache_remove(cache, table);
+  }
+  table = calloc(1, sizeof(IncludeTable));
+  char *name = malloc(strlen(filename) + sizeof(" (preprocessed)"));
+  char *config = strndup(opts->pp_key.data, opts->pp_key.count);
+  if (table == NULL || name == NULL || config == NULL) {
+    perror("malloc include table");
+    exit(1);
+  }
+  strcpy(name, filename);
+  strcat(name, " (preprocessed)");
+  *table = (IncludeTable) {
+    .dir = dir,
+    .config = sv_from_parts(config, opts->pp_key.count),
+    .prelude = prelude,
+    .name = name,
+  };
+  ARRAY_PUSH(*cache, items, table);
+  PTHREAD_WORK(pthread_mutex_unlock, &cache->lock);
+
+  StatsMark mark = stats_begin(opts->stats);
+  StructFilter filter = {0};
+  if (opts->preprocessed) {
+    table->text = load_file(opts->preprocessed, opts->populate);
+    table->text_mapped = true;
+    table_add_dep(table, sv_from_cstr(opts->preprocessed));
+  } else {
+    table->text = preprocess_prelude(&opts->pp, table->dir, table->prelude, opts->stream ? &filter : NULL);
+  }
+  if (opts->stream) {
+    if (table->text_mapped) {
+      filter_feed(&filter, table->text.data, table->text.count);
+      unload_file(table->text);
+      table->text_mapped = false;
+    }
+    table->text = filter_finish(&filter, table->name);
+  }
+  stats_end(opts->stats, PHASE_PREPROCESS, mark, filename);
+  stats_count(opts->stats, COUNT_BYTES_READ, opts->stream ? filter.text_size : table->text.count);
+  mark = stats_begin(opts->stats);
+  table->tokens = lex_parallel(sv_from_cstr(table->name), table->text, opts->lex_threads);
+  stats_end(opts->stats, PHASE_LEX, mark, filename);
+  stats_count(opts->stats, COUNT_TOKENS, table->tokens.count);
+  mark = stats_begin(opts->stats);
+  table->structs = collect_structs(&table->tokens);
+  stats_end(opts->stats, PHASE_STRUCTS, mark, filename);
+  stats_count(opts->stats, COUNT_STRUCTS, table->structs.items_count);
+  collect_segments(table);
+  if (opts->stream) {
+    for (size_t at = 0; at < filter.deps.items_count; at += strlen(filter.deps.items + at) + 1)
+      table_add_dep(table, sv_from_cstr(filter.deps.items + at));
+    free(filter.deps.items);
+  } else {
+    collect_deps(table);
+  }
+
+  PTHREAD_WORK(pthread_mutex_lock, &cache->lock);
+  table->ready = true;
+  PTHREAD_WORK(pthread_cond_broadcast, &cache->cond);
+  PTHREAD_WORK(pthread_mutex_unlock, &cache->lock);
+  return table;
+}
+
+// adds a completely built table, replacing any older table for the same prelude
+void include_cache_put(IncludeCache *cache, IncludeTable *table) {
+  table->ready = true;
+  PTHREAD_WORK(pthread_mutex_lock, &cache->lock);
+  IncludeTable *old = include_cache_find(cache, table->dir, table->config, table->prelude);
+  if (old) {
+    include_cache_remove(cache, old);
+    include_table_free(old);
+  }
+  ARRAY_PUSH(*cache, items, table);
+  PTHREAD_WORK(pthread_mutex_unlock, &cache->lock);
+}
+
+void include_cache_free(IncludeCache *cache) {
+  for (size_t i = 0; i < cache->items_count; ++i) include_table_free(cache->items[i]);
+  free((void *)cache->items);
+  PTHREAD_WORK(pthread_mutex_destroy, &cache->lock);
+  PTHREAD_WORK(pthread_cond_destroy, &cache->cond);
+}
+
+// per-file copy of the shared structs, children are only ever added to the copy
+StructArr structs_from_table(const IncludeTable *table) {
+  StructArr structs = { .symbols = symtab_extend(&table->structs.symbols) };
+  ARENA_EXTEND(&structs.arena, structs, items, table->structs.items_count);
+  for (size_t i = 0; i < table->structs.items_count; ++i) {
+    StructDef def = table->structs.items[i];
+    def.inherits_count = def.inherits_cap = 0;
+    structs.items[structs.items_count++] = def;
+  }
+  structs.shared = structs.items_count;
+  for (size_t i = 0; i < table->structs.tags_count; ++i) ARENA_PUSH(&structs.arena, structs, tags, table->structs.tags[i]);
+  for (size_t i = 0; i < table->structs.typedefs_count; ++i) ARENA_PUSH(&structs.arena, structs, typedefs, table->structs.typedefs[i]);
+  return structs;
+}
+
+// Code of the file in inactive conditionals is not looked at for plain structs, like the
+// preprocessor would not have passed it on. Without a marker in the text (also with
+// --preprocessed, where the text has the active structs of the file) nothing is active.
+void skip_inactive(StructArr *structs, const TokenBuffer *tokens, const IncludeTable *table) {
+  if (!has_conditionals(tokens)) return;
+  size_t segment = 0, found = 0;
+  bool in_code = false;
+  for (size_t i = 0; i < tokens->count; ++i) {
+    if (tokens->kinds[i] == TK_COMMENT) continue;
+    if (tokens->kinds[i] == TK_DIRECTIVE) {
+      if (in_code && structs->skipped_count % 2) ARENA_PUSH(&structs->arena, *structs, skipped, i);
+      in_code = false;
+      continue;
+    }
+    if (in_code) continue;
+    in_code = true;
+    while (found < table->segments_count && table->segments[found] < segment) found += 1;
+    if (found == table->segments_count || table->segments[found] != segment) ARENA_PUSH(&structs->arena, *structs, skipped, i);
+    segment += 1;
+  }
+  if (structs->skipped_count % 2) ARENA_PUSH(&structs->arena, *structs, skipped, tokens->count);
 }
 
-bool parse_typedef_inherit(Lexer *lexer, String_View *strt, String_View *def, String_View *tpdef, bool *is_struct, String_View *who) {
-  Token token = lexer_expect_token(lexer);
+static bool token_skipped(const StructArr *structs, size_t i) {
+  for (size_t r = 0; r < structs->skipped_count; r += 2)
+    if (i >= structs->skipped[r] && i < structs->skipped[r + 1]) return true;
+  return false;
+}
+
+bool parse_struct_inherit(TokenCursor *cur, StructDef *def, bool *is_struct, String_View *who) {
+  return parse_structdef(cur, def, is_struct, who);
+}
+
+// returns whether the struct inherits, `def->defn` is only set if it has a body
+bool parse_typedef_inherit(TokenCursor *cur, StructDef *def, bool *is_struct, String_View *who) {
+  Token token = cursor_expect(cur);
   if (token.kind != TK_STRUCT) return false;
-  if (!parse_structdef(lexer, strt, def, is_struct, who)) return false;
+  if (!struct_has_body(*cur, true)) return false;
+  bool is_inherit = parse_structdef(cur, def, is_struct, who);
   
-  TokenOrEnd nameOrSemi = lexer_peek_token(lexer);
+  TokenOrEnd nameOrSemi = cursor_peek(cur);
   if (nameOrSemi.has_value && nameOrSemi.token.kind == TK_NAME) {
-    *tpdef = nameOrSemi.token.content;
-    lexer_expect_token(lexer);
+    def->tdef = nameOrSemi.token.content;
+    cursor_expect(cur);
   }
-  return true;
+  return is_inherit;
 }
 
-void collect_inherits(StructArr *structs, String_View file, String_View filename) {
-  Lexer lexer = lexer_create(filename, file);
+void collect_inherits(StructArr *structs, TokenBuffer *tokens) {
+  // only whole names are markers, not ones in comments, literals or directives
+  for (size_t i = 0; i < tokens->count; ++i) {
+    if (tokens->kinds[i] != TK_NAME || tokens->lengths[i] != sizeof(INSERT_STR) - 1) continue;
+    const char *at = tokens->lexer.source.data + tokens->offsets[i];
+    if (memcmp(at, INSERT_STR, sizeof(INSERT_STR) - 1) == 0) ARENA_PUSH(&structs->arena, *structs, markers, at);
+  }
+  TokenCursor cur = cursor_create(tokens, 0, tokens->count);
 
   size_t depth = 0;
-  TokenOrEnd token = lexer_get_token(&lexer);
-  for (; token.has_value; token = lexer_get_token(&lexer)) {
+  TokenOrEnd token = cursor_get(&cur);
+  for (; token.has_value; token = cursor_get(&cur)) {
     Token t = token.token;
     if (t.kind == TK_PAREN && sv_eq(t.content, SV("}"))) {
       depth -= 1;
@@ -306,53 +1310,61 @@ void collect_inherits(StructArr *structs, String_View file, String_View filename
 
     if (t.kind != TK_TYPEDF && t.kind != TK_STRUCT) continue; // ignore everything else
 
+    const bool skipped = token_skipped(structs, cur.pos - 1);
     StructDef new = {0};
     String_View who = {0};
     bool is_struct = false;
     new.loc_start = t.content.data;
     
     if (t.kind == TK_TYPEDF) {
-      if (!parse_typedef_inherit(&lexer, &new.strt, &new.defn, &new.tdef, &is_struct, &who))
+      if (!parse_typedef_inherit(&cur, &new, &is_struct, &who)) {
+        if (new.defn.data && !skipped) structs_push(structs, new); // plain struct of this file
         continue;
+      }
       // typdef given but no name -> skip it
       if (new.tdef.count == 0) {
-        lexer_dump_warn(t.loc, stderr, "Warning: typedef but no name for child of `" SV_Fmt "`", SV_Arg(who));
+        lexer_dump_warn(cursor_loc(&cur, t.content.data), stderr, "Warning: typedef but no name for child of `" SV_Fmt "`", SV_Arg(who));
+        structs->diagnostics += 1;
         new.loc_start += t.content.count;
       }
     }
     if (t.kind == TK_STRUCT) {
-      if (!parse_struct_inherit(&lexer, &new.strt, &new.defn, &is_struct, &who))
+      if (!struct_has_body(cur, true)) continue;
+      if (!parse_struct_inherit(&cur, &new, &is_struct, &who)) {
+        if (!skipped) structs_push(structs, new); // plain struct of this file
         continue;
+      }
     }
     
-    new.loc_end = lexer.content.data - new.tdef.count;
+    new.loc_end = cur.lexed - new.tdef.count;
     if (!new.strt.count && !new.tdef.count) {
-      lexer_dump_warn(t.loc, stderr, "Warning: neither struct name nor typedef given for child of `" SV_Fmt "`", SV_Arg(who));
+      lexer_dump_warn(cursor_loc(&cur, t.content.data), stderr, "Warning: neither struct name nor typedef given for child of `" SV_Fmt "`", SV_Arg(who));
+      structs->diagnostics += 1;
     }
 
-    for (; token.has_value; token = lexer_get_token(&lexer)) {
+    for (; token.has_value; token = cursor_get(&cur)) {
       if (token.token.kind == TK_SEP && sv_eq(token.token.content, SV(";"))) {
-        new.loc_after = lexer.content.data;
+        new.loc_after = cur.lexed;
         break;
       }
     }
 
-    for (size_t i = 0; i < structs->items_count; ++i) {
-      if ((is_struct && sv_eq(who, structs->items[i].strt)) ||
-          (!is_struct && sv_eq(who, structs->items[i].tdef))) {
-        new.parent = i;
-        new.hasParent = true;
-        ARRAY_PUSH(*structs, items, new);
-        if (new.strt.count || new.tdef.count) // TODO: is this good? parent-child broken...
-          ARRAY_PUSH(structs->items[i], inherits, structs->items_count - 1);
-        break;
-      }
+    size_t parent = structs_find(structs, who, is_struct);
+    if (parent != SIZE_MAX) {
+      new.parent = parent;
+      new.hasParent = true;
+      structs_push(structs, new);
+      if (new.strt.count || new.tdef.count) // TODO: is this good? parent-child broken...
+        SMALL_ARRAY_PUSH(&structs->arena, structs->items[parent], inherits, structs->items_count - 1);
+    }
+    if (!new.hasParent) {
+      char *name = struct_to_name(&structs->arena, new);
+      lexer_dump_err(cursor_loc(&cur, t.content.data), stderr, "Error: no parent `" SV_Fmt "` known in definition of %s", SV_Arg(who), name);
+      structs->diagnostics += 1;
     }
-    if (!new.hasParent)
-      lexer_dump_err(t.loc, stderr, "Error: no parent `" SV_Fmt "` known in definition of %s", SV_Arg(who), struct_to_name(new, false));
   }
   if (depth != 0)
-    lexer_exit_err(lexer.loc, stderr, "Unclosed block");
+    lexer_exit_err(cursor_loc(&cur, cur.lexed), stderr, "Unclosed block");
 }
 
 #define WRITE(ptr, size) do                                          \
@@ -363,75 +1375,66 @@ void collect_inherits(StructArr *structs, String_View file, String_View filename
         exit(1);                                                     \
       }                                                              \
     } while (0);
-void dump_def(StructArr data, StructDef def, FILE *outfile) {
-  if (def.hasParent) dump_def(data, data.items[def.parent], outfile);
-  WRITE(def.defn.data, def.defn.count);
-}
-
-void dump_type_name(StructDef def, FILE *outfile) {
+void dump_type_name(const StructDef *def, FILE *outfile) {
   static char strut[] = "struct ";
-  if (def.strt.count) {
+  if (def->strt.count) {
     WRITE(strut, sizeof(strut) - 1);
-    WRITE(def.strt.data, def.strt.count);
+    WRITE(def->strt.data, def->strt.count);
   } else {
-    assert(def.tdef.count);
-    WRITE(def.tdef.data, def.tdef.count);
+    assert(def->tdef.count);
+    WRITE(def->tdef.data, def->tdef.count);
   }
 }
 
-String_View extract_property(Lexer *lexer) {
-  String_View last_name = {0};
-  while (true) {
-    Token token = lexer_expect_token(lexer);
-    if (token.kind == TK_NAME) last_name = token.content;
-    else if (token.kind == TK_SEP && sv_eq(token.content, SV(";"))) break;
+void dump_asserts(const StructArr *data, const StructDef *def, Arena *scratch, FILE *outfile) {
+  // dump asserts for all fields in parent chain, but with actual parent name
+  const StructDef *curparent = &data->items[def->parent];
+  struct { MAKE_ARRAY(size_t, items) } chain = {0};
+  for (size_t i = def->parent;; i = data->items[i].parent) {
+    ARENA_PUSH(scratch, chain, items, i);
+    if (!data->items[i].hasParent) break;
   }
-  return last_name;
-}
+  // fields of the root come first
+  for (size_t c = chain.items_count; c-- > 0;) {
+    const StructDef *parent = &data->items[chain.items[c]];
+    for (size_t i = 0; i < parent->fields_count; ++i) {
+      const Field *field = &parent->fields[i];
+      const Token at = tokens_at(parent->tokens, field->token);
+      switch (field->kind) {
+      case FIELD_NO_TYPE: lexer_exit_err(lexer_token_loc(&parent->tokens->lexer, at), stderr, "Expected a type"); break;
+      case FIELD_NO_NAME: lexer_exit_err(lexer_token_loc(&parent->tokens->lexer, at), stderr, "Not a valid property"); break;
+      case FIELD_BITFIELD: continue; // offsetof cannot be applied to bitfields
+      case FIELD_MEMBER: break;
+      }
 
-void dump_asserts(StructArr data, StructDef def, StructDef curparent, StructDef parent, FILE *outfile) {
-  // dump asserts for all fields in parent chain, but with actual parent name
-  if (parent.hasParent) dump_asserts(data, def, curparent, data.items[parent.parent], outfile);
+      static char assrt1[] = "_Static_assert(offsetof(";
+      static char assrt2[] = ") == offsetof(";
+      static char assrt3[] = "), \"Offsets don't match\");\n";
+      WRITE(assrt1, sizeof(assrt1) - 1);
+      dump_type_name(def, outfile);
+      WRITE(", ", 2);
+      WRITE(field->name.data, field->name.count);
+      WRITE(assrt2, sizeof(assrt2) - 1);
+      dump_type_name(curparent, outfile);
+      WRITE(", ", 2);
+      WRITE(field->name.data, field->name.count);
+      WRITE(assrt3, sizeof(assrt3) - 1);
+    }
+  }
+}
 
-  char *fname = struct_to_name(parent, true);
-  Lexer lexer = lexer_create(sv_from_cstr(fname), parent.defn);
-  TokenOrEnd token = lexer_get_token(&lexer);
-  for (; token.has_value; token = lexer_get_token(&lexer)) {
-    Token t = token.token;
-    if (t.kind != TK_NAME)
-      lexer_exit_err(t.loc, stderr, "Expected a type");
-    String_View property = extract_property(&lexer);
-    if (!property.count)
-      lexer_exit_err(t.loc, stderr, "Not a valid property");
-    
-    static char assrt1[] = "_Static_assert(offsetof(";
-    static char assrt2[] = ") == offsetof(";
-    static char assrt3[] = "), \"Offsets don't match\");\n";
-    WRITE(assrt1, sizeof(assrt1) - 1);
-    dump_type_name(def, outfile);
-    WRITE(", ", 2);
-    WRITE(property.data, property.count);
-    WRITE(assrt2, sizeof(assrt2) - 1);
-    dump_type_name(curparent, outfile);
-    WRITE(", ", 2);
-    WRITE(property.data, property.count);
-    WRITE(assrt3, sizeof(assrt3) - 1);
-  }
-  free(fname);
-}
-
-void dump_child_cast(StructArr data, StructDef in, String_View name, bool is_struct, bool ptr, FILE *outfile) {
+void dump_child_cast(const StructDef *in, String_View name, bool is_struct, bool ptr, FILE *outfile) {
   static char stut[] = "struct ";
   // <typename>: *(<parent>*)&(T)
   // or
   // <typename>*: (<parent>*)(T)
   WRITE(", ", 2);
-  if (in.strt.count) {
+  if (in->strt.count) {
     WRITE(stut, sizeof(stut) - 1);
-    WRITE(in.strt.data, in.strt.count);
+    WRITE(in->strt.data, in->strt.count);
   } else {
-    assert(in.tdef.count);
-    WRITE(in.tdef.data, in.tdef.count);
+    assert(in->tdef.count);
+    WRITE(in->tdef.data, in->tdef.count);
   }
   if (ptr) WRITE("*", 1);
   WRITE(": ", 2);
@@ -442,17 +1445,44 @@ void dump_child_cast(StructArr data, StructDef in, String_View name, bool is_str
   WRITE("*)", 2);
   if (!ptr) WRITE("&", 1);
   WRITE("(T)", 3);
+}
 
-  // recurse into children to allow casting up the chain
-  for (size_t i = 0; i < in.inherits_count; ++i) {
-    StructDef in2 = data.items[in.inherits[i]];
-    dump_child_cast(data, in2, name, is_struct, ptr, outfile);
+// CEST_AS_[struct_]<name>[S] is named in a --used-by source (or there is no --used-by)
+bool cast_used(const UsedBy *used, String_View name, bool is_struct, bool ptr) {
+  if (used == NULL) return true;
+  static char defc[] = "CEST_AS_";
+  static char strt[] = "struct_";
+  char stack[128];
+  const size_t n = (sizeof(defc) - 1) + (is_struct ? sizeof(strt) - 1 : 0) + name.count + ptr;
+  char *macro = n <= sizeof(stack) ? stack : malloc(n);
+  if (macro == NULL) {
+    perror("malloc cast name");
+    exit(1);
+  }
+  char *at = macro;
+  memcpy(at, defc, sizeof(defc) - 1);
+  at += sizeof(defc) - 1;
+  if (is_struct) {
+    memcpy(at, strt, sizeof(strt) - 1);
+    at += sizeof(strt) - 1;
   }
+  memcpy(at, name.data, name.count);
+  if (ptr) at[name.count] = 'S';
+  const bool found = symtab_find(&used->names, sv_from_parts(macro, n)) != NO_SYMBOL;
+  if (macro != stack) free(macro);
+  return found;
 }
 
-void dump_cast(StructArr data, StructDef def, String_View name,
+// the struct tag or typedef name of `def` is named in a --used-by source (or there is no --used-by)
+bool type_used(const UsedBy *used, const StructDef *def) {
+  if (used == NULL) return true;
+  if (def->strt.count && symtab_find(&used->names, def->strt) != NO_SYMBOL) return true;
+  return def->tdef.count && symtab_find(&used->names, def->tdef) != NO_SYMBOL;
+}
+
+void dump_cast(const StructArr *data, const UsedBy *used, const StructDef *def, String_View name,
     bool is_struct, bool ptr, FILE *outfile) {
-  if (!def.inherits_count) return;
+  if (!def->descendants || !cast_used(used, name, is_struct, ptr)) return;
   static char defc[] = "#define CEST_AS_";
   static char strt[] = "struct_";
   static char gene[] = "(T) _Generic((T)";
@@ -467,129 +1497,1053 @@ void dump_cast(StructArr data, StructDef def, String_View name,
   WRITE(name.data, name.count);
   if (ptr) WRITE("*", 1);
   WRITE(": (T)", 5);
-  for (size_t i = 0; i < def.inherits_count; ++i) {
-    StructDef in = data.items[def.inherits[i]];
-    dump_child_cast(data, in, name, is_struct, ptr, outfile);
+  // all descendants allow casting up the chain
+  for (size_t i = 1; i <= def->descendants; ++i) {
+    const StructDef *child = &data->items[data->preorder[def->pre + i]];
+    if (type_used(used, child)) dump_child_cast(child, name, is_struct, ptr, outfile);
   }
   WRITE(")\n", 2);
 }
 
-void output_casts(StructArr data, FILE *outfile) {
-  for (size_t i = 0; i < data.items_count; ++i) {
-    StructDef def = data.items[i];
-    if (def.strt.count) dump_cast(data, def, def.strt, true, false, outfile);
-    if (def.strt.count) dump_cast(data, def, def.strt, true, true, outfile);
-    if (def.tdef.count) dump_cast(data, def, def.tdef, false, false, outfile);
-    if (def.tdef.count) dump_cast(data, def, def.tdef, false, true, outfile);
+void output_casts(const StructArr *data, const UsedBy *used, FILE *outfile) {
+  for (size_t i = 0; i < data->items_count; ++i) {
+    const StructDef *def = &data->items[i];
+    if (def->strt.count) dump_cast(data, used, def, def->strt, true, false, outfile);
+    if (def->strt.count) dump_cast(data, used, def, def->strt, true, true, outfile);
+    if (def->tdef.count) dump_cast(data, used, def, def->tdef, false, false, outfile);
+    if (def->tdef.count) dump_cast(data, used, def, def->tdef, false, true, outfile);
   }
 }
 
-void replace_inherits(StructArr data, String_View file, FILE *outfile) {
-  char *ins = NULL;
+// copies `file`, replacing the definitions of children and every marker outside of them
+void replace_inherits(const StructArr *data, const UsedBy *used, String_View file, FILE *outfile) {
+  static const size_t marker = sizeof(INSERT_STR) - 1;
+  Arena scratch = {0}; // temporaries of one struct
   const char *last = file.data;
-  // items are guaranteed to be in order
-  for (size_t i = 0; i < data.items_count; ++i) {
-    StructDef def = data.items[i];
-    if (!def.hasParent) continue;
-    if ((ins = strstr(last, INSERT_STR)) != NULL && ins < def.loc_start) {
-      WRITE(last, ins - last);
-      output_casts(data, outfile);
-      WRITE(ins + sizeof(INSERT_STR) - 1, def.loc_start - (ins + sizeof(INSERT_STR) - 1));
-    } else {
-      WRITE(last, def.loc_start - last);
+  size_t m = 0; // next marker
+  // items are guaranteed to be in order, as are the markers
+  for (size_t i = 0; i < data->items_count; ++i) {
+    const StructDef *def = &data->items[i];
+    if (!def->hasParent) continue;
+    for (; m < data->markers_count && data->markers[m] < def->loc_start; ++m) {
+      WRITE(last, data->markers[m] - last);
+      output_casts(data, used, outfile);
+      last = data->markers[m] + marker;
     }
+    while (m < data->markers_count && data->markers[m] < def->loc_after) m += 1; // replaced with the struct
+    WRITE(last, def->loc_start - last);
     
     static char tpdef[] = "typedef ";
     static char strut[] = "struct ";
-    if (def.tdef.count) WRITE(tpdef, sizeof(tpdef) - 1);
+    if (def->tdef.count) WRITE(tpdef, sizeof(tpdef) - 1);
     WRITE(strut, sizeof(strut) - 1);
-    WRITE(def.strt.data, def.strt.count);
+    if (def->strt.count) WRITE(def->strt.data, def->strt.count);
     WRITE("{", 1);
-    dump_def(data, def, outfile);
+    WRITE(def->body.data, def->body.count);
     WRITE("}", 1);
-    WRITE(def.loc_end, def.loc_after - def.loc_end);
+    WRITE(def->loc_end, def->loc_after - def->loc_end);
     WRITE("\n", 1);
-    if (def.strt.count || def.tdef.count)
-      dump_asserts(data, def, data.items[def.parent], data.items[def.parent], outfile);
-    last = def.loc_after;
-  }
-  size_t rest = (file.data + file.count) - last;
-  if ((ins = strstr(last, INSERT_STR)) != NULL && ins < last + rest) {
-    WRITE(last, ins - last);
-    output_casts(data, outfile);
-    WRITE(ins + sizeof(INSERT_STR) - 1, file.data + file.count - (ins + sizeof(INSERT_STR) - 1));
-  } else {
-    WRITE(last, rest);
+    arena_reset(&scratch);
+    if (def->strt.count || def->tdef.count)
+      dump_asserts(data, def, &scratch, outfile);
+    last = def->loc_after;
+  }
+  for (; m < data->markers_count; ++m) {
+    WRITE(last, data->markers[m] - last);
+    output_casts(data, used, outfile);
+    last = data->markers[m] + marker;
   }
+  WRITE(last, (file.data + file.count) - last);
+  arena_free(&scratch);
 }
 #undef WRITE
 
-void print_struct_def(StructArr arr, StructDef def, int level) {
-  printf("%*.s", level * 2, "");
-  if (def.strt.count) printf("struct " SV_Fmt, SV_Arg(def.strt));
-  if (def.strt.count && def.tdef.count) printf(" / ");
-  if (def.tdef.count) printf(SV_Fmt, SV_Arg(def.tdef));
-  if (def.hasParent) printf(" (parent: %zu)", def.parent);
-  printf("\n");
-  if (def.inherits_count) {
-    printf("%*.sChildren:\n", level * 2, "");
-    for (size_t i = 0; i < def.inherits_count; ++i) {
-      print_struct_def(arr, arr.items[def.inherits[i]], level + 1);
+void print_struct_def(const StructArr *arr, size_t index) {
+  struct { MAKE_ARRAY(size_t, items) } stack = {0}; // pairs of index and level
+  ARRAY_PUSH(stack, items, index);
+  ARRAY_PUSH(stack, items, 0);
+  while (stack.items_count) {
+    const int level = stack.items[--stack.items_count];
+    const StructDef *def = &arr->items[stack.items[--stack.items_count]];
+    printf("%*.s", level * 2, "");
+    if (def->strt.count) printf("struct " SV_Fmt, SV_Arg(def->strt));
+    if (def->strt.count && def->tdef.count) printf(" / ");
+    if (def->tdef.count) printf(SV_Fmt, SV_Arg(def->tdef));
+    if (def->hasParent) printf(" (parent: %zu)", def->parent);
+    printf("\n");
+    if (def->inherits_count) printf("%*.sChildren:\n", level * 2, "");
+    for (size_t i = def->inherits_count; i-- > 0;) {
+      ARRAY_PUSH(stack, items, SMALL_ARRAY_ITEMS(*def, inherits)[i]);
+      ARRAY_PUSH(stack, items, level + 1);
     }
   }
+  free(stack.items);
 }
 
 void usage(FILE *stream, const char *program) {
-  fprintf(stream, "%s <in file> [<out file>]\n", program);
-  fprintf(stream, "   <in file>   File to resolve inheritance in\n");
-  fprintf(stream, "   <out file>  File to place results in, may be - for stdout\n");
+  fprintf(stream, "%s [options] <in file> [<out file>]\n", program);
+  fprintf(stream, "%s [options] -o <out dir> <in file>...\n", program);
+  fprintf(stream, "%s [options] --manifest <list file> [<in file>...]\n", program);
+  fprintf(stream, "   <in file>     File to resolve inheritance in\n");
+  fprintf(stream, "   <out file>    File to place results in, may be - for stdout\n");
+  fprintf(stream, "   -o <out dir>  Translate all input files into <out dir>, dropping their `.in` suffix\n");
+  fprintf(stream, "   --manifest <list file>\n");
+  fprintf(stream, "                 Translate all files listed in <list file>, one `<in file> [<out file>]` per line\n");
+  fprintf(stream, "   -j <jobs>     Number of worker threads for multiple inputs (default: number of cores)\n");
+  fprintf(stream, "   -I <dir>, -isystem <dir>\n");
+  fprintf(stream, "                 Add <dir> to the search path of includes\n");
+  fprintf(stream, "   --preprocessor=<cc|builtin>\n");
+  fprintf(stream, "                 Resolve includes with `cc -E` (default) or the faster builtin preprocessor\n");
+  fprintf(stream, "   --lexer=<classic|table>\n");
+  fprintf(stream, "                 Tokenize with character comparisons (default) or a table-driven state machine\n");
+  fprintf(stream, "   --preprocessed <file>\n");
+  fprintf(stream, "                 Take the structs of includes from <file> (output of `cc -fdirectives-only -E`)\n");
+  fprintf(stream, "                 instead of preprocessing, only for a single input file\n");
+  fprintf(stream, "   -MD           Write a make rule with all included headers to `<out file>.d`\n");
+  fprintf(stream, "   -MF <file>    Write the rule to <file> instead, only for a single input file\n");
+  fprintf(stream, "   -MT <target>  Name <target> in the rule instead of the output file, only for a single input file\n");
+  fprintf(stream, "   --used-by <file or glob>\n");
+  fprintf(stream, "                 Only generate the CEST_AS_ macros used in these sources, with associations for the\n");
+  fprintf(stream, "                 types they name; may be given multiple times\n");
+  fprintf(stream, "   --stream-includes\n");
+  fprintf(stream, "                 Drop included declarations that cannot define structs while preprocessing, to bound memory\n");
+  fprintf(stream, "   --lex-threads <n>\n");
+  fprintf(stream, "                 Lex large included text in up to <n> pieces on as many threads (default: 1)\n");
+  fprintf(stream, "   --mmap-populate\n");
+  fprintf(stream, "                 Read mapped input files completely up front\n");
+  fprintf(stream, "   --cache-dir <dir>\n");
+  fprintf(stream, "                 Cache translations in <dir> (default: $CEST_CACHE_DIR, $XDG_CACHE_HOME/cest or ~/.cache/cest)\n");
+  fprintf(stream, "   --cache-size <MiB>\n");
+  fprintf(stream, "                 Evict least recently used translations above this size (default: %d)\n", DEFAULT_CACHE_SIZE / 1024 / 1024);
+  fprintf(stream, "   --no-cache    Always translate, do not use the cache\n");
+  fprintf(stream, "   --cache-stats Print cache hits and misses (after translating, if any inputs are given)\n");
+  fprintf(stream, "   --stats       Print the time spent per phase and the amount of data processed\n");
+  fprintf(stream, "   --perf-counters\n");
+  fprintf(stream, "                 Print cycles, instructions, branch and cache misses per phase and input file\n");
+  fprintf(stream, "   --trace <file>\n");
+  fprintf(stream, "                 Append every phase as an event to the Chrome trace <file> (JSON)\n");
+  fprintf(stream, "%s --serve <socket>\n", program);
+  fprintf(stream, "                 Keep structs of includes in memory and translate for clients connecting to <socket>\n");
+  fprintf(stream, "%s --client [options] ...\n", program);
+  fprintf(stream, "                 Same as without --client, but let the server at $CEST_SOCKET (default " DEFAULT_SOCKET ") translate\n");
 }
 
+void write_all(int fd, const void *data, size_t count) {
+  for (size_t written = 0; written < count;) {
+    ssize_t n = write(fd, (const char *)data + written, count - written);
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0) {
+      perror("write");
+      exit(1);
+    }
+    written += n;
+  }
+}
 
-#ifndef NO_MAIN
-int main(int argc, char *argv[]) {
-  if (argc > 1 && strcmp(argv[1], "-h") == 0) {
-    usage(stdout, argv[0]);
-    exit(0);
+// the file at `path` has exactly the contents `data`
+bool file_equals(const char *path, String_View data) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return false;
+  struct stat st;
+  bool same = fstat(fd, &st) == 0 && (size_t)st.st_size == data.count;
+  char chunk[64 * 1024];
+  for (size_t at = 0; same && at < data.count;) {
+    ssize_t n = read(fd, chunk, sizeof(chunk));
+    if (n < 0 && errno == EINTR) continue;
+    same = n > 0 && at + n <= data.count && memcmp(chunk, data.data + at, n) == 0;
+    at += same ? n : 0;
   }
-  if (argc < 2) {
-    fprintf(stderr, "too few arguments provided!\n");
-    usage(stderr, argv[0]);
+  POSIX_WORK(close, fd);
+  return same;
+}
+
+// Unchanged files are not touched, so their mtime does not trigger rebuilds. Otherwise the
+// output is written next to the file and renamed over it: readers never see it half-written.
+// Anything but regular files (stdout as `-`, devices, symlinks) is written directly.
+void write_output(const char *out, String_View output) {
+  static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+  static size_t temps = 0;
+  struct stat st;
+  const bool exists = lstat(out, &st) == 0;
+  if (strcmp(out, "-") != 0 && (!exists || S_ISREG(st.st_mode))) {
+    if (exists && file_equals(out, output)) return;
+    PTHREAD_WORK(pthread_mutex_lock, &lock);
+    const size_t n = temps++;
+    PTHREAD_WORK(pthread_mutex_unlock, &lock);
+    char *tmp = malloc(strlen(out) + 64);
+    if (tmp == NULL) {
+      perror("malloc temporary output name");
+      exit(1);
+    }
+    sprintf(tmp, "%s.tmp.%ld.%zu", out, (long)getpid(), n);
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, exists ? st.st_mode & 07777 : 0666);
+    if (fd < 0) {
+      fprintf(stderr, "Could not open file `%s` for writing: %s\n", tmp, strerror(errno));
+      exit(1);
+    }
+    write_all(fd, output.data, output.count);
+    POSIX_WORK(close, fd);
+    if (rename(tmp, out) < 0) {
+      fprintf(stderr, "Could not replace `%s`: %s\n", out, strerror(errno));
+      unlink(tmp);
+      exit(1);
+    }
+    free(tmp);
+    return;
+  }
+  FILE *outfile = stdout;
+  if (strcmp(out, "-") != 0) outfile = fopen(out, "w");
+  if (outfile == NULL) {
+    fprintf(stderr, "Could not open file `%s` for writing: %s\n", out, strerror(errno));
+    exit(1);
+  }
+  if (output.count && fwrite(output.data, output.count, 1, outfile) != 1) {
+    fprintf(stderr, "Could not write to `%s`: %s\n", out, strerror(errno));
+    exit(1);
+  }
+  if (strcmp(out, "-") != 0) POSIX_WORK(fclose, outfile);
+}
+
+// interns all names of the files matching `patterns`, remembering the first use of every cast macro
+void used_by_scan(UsedBy *used, const char *const *patterns, size_t count) {
+  *used = (UsedBy) {0};
+  PTHREAD_WORK(pthread_mutex_init, &used->lock, NULL);
+  for (size_t p = 0; p < count; ++p) {
+    glob_t matches;
+    // patterns without matches are taken as file names, to fail on loading them
+    if (glob(patterns[p], GLOB_NOCHECK, NULL, &matches) != 0) {
+      fprintf(stderr, "Could not expand `%s`!\n", patterns[p]);
+      exit(1);
+    }
+    for (size_t i = 0; i < matches.gl_pathc; ++i) ARRAY_PUSH(*used, paths, strdup(matches.gl_pathv[i]));
+    globfree(&matches);
+  }
+  for (size_t i = 0; i < used->paths_count; ++i) {
+    String_View file = load_file(used->paths[i], false);
+    ARRAY_PUSH(*used, files, file);
+    Lexer lexer = lexer_create(sv_from_cstr(used->paths[i]), file);
+    for (TokenOrEnd t = lexer_get_token(&lexer); t.has_value; t = lexer_get_token(&lexer)) {
+      if (t.token.kind != TK_NAME) continue;
+      const Symbol symbol = symtab_intern(&used->names, t.token.content);
+      while (used->uses_count < symtab_end(&used->names)) ARRAY_PUSH(*used, uses, (Location) {0});
+      if (!used->uses[symbol].filename.count && sv_starts_with(t.token.content, SV("CEST_AS_")))
+        used->uses[symbol] = lexer_token_loc(&lexer, t.token);
+    }
+    lexer_free(&lexer);
+  }
+  used->generated = calloc(used->uses_count ? used->uses_count : 1, sizeof(bool));
+  if (used->generated == NULL) {
+    perror("calloc used casts");
     exit(1);
   }
-  char *outstr = "-";
-  if (argc >= 3) outstr = argv[2];
-  StructArr strts = collect_structs(argv[1]);
+  used->key = hash_bytes(0, "--used-by", 9);
+  for (Symbol symbol = NO_SYMBOL + 1; symbol < used->uses_count; ++symbol) {
+    const String_View name = symtab_name(&used->names, symbol);
+    used->key = hash_bytes(used->key, name.data, name.count + 1); // followed by a NUL or delimiter
+  }
+}
+
+// records the used cast macros defined in `output`, each only has to be generated by one input
+void used_by_mark(UsedBy *used, String_View output) {
+  static char defc[] = "#define ";
+  static char cast[] = "#define CEST_AS_";
+  const char *at = output.data;
+  const char *end = output.data + output.count;
+  PTHREAD_WORK(pthread_mutex_lock, &used->lock);
+  while ((at = memmem(at, end - at, cast, sizeof(cast) - 1)) != NULL) {
+    at += sizeof(defc) - 1;
+    size_t n = 0;
+    while (at + n < end && (isalnum(at[n]) || at[n] == '_')) n += 1;
+    const Symbol symbol = symtab_find(&used->names, sv_from_parts(at, n));
+    if (symbol != NO_SYMBOL) used->generated[symbol] = true;
+    at += n;
+  }
+  PTHREAD_WORK(pthread_mutex_unlock, &used->lock);
+}
+
+void used_by_warn(const UsedBy *used) {
+  for (Symbol symbol = 0; symbol < used->uses_count; ++symbol) {
+    if (!used->uses[symbol].filename.count || used->generated[symbol]) continue;
+    const String_View name = symtab_name(&used->names, symbol);
+    lexer_dump_warn(used->uses[symbol], stderr, "`" SV_Fmt "` is not generated, no input defines a struct with children of this name", SV_Arg(name));
+  }
+}
+
+void used_by_free(UsedBy *used) {
+  for (size_t i = 0; i < used->files_count; ++i) unload_file(used->files[i]);
+  for (size_t i = 0; i < used->paths_count; ++i) free(used->paths[i]);
+  free(used->files);
+  free(used->paths);
+  free(used->uses);
+  free(used->generated);
+  symtab_free(&used->names);
+  PTHREAD_WORK(pthread_mutex_destroy, &used->lock);
+}
+
+void make_escape(StringBuilder *sb, const char *name) {
+  for (const char *c = name; *c; ++c) {
+    if (*c == ' ' || *c == '\t' || *c == '#') sb_append(sb, "\\", 1);
+    if (*c == '$') sb_append(sb, "$", 1);
+    sb_append(sb, c, 1);
+  }
+}
+
+// GNU make rule `<out>: <in> <headers>...`, `deps` are the paths of the headers, each followed by a NUL
+void write_depfile(const Options *opts, const char *in, const char *out, String_View deps) {
+  StringBuilder sb = {0};
+  make_escape(&sb, opts->dep_target ? opts->dep_target : out);
+  sb_append(&sb, ": ", 2);
+  make_escape(&sb, in);
+  while (deps.count) {
+    const String_View dep = sv_chop_by_delim(&deps, 0);
+    sb_append(&sb, " \\\n  ", 4);
+    make_escape(&sb, dep.data);
+  }
+  // the consumers decide which cast macros are generated
+  for (size_t i = 0; opts->used && i < opts->used->paths_count; ++i) {
+    sb_append(&sb, " \\\n  ", 4);
+    make_escape(&sb, opts->used->paths[i]);
+  }
+  sb_append(&sb, "\n", 1);
+  char *path = NULL;
+  if (opts->depfile == NULL) {
+    path = malloc(strlen(out) + sizeof(".d"));
+    if (path == NULL) {
+      perror("malloc depfile name");
+      exit(1);
+    }
+    sprintf(path, "%s.d", out);
+  }
+  write_output(path ? path : opts->depfile, sv_from_parts(sb.items, sb.items_count));
+  free(path);
+  free(sb.items);
+}
+
+// the output only depends on the input, the headers it includes and how they are found
+uint64_t translation_key(const Options *opts, const char *in, String_View file) {
+  char *dir = dir_of(in);
+  uint64_t key = hash_bytes(0, CEST_BUILD, sizeof(CEST_BUILD));
+  key = hash_bytes(key, opts->pp_key.data, opts->pp_key.count);
+  key = hash_bytes(key, dir, strlen(dir) + 1);
+  key = hash_bytes(key, file.data, file.count);
+  if (opts->used) key = hash_bytes(key, &opts->used->key, sizeof(opts->used->key));
+  free(dir);
+  return key;
+}
+
+void translate_file(IncludeCache *cache, const Options *opts, const char *in, const char *out) {
+  StatsMark file_mark = stats_begin(opts->stats);
+  String_View file = load_file(in, opts->populate);
+  stats_count(opts->stats, COUNT_BYTES_READ, file.count);
+  uint64_t key = 0;
+  if (opts->results) {
+    String_View cached;
+    key = translation_key(opts, in, file);
+    StringBuilder deps = {0};
+    if (result_cache_lookup(opts->results, key, &cached, opts->depfiles ? &deps : NULL)) {
+      StatsMark mark = stats_begin(opts->stats);
+      write_output(out, cached);
+      stats_end(opts->stats, PHASE_EMIT, mark, in);
+      stats_count(opts->stats, COUNT_BYTES_EMITTED, cached.count);
+      if (opts->used) used_by_mark(opts->used, cached);
+      if (opts->depfiles) write_depfile(opts, in, out, sv_from_parts(deps.items, deps.items_count));
+      free(deps.items);
+      free((void *)cached.data);
+      unload_file(file);
+      stats_end(opts->stats, PHASE_FILE, file_mark, in);
+      return;
+    }
+    free(deps.items);
+  }
+  StatsMark mark = stats_begin(opts->stats);
+  TokenBuffer tokens = tokens_lex(sv_from_cstr(in), file);
+  stats_end(opts->stats, PHASE_LEX, mark, in);
+  stats_count(opts->stats, COUNT_TOKENS, tokens.count);
+  IncludeTable *table = include_cache_get(cache, opts, in, extract_prelude(&tokens));
+  StructArr strts = structs_from_table(table);
 #ifdef DEBUG
   printf("Originally known structs:\n");
   for (size_t i = 0; i < strts.items_count; i++) {
-    print_struct_def(strts, strts.items[i], 0);
+    print_struct_def(&strts, i);
   }
 #endif // DEBUG
-  String_View file = load_file(argv[1]);
-  collect_inherits(&strts, file, sv_from_cstr(argv[1]));
+  mark = stats_begin(opts->stats);
+  skip_inactive(&strts, &tokens, table);
+  collect_inherits(&strts, &tokens);
+  flatten_structs(&strts);
+  order_descendants(&strts);
+  stats_end(opts->stats, PHASE_INHERITS, mark, in);
+  if (opts->stats) {
+    size_t children = 0;
+    for (size_t i = 0; i < strts.items_count; ++i) children += strts.items[i].inherits_count;
+    stats_count(opts->stats, COUNT_CHILDREN, children);
+  }
 #ifdef DEBUG
   printf("-------------------------\n");
   printf("Structs after inheritance:\n");
   for (size_t i = 0; i < strts.items_count; i++) {
-    print_struct_def(strts, strts.items[i], 0);
+    print_struct_def(&strts, i);
   }
   printf("-------------------------\n");
 #endif // DEBUG
   // TODO: collect anonymous typedefs
   // will require making tdef an array
-  FILE *outfile = stdout;
-  if (strcmp(outstr, "-") != 0) outfile = fopen(outstr, "w");
+  mark = stats_begin(opts->stats);
+  char *data = NULL;
+  size_t size = 0;
+  FILE *outfile = open_memstream(&data, &size);
   if (outfile == NULL) {
-    fprintf(stderr, "Could not open file `%s` for writing: %s\n", outstr, strerror(errno));
+    perror("open_memstream");
+    exit(1);
+  }
+  replace_inherits(&strts, opts->used, file, outfile);
+  POSIX_WORK(fclose, outfile);
+  String_View output = sv_from_parts(data, size);
+  write_output(out, output);
+  stats_end(opts->stats, PHASE_EMIT, mark, in);
+  stats_count(opts->stats, COUNT_BYTES_EMITTED, output.count);
+  if (opts->used) used_by_mark(opts->used, output);
+  if (opts->depfiles) {
+    StringBuilder deps = {0};
+    for (size_t i = 0; i < table->deps_count; ++i) sb_append(&deps, table->deps[i].path, strlen(table->deps[i].path) + 1);
+    write_depfile(opts, in, out, sv_from_parts(deps.items, deps.items_count));
+    free(deps.items);
+  }
+  // a cache hit only replays the output, the diagnostics have to be printed again by translating
+  if (opts->results && strts.diagnostics == 0) {
+    char **deps = malloc((table->deps_count + 1) * sizeof(char *));
+    if (deps == NULL) {
+      perror("malloc deps");
+      exit(1);
+    }
+    for (size_t i = 0; i < table->deps_count; ++i) deps[i] = table->deps[i].path;
+    result_cache_store(opts->results, key, deps, table->deps_count, output);
+    free(deps);
+  }
+  free(data);
+  structs_free(&strts);
+  tokens_free(&tokens);
+  unload_file(file);
+  stats_end(opts->stats, PHASE_FILE, file_mark, in);
+}
+
+typedef struct {
+  const char *in;
+  char *out;
+} Job;
+typedef struct {
+  MAKE_ARRAY(Job, items)
+  IncludeCache *cache;
+  const Options *opts;
+  pthread_mutex_t lock;
+  size_t next;
+} Batch;
+
+// <out dir>/<basename of in without .in>
+char *output_in_dir(const char *in, const char *outdir) {
+  const char *base = strrchr(in, '/');
+  base = base ? base + 1 : in;
+  size_t n = strlen(base);
+  if (n <= 3 || strcmp(base + n - 3, ".in") != 0) {
+    fprintf(stderr, "Input file `%s` does not end in `.in`, cannot derive output name\n", in);
+    exit(1);
+  }
+  char *out = malloc(strlen(outdir) + 1 + n - 3 + 1);
+  if (out == NULL) {
+    perror("malloc output name");
     exit(1);
   }
-  replace_inherits(strts, file, outfile); 
-  if (strcmp(outstr, "-") != 0) POSIX_WORK(fclose, outfile);
-  free((void *)strts.orig);
-  for (size_t i = 0; i < strts.items_count; ++i) free((void *)strts.items[i].inherits);
-  free((void *)strts.items);
-  free((void *)file.data);
+  sprintf(out, "%s/%.*s", outdir, (int) (n - 3), base);
+  return out;
+}
+
+void batch_add(Batch *batch, const char *in, const char *out, const char *outdir) {
+  Job job = { .in = in };
+  if (out) job.out = strdup(out);
+  else if (outdir) job.out = output_in_dir(in, outdir);
+  else {
+    size_t n = strlen(in);
+    if (n <= 3 || strcmp(in + n - 3, ".in") != 0) {
+      fprintf(stderr, "Input file `%s` does not end in `.in`, cannot derive output name\n", in);
+      exit(1);
+    }
+    job.out = strndup(in, n - 3);
+  }
+  ARRAY_PUSH(*batch, items, job);
+}
+
+// each non-empty line is `<in file> [<out file>]`, lines starting with `#` are ignored
+// returns the file contents, which job names point into
+String_View batch_add_manifest(Batch *batch, const char *manifest, const char *outdir) {
+  String_View file = load_file(manifest, false);
+  const String_View contents = file;
+  char *data = (char *)file.data;
+  while (file.count) {
+    String_View line = sv_trim(sv_chop_by_delim(&file, '\n'));
+    if (line.count == 0 || line.data[0] == '#') continue;
+    String_View in = sv_chop_by_delim(&line, ' ');
+    String_View out = sv_trim(line);
+    // terminate names in place, the delimiters are not needed anymore
+    data[in.data + in.count - data] = 0;
+    if (out.count) data[out.data + out.count - data] = 0;
+    batch_add(batch, in.data, out.count ? out.data : NULL, outdir);
+  }
+  return contents;
+}
+
+void *batch_worker(void *arg) {
+  Batch *batch = arg;
+  while (true) {
+    PTHREAD_WORK(pthread_mutex_lock, &batch->lock);
+    size_t i = batch->next++;
+    PTHREAD_WORK(pthread_mutex_unlock, &batch->lock);
+    if (i >= batch->items_count) return NULL;
+    translate_file(batch->cache, batch->opts, batch->items[i].in, batch->items[i].out);
+  }
+}
+
+void batch_run(Batch *batch, size_t jobs) {
+  if (jobs > batch->items_count) jobs = batch->items_count;
+  if (jobs <= 1) {
+    batch_worker(batch);
+    return;
+  }
+  pthread_t *threads = malloc(jobs * sizeof(pthread_t));
+  if (threads == NULL) {
+    perror("malloc threads");
+    exit(1);
+  }
+  for (size_t i = 0; i < jobs; ++i) PTHREAD_WORK(pthread_create, &threads[i], NULL, batch_worker, batch);
+  for (size_t i = 0; i < jobs; ++i) PTHREAD_WORK(pthread_join, threads[i], NULL);
+  free(threads);
+}
+
+const char *next_arg(int argc, char *argv[], int *i) {
+  if (*i + 1 >= argc) {
+    fprintf(stderr, "option `%s` requires an argument!\n", argv[*i]);
+    usage(stderr, argv[0]);
+    exit(1);
+  }
+  return argv[++*i];
+}
+
+// include directories are made absolute, tables are shared between working directories
+const char *include_dir(const char *dir) {
+  char *real = realpath(dir, NULL);
+  if (real == NULL) {
+    fprintf(stderr, "Could not resolve include directory `%s`: %s\n", dir, strerror(errno));
+    exit(1);
+  }
+  return real;
+}
+
+String_View options_key(const Options *opts) {
+  const PPConfig *config = &opts->pp;
+  StringBuilder sb = {0};
+  const char *engine = config->engine == PP_ENGINE_BUILTIN ? "builtin" : "cc";
+  sb_append(&sb, engine, strlen(engine) + 1);
+  for (size_t i = 0; i < config->includes_count; ++i) {
+    sb_append(&sb, "-I", 2);
+    sb_append(&sb, config->includes[i], strlen(config->includes[i]) + 1);
+  }
+  for (size_t i = 0; i < config->system_includes_count; ++i) {
+    sb_append(&sb, "-isystem", 8);
+    sb_append(&sb, config->system_includes[i], strlen(config->system_includes[i]) + 1);
+  }
+  if (opts->preprocessed) {
+    sb_append(&sb, "--preprocessed", 14);
+    sb_append(&sb, opts->preprocessed, strlen(opts->preprocessed) + 1);
+  }
+  return (String_View) {
+    .count = sb.items_count,
+    .data = sb.items,
+  };
+}
+
+
+// translates according to the command line, structs of includes are looked up in `cache`
+int run_cest(int argc, char *argv[], IncludeCache *cache) {
+  const char *outdir = NULL;
+  const char *manifest = NULL;
+  Options opts = {0};
+  const char *cache_dir = NULL;
+  uint64_t cache_size = DEFAULT_CACHE_SIZE;
+  bool no_cache = false;
+  bool cache_stats = false;
+  bool print_stats = false;
+  bool perf_counters = false;
+  const char *trace = NULL;
+  long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+  struct { MAKE_ARRAY(const char *, items) } args = {0};
+  struct { MAKE_ARRAY(const char *, items) } used_by = {0};
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "-h") == 0) {
+      usage(stdout, argv[0]);
+      return 0;
+    } else if (strcmp(argv[i], "-o") == 0) {
+      outdir = next_arg(argc, argv, &i);
+    } else if (strcmp(argv[i], "--manifest") == 0) {
+      manifest = next_arg(argc, argv, &i);
+    } else if (strcmp(argv[i], "-j") == 0) {
+      jobs = atol(next_arg(argc, argv, &i));
+      if (jobs < 1) {
+        fprintf(stderr, "invalid number of jobs `%s`!\n", argv[i]);
+        exit(1);
+      }
+    } else if (strncmp(argv[i], "--preprocessor=", 15) == 0) {
+      const char *engine = argv[i] + 15;
+      if (strcmp(engine, "cc") == 0) opts.pp.engine = PP_ENGINE_CC;
+      else if (strcmp(engine, "builtin") == 0) opts.pp.engine = PP_ENGINE_BUILTIN;
+      else {
+        fprintf(stderr, "unknown preprocessor `%s`!\n", engine);
+        exit(1);
+      }
+    } else if (strncmp(argv[i], "--lexer=", 8) == 0) {
+      const char *mode = argv[i] + 8;
+      if (strcmp(mode, "classic") == 0) lexer_default_flags &= ~LEXER_TABLE;
+      else if (strcmp(mode, "table") == 0) lexer_default_flags |= LEXER_TABLE;
+      else {
+        fprintf(stderr, "unknown lexer `%s`!\n", mode);
+        exit(1);
+      }
+    } else if (strcmp(argv[i], "--cache-dir") == 0) {
+      cache_dir = next_arg(argc, argv, &i);
+    } else if (strcmp(argv[i], "--cache-size") == 0) {
+      long mib = atol(next_arg(argc, argv, &i));
+      if (mib < 1) {
+        fprintf(stderr, "invalid cache size `%s`!\n", argv[i]);
+        exit(1);
+      }
+      cache_size = (uint64_t)mib * 1024 * 1024;
+    } else if (strcmp(argv[i], "-MD") == 0) {
+      opts.depfiles = true;
+    } else if (strcmp(argv[i], "-MF") == 0) {
+      opts.depfiles = true;
+      opts.depfile = next_arg(argc, argv, &i);
+    } else if (strcmp(argv[i], "-MT") == 0) {
+      opts.dep_target = next_arg(argc, argv, &i);
+    } else if (strcmp(argv[i], "--used-by") == 0) {
+      ARRAY_PUSH(used_by, items, next_arg(argc, argv, &i));
+    } else if (strcmp(argv[i], "--mmap-populate") == 0) {
+      opts.populate = true;
+    } else if (strcmp(argv[i], "--stream-includes") == 0) {
+      opts.stream = true;
+    } else if (strcmp(argv[i], "--lex-threads") == 0) {
+      long threads = atol(next_arg(argc, argv, &i));
+      if (threads < 1) {
+        fprintf(stderr, "invalid number of lexer threads `%s`!\n", argv[i]);
+        exit(1);
+      }
+      opts.lex_threads = threads;
+    } else if (strcmp(argv[i], "--preprocessed") == 0) {
+      const char *file = next_arg(argc, argv, &i);
+      opts.preprocessed = realpath(file, NULL);
+      if (opts.preprocessed == NULL) {
+        fprintf(stderr, "Could not resolve `%s`: %s\n", file, strerror(errno));
+        exit(1);
+      }
+    } else if (strcmp(argv[i], "--no-cache") == 0) {
+      no_cache = true;
+    } else if (strcmp(argv[i], "--cache-stats") == 0) {
+      cache_stats = true;
+    } else if (strcmp(argv[i], "--stats") == 0) {
+      print_stats = true;
+    } else if (strcmp(argv[i], "--perf-counters") == 0) {
+      perf_counters = true;
+    } else if (strcmp(argv[i], "--trace") == 0) {
+      trace = next_arg(argc, argv, &i);
+    } else if (strncmp(argv[i], "-I", 2) == 0) {
+      const char *dir = argv[i][2] ? argv[i] + 2 : next_arg(argc, argv, &i);
+      ARRAY_PUSH(opts.pp, includes, include_dir(dir));
+    } else if (strcmp(argv[i], "-isystem") == 0) {
+      ARRAY_PUSH(opts.pp, system_includes, include_dir(next_arg(argc, argv, &i)));
+    } else if (argv[i][0] == '-' && argv[i][1] != 0) {
+      fprintf(stderr, "unknown option `%s`!\n", argv[i]);
+      usage(stderr, argv[0]);
+      exit(1);
+    } else {
+      ARRAY_PUSH(args, items, argv[i]);
+    }
+  }
+  if (jobs < 1) jobs = 1;
+  char *cache_path = cache_dir ? strdup(cache_dir) : result_cache_default_dir();
+  if (cache_stats && args.items_count == 0 && manifest == NULL) {
+    result_cache_print_stats(cache_path, stdout);
+    free(cache_path);
+    free((void *)args.items);
+    free((void *)used_by.items);
+    return 0;
+  }
+  ResultCache results;
+  if (!no_cache) {
+    result_cache_init(&results, cache_path, cache_size);
+    opts.results = &results;
+  }
+
+  opts.pp_key = options_key(&opts);
+  Stats stats;
+  if (print_stats || perf_counters || trace) {
+    stats_init(&stats, trace, perf_counters);
+    opts.stats = &stats;
+  }
+  UsedBy used;
+  if (used_by.items_count) {
+    used_by_scan(&used, used_by.items, used_by.items_count);
+    opts.used = &used;
+  }
+
+  Batch batch = { .cache = cache, .opts = &opts };
+  PTHREAD_WORK(pthread_mutex_init, &batch.lock, NULL);
+  String_View manifest_data = {0};
+  if (outdir || manifest) {
+    if (manifest) manifest_data = batch_add_manifest(&batch, manifest, outdir);
+    for (size_t i = 0; i < args.items_count; ++i) batch_add(&batch, args.items[i], NULL, outdir);
+  } else {
+    if (args.items_count < 1 || args.items_count > 2) {
+      fprintf(stderr, "%s arguments provided!\n", args.items_count < 1 ? "too few" : "too many");
+      usage(stderr, argv[0]);
+      exit(1);
+    }
+    batch_add(&batch, args.items[0], args.items_count >= 2 ? args.items[1] : "-", NULL);
+  }
+  if (opts.preprocessed && batch.items_count > 1) {
+    fprintf(stderr, "--preprocessed can only be used with a single input file!\n");
+    exit(1);
+  }
+  if ((opts.depfile || opts.dep_target) && batch.items_count > 1) {
+    fprintf(stderr, "-MF and -MT can only be used with a single input file!\n");
+    exit(1);
+  }
+  if (opts.depfiles && opts.depfile == NULL && batch.items_count == 1 && strcmp(batch.items[0].out, "-") == 0) {
+    fprintf(stderr, "-MD needs an output file or -MF to name the dependency file!\n");
+    exit(1);
+  }
+  batch_run(&batch, jobs);
+  if (opts.results) result_cache_finish(opts.results);
+  if (cache_stats) result_cache_print_stats(cache_path, stderr);
+  if (print_stats) stats_print(opts.stats, stderr);
+  if (perf_counters) stats_print_perf(opts.stats, stderr);
+  if (opts.stats) stats_free(opts.stats);
+  if (opts.used) {
+    used_by_warn(opts.used);
+    used_by_free(opts.used);
+  }
+  free(cache_path);
+
+  for (size_t i = 0; i < batch.items_count; ++i) free(batch.items[i].out);
+  free((void *)batch.items);
+  if (manifest_data.data) unload_file(manifest_data);
+  free((void *)args.items);
+  free((void *)used_by.items);
+  for (size_t i = 0; i < opts.pp.includes_count; ++i) free((void *)opts.pp.includes[i]);
+  for (size_t i = 0; i < opts.pp.system_includes_count; ++i) free((void *)opts.pp.system_includes[i]);
+  free((void *)opts.pp.includes);
+  free((void *)opts.pp.system_includes);
+  free((void *)opts.pp_key.data);
+  free((void *)opts.preprocessed);
+  PTHREAD_WORK(pthread_mutex_destroy, &batch.lock);
   return 0;
 }
+
+// returns false on premature end of file
+bool read_all(int fd, void *data, size_t count) {
+  for (size_t nread = 0; nread < count;) {
+    ssize_t n = read(fd, (char *)data + nread, count - nread);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    nread += n;
+  }
+  return true;
+}
+
+void write_sv(int fd, String_View sv) {
+  uint64_t count = sv.count;
+  write_all(fd, &count, sizeof(count));
+  write_all(fd, sv.data, sv.count);
+}
+
+// the result is always NUL-terminated
+bool read_sv(int fd, String_View *sv) {
+  uint64_t count;
+  if (!read_all(fd, &count, sizeof(count))) return false;
+  char *data = malloc(count + 1);
+  if (data == NULL) {
+    perror("malloc read_sv");
+    exit(1);
+  }
+  if (!read_all(fd, data, count)) {
+    free(data);
+    return false;
+  }
+  data[count] = 0;
+  *sv = (String_View) { .count = count, .data = data };
+  return true;
+}
+
+// tables built by a request process are sent back to the server, which then keeps them
+void send_new_tables(IncludeCache *cache, int fd) {
+  for (size_t i = 0; i < cache->items_count; ++i) {
+    IncludeTable *table = cache->items[i];
+    if (table->inherited || !table->ready) continue;
+    write_sv(fd, sv_from_cstr(table->dir));
+    write_sv(fd, table->config);
+    write_sv(fd, table->prelude);
+    write_sv(fd, sv_from_cstr(table->name));
+    write_sv(fd, table->text);
+    uint64_t deps = table->deps_count;
+    write_all(fd, &deps, sizeof(deps));
+    for (size_t j = 0; j < table->deps_count; ++j) {
+      write_sv(fd, sv_from_cstr(table->deps[j].path));
+      write_all(fd, &table->deps[j].mtime, sizeof(table->deps[j].mtime));
+    }
+  }
+}
+
+IncludeTable *receive_table(int fd) {
+  IncludeTable *table = calloc(1, sizeof(IncludeTable));
+  if (table == NULL) {
+    perror("malloc include table");
+    exit(1);
+  }
+  String_View dir, name;
+  uint64_t deps;
+  if (!read_sv(fd, &dir)) {
+    free(table);
+    return NULL;
+  }
+  table->dir = (char *)dir.data;
+  bool ok = read_sv(fd, &table->config) && read_sv(fd, &table->prelude) && read_sv(fd, &name);
+  table->name = ok ? (char *)name.data : NULL;
+  ok = ok && read_sv(fd, &table->text) && read_all(fd, &deps, sizeof(deps));
+  for (uint64_t i = 0; ok && i < deps; ++i) {
+    String_View path;
+    Dependency dep = {0};
+    ok = read_sv(fd, &path) && read_all(fd, &dep.mtime, sizeof(dep.mtime));
+    if (!ok) break;
+    dep.path = (char *)path.data;
+    ARRAY_PUSH(*table, deps, dep);
+  }
+  if (!ok) {
+    include_table_free(table);
+    return NULL;
+  }
+  // the request process already lexed this exact text successfully
+  table->tokens = tokens_lex(sv_from_cstr(table->name), table->text);
+  table->structs = collect_structs(&table->tokens);
+  collect_segments(table);
+  return table;
+}
+
+// A request being translated by its request process: the server itself stays single
+// threaded, so forking a request process neither inherits locks nor other threads.
+typedef struct {
+  int client;
+  int tables; // read end of the pipe the request process sends the tables it built through
+  pid_t child;
+} Request;
+
+// Request process: everything depending on the request happens here, so errors (which
+// exit) only ever end this process. Having been forked from a single-threaded server, it
+// may allocate and start threads freely.
+// request: u32 payload size, payload of NUL-terminated working directory and arguments
+// the client's stdout and stderr are passed along with the first message
+void serve_request(IncludeCache *cache, int client, int tables) {
+  uint32_t size = 0;
+  int fds[2] = { -1, -1 };
+  char control[CMSG_SPACE(sizeof(fds))] = {0};
+  struct iovec iov = { .iov_base = &size, .iov_len = sizeof(size) };
+  struct msghdr msg = {
+    .msg_iov = &iov,
+    .msg_iovlen = 1,
+    .msg_control = control,
+    .msg_controllen = sizeof(control),
+  };
+  if (recvmsg(client, &msg, MSG_CMSG_CLOEXEC) != sizeof(size)) exit(1);
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) exit(1);
+  memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+  char *payload = malloc(size + 1);
+  if (payload == NULL || !read_all(client, payload, size)) exit(1);
+  payload[size] = 0;
+
+  struct { MAKE_ARRAY(char *, items) } args = {0};
+  for (char *p = payload; p < payload + size; p += strlen(p) + 1) ARRAY_PUSH(args, items, p);
+  if (args.items_count < 1) exit(1);
+  ARRAY_PUSH(args, items, NULL);
+
+  for (size_t i = 0; i < cache->items_count; ++i) cache->items[i]->inherited = true;
+  cache->revalidate = true;
+  POSIX_WORK(dup2, fds[0], STDOUT_FILENO);
+  POSIX_WORK(dup2, fds[1], STDERR_FILENO);
+  if (chdir(args.items[0]) < 0) {
+    fprintf(stderr, "Could not change to directory `%s`: %s\n", args.items[0], strerror(errno));
+    exit(1);
+  }
+  args.items[0] = "cest";
+  int status = run_cest(args.items_count - 1, args.items, cache);
+  send_new_tables(cache, tables);
+  exit(status);
+}
+
+// takes over the tables of a finished request process
+// response: i32 exit status
+void finish_request(IncludeCache *cache, Request request) {
+  IncludeTable *table;
+  while ((table = receive_table(request.tables)) != NULL) include_cache_put(cache, table);
+  POSIX_WORK(close, request.tables);
+
+  int status;
+  POSIX_WORK(waitpid, request.child, &status, 0);
+  int32_t result = WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+  if (write(request.client, &result, sizeof(result)) < 0) {
+    // client is gone already, nothing to report to
+  }
+  close(request.client);
+}
+
+int serve(const char *path) {
+  IncludeCache cache;
+  include_cache_init(&cache);
+  int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (sock < 0) {
+    perror("socket");
+    exit(1);
+  }
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "Socket path `%s` is too long\n", path);
+    exit(1);
+  }
+  strcpy(addr.sun_path, path);
+  unlink(path); // left over from a previous server
+  POSIX_WORK(bind, sock, (struct sockaddr *)&addr, sizeof(addr));
+  POSIX_WORK(listen, sock, SOMAXCONN);
+  fprintf(stderr, "Serving on `%s`\n", path);
+  struct { MAKE_ARRAY(Request, items) } requests = {0};
+  struct { MAKE_ARRAY(struct pollfd, items) } polled = {0};
+  while (true) {
+    // the listening socket, then the tables of every request, in order
+    polled.items_count = 0;
+    ARRAY_PUSH(polled, items, ((struct pollfd) { .fd = sock, .events = POLLIN }));
+    for (size_t i = 0; i < requests.items_count; ++i)
+      ARRAY_PUSH(polled, items, ((struct pollfd) { .fd = requests.items[i].tables, .events = POLLIN }));
+    if (poll(polled.items, polled.items_count, -1) < 0) {
+      if (errno == EINTR) continue;
+      perror("poll");
+      exit(1);
+    }
+    // backwards, the last request (already looked at) takes the place of a finished one
+    for (size_t i = requests.items_count; i-- > 0;) {
+      if (polled.items[i + 1].revents == 0) continue;
+      finish_request(&cache, requests.items[i]);
+      requests.items[i] = requests.items[--requests.items_count];
+    }
+    if (!(polled.items[0].revents & POLLIN)) continue;
+
+    int client = accept4(sock, NULL, NULL, SOCK_CLOEXEC);
+    if (client < 0) {
+      if (errno == EINTR || errno == ECONNABORTED || errno == EAGAIN) continue;
+      perror("accept");
+      exit(1);
+    }
+    // the request process acts on behalf of the client, only its owner may use the server
+    struct ucred peer;
+    socklen_t peer_size = sizeof(peer);
+    if (getsockopt(client, SOL_SOCKET, SO_PEERCRED, &peer, &peer_size) < 0 || peer.uid != getuid()) {
+      close(client);
+      continue;
+    }
+    int tables[2];
+    POSIX_WORK(pipe2, tables, O_CLOEXEC);
+    pid_t child = fork();
+    if (child < 0) {
+      perror("fork");
+      exit(1);
+    } else if (child == 0) {
+      close(sock);
+      for (size_t i = 0; i < requests.items_count; ++i) {
+        close(requests.items[i].client);
+        close(requests.items[i].tables);
+      }
+      close(tables[0]);
+      serve_request(&cache, client, tables[1]);
+    }
+    POSIX_WORK(close, tables[1]);
+    ARRAY_PUSH(requests, items, ((Request) { .client = client, .tables = tables[0], .child = child }));
+  }
+}
+
+// forwards the command line to a running server, returns false if there is none
+bool run_client(int argc, char *argv[], int *status) {
+  const char *path = getenv("CEST_SOCKET");
+  if (path == NULL) path = DEFAULT_SOCKET;
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  if (strlen(path) >= sizeof(addr.sun_path)) return false;
+  strcpy(addr.sun_path, path);
+  int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (sock < 0) return false;
+  if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    close(sock);
+    return false;
+  }
+
+  char *cwd = getcwd(NULL, 0);
+  if (cwd == NULL) {
+    perror("getcwd");
+    exit(1);
+  }
+  StringBuilder payload = {0};
+  sb_append(&payload, cwd, strlen(cwd) + 1);
+  for (int i = 1; i < argc; ++i) sb_append(&payload, argv[i], strlen(argv[i]) + 1);
+  free(cwd);
+
+  uint32_t size = payload.items_count;
+  int fds[2] = { STDOUT_FILENO, STDERR_FILENO };
+  char control[CMSG_SPACE(sizeof(fds))] = {0};
+  struct iovec iov = { .iov_base = &size, .iov_len = sizeof(size) };
+  struct msghdr msg = {
+    .msg_iov = &iov,
+    .msg_iovlen = 1,
+    .msg_control = control,
+    .msg_controllen = sizeof(control),
+  };
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+  POSIX_WORK(sendmsg, sock, &msg, 0);
+  write_all(sock, payload.items, payload.items_count);
+  free(payload.items);
+
+  int32_t result;
+  if (!read_all(sock, &result, sizeof(result))) {
+    fprintf(stderr, "Server closed the connection\n");
+    result = 1;
+  }
+  close(sock);
+  *status = result;
+  return true;
+}
+
+
+#ifndef NO_MAIN
+int main(int argc, char *argv[]) {
+  // a dying preprocessor or client is reported through exit status or a closed connection
+  signal(SIGPIPE, SIG_IGN);
+  if (argc > 2 && strcmp(argv[1], "--serve") == 0) return serve(argv[2]);
+  if (argc > 1 && strcmp(argv[1], "--client") == 0) {
+    // without a running server, just translate in this process
+    argv[1] = argv[0];
+    argc -= 1;
+    argv += 1;
+    int status;
+    if (run_client(argc, argv, &status)) return status;
+  }
+  IncludeCache cache;
+  include_cache_init(&cache);
+  int status = run_cest(argc, argv, &cache);
+  include_cache_free(&cache);
+  return status;
+}
 #endif // NO_MAIN
@@ -1,29 +1,37 @@
 #include <assert.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <string.h>
 #include "lexer.h"
+#include "scan.h"
 
-#define SV_PEEK(sv, i, name, body) {                              \
+#define SV_PEEK(sv, i, name, body) do {                           \
     if ((sv).count > i) { const char name = (sv).data[i]; body; } \
   } while(0)
-#define PRODUCE(kind) {                \
+#define PRODUCE(kind) do {             \
     last_kind = kind;                  \
     lexer_consume_char(lexer, &token); \
   } while(0)
 
 
+LexerFlags lexer_default_flags = 0;
+
 Lexer lexer_create(String_View filename, String_View content) {
   return (Lexer) {
+    .filename = filename,
+    .source = content,
     .content = content,
-    .loc = { .filename = filename },
+    .flags = lexer_default_flags,
   };
 }
 
-
-static bool is_space_not_newline(char c) {
-  return isspace(c) && c != '\n';
+void lexer_free(Lexer *lexer) {
+  free(lexer->line_starts);
+  lexer->line_starts = NULL;
+  lexer->line_starts_count = lexer->line_starts_cap = 0;
 }
 
+
 static bool is_ident(char c) {
   return isalnum(c) || c == '_';
 }
@@ -47,27 +55,20 @@ static bool is_number_suffix(char c) {
   return u == 'L' || u == 'U' || u == 'F';
 }
 
+// consumes `n` bytes, which may contain newlines
+static void lexer_advance(Lexer *lexer, String_View *sv, size_t n) {
+  assert(n <= lexer->content.count);
+  lexer->content.count -= n;
+  lexer->content.data += n;
+  if (sv) sv->count += n;
+}
+
 static void lexer_remove_space(Lexer *lexer) {
-  while (true) {
-    const String_View space = sv_chop_left_while(&lexer->content, is_space_not_newline);
-    lexer->loc.col += space.count;
-
-    if (lexer->content.count == 0 || lexer->content.data[0] != '\n') break;
-    lexer->content.count -= 1;
-    lexer->content.data += 1;
-    lexer->loc.line += 1;
-    lexer->loc.col = 0;
-  }
+  lexer_advance(lexer, NULL, scan_space(lexer->content.data, lexer->content.count));
 }
 
 static void lexer_consume_char(Lexer *lexer, String_View *sv) {
   assert(lexer->content.count > 0);
-  if (lexer->content.data[0] == '\n') {
-    lexer->loc.col = 0;
-    lexer->loc.line += 1;
-  } else {
-    lexer->loc.col += 1;
-  }
   lexer->content.count -= 1;
   lexer->content.data += 1;
   sv->count += 1;
@@ -75,11 +76,13 @@ static void lexer_consume_char(Lexer *lexer, String_View *sv) {
 
 static void lexer_consume_line(Lexer *lexer, String_View *sv) {
   while (true) {
-    const String_View c = sv_chop_by_delim(&lexer->content, '\n');
-    lexer->loc.col = 0;
-    lexer->loc.line += 1;
-    sv->count += c.count;
-    if (c.count == 0 || c.data[c.count-1] != '\\') break;
+    const size_t n = scan_byte(lexer->content.data, lexer->content.count, '\n');
+    const bool escaped = n > 0 && lexer->content.data[n - 1] == '\\';
+    const size_t consumed = n < lexer->content.count ? n + 1 : n; // including the newline
+    lexer->content.count -= consumed;
+    lexer->content.data += consumed;
+    sv->count += n;
+    if (!escaped) break;
     sv->count += 1; // newline was escaped, consume it and continue
   }
 }
@@ -118,34 +121,258 @@ static void lexer_consume_line_comment(Lexer *lexer, String_View *sv) {
 static void lexer_consume_block_comment(Lexer *lexer, String_View *sv) {
   assert(lexer->content.count > 0 && lexer->content.data[0] == '*');
   lexer_consume_char(lexer, sv); // *
-  while (lexer->content.count) {
-    const char c = lexer->content.data[0];
-    lexer_consume_char(lexer, sv);
-    if (c == '*') SV_PEEK(lexer->content, 0, cc, if (cc == '/') {
-      lexer_consume_char(lexer, sv);
+  const char *data = lexer->content.data;
+  const size_t count = lexer->content.count;
+  size_t i = 0;
+  while ((i += scan_byte(data + i, count - i, '*')) < count) {
+    i += 1;
+    if (i < count && data[i] == '/') {
+      lexer_advance(lexer, sv, i + 1);
       return;
-    });
+    }
   }
+  lexer_advance(lexer, sv, count); // unclosed, the rest of the file is comment
 }
 
 static void lexer_consume_string(Lexer *lexer, String_View *sv) {
   assert(lexer->content.count > 0 && lexer->content.data[0] == '"');
   lexer_consume_char(lexer, sv); // "
   while (lexer->content.count) {
+    const size_t n = scan_byte2(lexer->content.data, lexer->content.count, '"', '\\');
+    if (n == lexer->content.count) {
+      lexer_advance(lexer, sv, n);
+      break;
+    }
+    const char c = lexer->content.data[n];
+    lexer_advance(lexer, sv, n + 1);
+    if (c == '"') return;
+    // escaped character
+    if (!lexer->content.count) lexer_exit_err(lexer_loc(lexer, lexer->content.data), stderr, "Unclosed string literal");
+    lexer_consume_char(lexer, sv);
+  }
+  lexer_exit_err(lexer_loc(lexer, lexer->content.data), stderr, "Unclosed string literal");
+}
+
+// up to the unescaped closing quote on the same line, so escapes like '\x41' or '\012' and
+// multi-character constants like 'ab' are one literal
+static void lexer_consume_char_lit(Lexer *lexer, String_View *sv) {
+  lexer_consume_char(lexer, sv); // '
+  while (lexer->content.count && lexer->content.data[0] != '\n') {
     const char c = lexer->content.data[0];
     lexer_consume_char(lexer, sv);
-    if (c == '"') return;
-    if (c == '\\') {
-      if (!lexer->content.count) lexer_exit_err(lexer->loc, stderr, "Unclosed string literal");
-      lexer_consume_char(lexer, sv);
+    if (c == '\'') return;
+    if (c == '\\' && lexer->content.count) lexer_consume_char(lexer, sv); // escaped character
+  }
+  lexer_exit_err(lexer_loc(lexer, lexer->content.data), stderr, "Unclosed character literal");
+}
+
+
+// Table-driven mode: a DFA over character classes recognizes names and operators, states
+// marked as actions hand over to the consume functions above for everything longer.
+
+typedef enum {
+  CL_OTHER = 0,
+  CL_SPACE,
+  CL_ALPHA,
+  CL_DIGIT,
+  CL_PAREN,
+  CL_SEP,
+  CL_DOT,
+  CL_EQ,
+  CL_MINUS,
+  CL_GT,
+  CL_SLASH,
+  CL_STAR,
+  CL_AMP,
+  CL_PIPE,
+  CL_OP,
+  CL_QUOTE,
+  CL_DQUOTE,
+  CL_HASH,
+  CL_END, // no more input
+  CL_COUNT,
+} CharClass;
+
+static const unsigned char char_classes[256] = {
+  ['\t'] = CL_SPACE, ['\n'] = CL_SPACE, ['\v'] = CL_SPACE, ['\f'] = CL_SPACE, ['\r'] = CL_SPACE,
+  [' '] = CL_SPACE,
+  ['!'] = CL_OP, ['%'] = CL_OP, ['+'] = CL_OP, ['<'] = CL_OP, ['^'] = CL_OP, ['~'] = CL_OP,
+  ['"'] = CL_DQUOTE,
+  ['#'] = CL_HASH,
+  ['&'] = CL_AMP,
+  ['\''] = CL_QUOTE,
+  ['('] = CL_PAREN, [')'] = CL_PAREN, ['['] = CL_PAREN, [']'] = CL_PAREN, ['{'] = CL_PAREN,
+  ['}'] = CL_PAREN,
+  ['*'] = CL_STAR,
+  [','] = CL_SEP, [':'] = CL_SEP, [';'] = CL_SEP, ['?'] = CL_SEP,
+  ['-'] = CL_MINUS,
+  ['.'] = CL_DOT,
+  ['/'] = CL_SLASH,
+  ['0'] = CL_DIGIT, ['1'] = CL_DIGIT, ['2'] = CL_DIGIT, ['3'] = CL_DIGIT, ['4'] = CL_DIGIT,
+  ['5'] = CL_DIGIT, ['6'] = CL_DIGIT, ['7'] = CL_DIGIT, ['8'] = CL_DIGIT, ['9'] = CL_DIGIT,
+  ['='] = CL_EQ,
+  ['>'] = CL_GT,
+  ['A'] = CL_ALPHA, ['B'] = CL_ALPHA, ['C'] = CL_ALPHA, ['D'] = CL_ALPHA, ['E'] = CL_ALPHA,
+  ['F'] = CL_ALPHA, ['G'] = CL_ALPHA, ['H'] = CL_ALPHA, ['I'] = CL_ALPHA, ['J'] = CL_ALPHA,
+  ['K'] = CL_ALPHA, ['L'] = CL_ALPHA, ['M'] = CL_ALPHA, ['N'] = CL_ALPHA, ['O'] = CL_ALPHA,
+  ['P'] = CL_ALPHA, ['Q'] = CL_ALPHA, ['R'] = CL_ALPHA, ['S'] = CL_ALPHA, ['T'] = CL_ALPHA,
+  ['U'] = CL_ALPHA, ['V'] = CL_ALPHA, ['W'] = CL_ALPHA, ['X'] = CL_ALPHA, ['Y'] = CL_ALPHA,
+  ['Z'] = CL_ALPHA, ['_'] = CL_ALPHA, ['a'] = CL_ALPHA, ['b'] = CL_ALPHA, ['c'] = CL_ALPHA,
+  ['d'] = CL_ALPHA, ['e'] = CL_ALPHA, ['f'] = CL_ALPHA, ['g'] = CL_ALPHA, ['h'] = CL_ALPHA,
+  ['i'] = CL_ALPHA, ['j'] = CL_ALPHA, ['k'] = CL_ALPHA, ['l'] = CL_ALPHA, ['m'] = CL_ALPHA,
+  ['n'] = CL_ALPHA, ['o'] = CL_ALPHA, ['p'] = CL_ALPHA, ['q'] = CL_ALPHA, ['r'] = CL_ALPHA,
+  ['s'] = CL_ALPHA, ['t'] = CL_ALPHA, ['u'] = CL_ALPHA, ['v'] = CL_ALPHA, ['w'] = CL_ALPHA,
+  ['x'] = CL_ALPHA, ['y'] = CL_ALPHA, ['z'] = CL_ALPHA,
+  ['|'] = CL_PIPE,
+};
+
+typedef enum {
+  S_STOP = 0, // no transition: the token ends before the current character
+  S_START,
+  S_IDENT,
+  S_PAREN,
+  S_SEP,
+  S_OP, // = + * ! ^ > < % ~, optionally followed by =
+  S_OP_EQ,
+  S_MINUS,
+  S_MINUS_EQ,
+  S_ARROW,
+  S_SLASH,
+  S_SLASH_EQ,
+  S_AMP,
+  S_PIPE,
+  S_DOUBLE, // && ||
+  // actions, entered without consuming the current character
+  S_NUMBER,
+  S_DOT,
+  S_CHAR,
+  S_STRING,
+  S_DIRECTIVE,
+  S_LINE_COMMENT,
+  S_BLOCK_COMMENT,
+  S_COUNT,
+} LexerState;
+#define S_FIRST_ACTION S_NUMBER
+
+static const unsigned char transitions[S_COUNT][CL_COUNT] = {
+  [S_START] = {
+    [CL_ALPHA] = S_IDENT, [CL_DIGIT] = S_NUMBER, [CL_PAREN] = S_PAREN, [CL_SEP] = S_SEP,
+    [CL_DOT] = S_DOT, [CL_EQ] = S_OP, [CL_GT] = S_OP, [CL_STAR] = S_OP, [CL_OP] = S_OP,
+    [CL_MINUS] = S_MINUS, [CL_SLASH] = S_SLASH, [CL_AMP] = S_AMP, [CL_PIPE] = S_PIPE,
+    [CL_QUOTE] = S_CHAR, [CL_DQUOTE] = S_STRING, [CL_HASH] = S_DIRECTIVE,
+  },
+  [S_IDENT] = { [CL_ALPHA] = S_IDENT, [CL_DIGIT] = S_IDENT },
+  [S_OP] = { [CL_EQ] = S_OP_EQ },
+  [S_MINUS] = { [CL_EQ] = S_MINUS_EQ, [CL_GT] = S_ARROW },
+  [S_MINUS_EQ] = { [CL_GT] = S_ARROW },
+  [S_SLASH] = { [CL_EQ] = S_SLASH_EQ, [CL_SLASH] = S_LINE_COMMENT, [CL_STAR] = S_BLOCK_COMMENT },
+  [S_SLASH_EQ] = { [CL_SLASH] = S_LINE_COMMENT, [CL_STAR] = S_BLOCK_COMMENT },
+  [S_AMP] = { [CL_AMP] = S_DOUBLE },
+  [S_PIPE] = { [CL_PIPE] = S_DOUBLE },
+};
+
+static const TokenKind accepts[S_COUNT] = {
+  [S_IDENT] = TK_NAME,
+  [S_PAREN] = TK_PAREN,
+  [S_SEP] = TK_SEP,
+  [S_OP] = TK_OP,
+  [S_OP_EQ] = TK_OP,
+  [S_MINUS] = TK_OP,
+  [S_MINUS_EQ] = TK_OP,
+  [S_ARROW] = TK_ACCESS,
+  [S_SLASH] = TK_OP,
+  [S_SLASH_EQ] = TK_OP,
+  [S_AMP] = TK_OP,
+  [S_PIPE] = TK_OP,
+  [S_DOUBLE] = TK_OP,
+};
+
+// perfect hash of the keywords by length, first and last character
+#define KEYWORD_HASH(len, first, last) (((len) + 2 * (first) + (last)) & 7)
+// (string subscripts are no constant expressions, so the slots are written out)
+static const struct {
+  String_View name;
+  TokenKind kind;
+} keywords[8] = {
+  [0] = { SV_STATIC("struct"), TK_STRUCT },
+  [1] = { SV_STATIC("true"), TK_LIT },
+  [2] = { SV_STATIC("__attribute__"), TK_ATTRIB },
+  [3] = { SV_STATIC("enum"), TK_ENUM },
+  [5] = { SV_STATIC("typedef"), TK_TYPEDF },
+  [6] = { SV_STATIC("false"), TK_LIT },
+  [7] = { SV_STATIC("const"), TK_ATTRIB },
+};
+
+static TokenKind keyword_kind(String_View name) {
+  const unsigned char first = name.data[0], last = name.data[name.count - 1];
+  const String_View kw = keywords[KEYWORD_HASH(name.count, first, last)].name;
+  if (kw.count == name.count && memcmp(kw.data, name.data, name.count) == 0)
+    return keywords[KEYWORD_HASH(name.count, first, last)].kind;
+  return TK_NAME;
+}
+
+static TokenOrEnd lexer_peek_token_table(Lexer *lexer) {
+  lexer_remove_space(lexer);
+  if (lexer->content.count == 0) return lexer->peek; // no value
+
+  String_View token = {
+    .count = 0,
+    .data = lexer->content.data,
+  };
+  const unsigned char *data = (const unsigned char *)lexer->content.data;
+  const size_t count = lexer->content.count;
+  unsigned state = S_START;
+  size_t i = 0;
+  while (true) {
+    const unsigned next = transitions[state][i < count ? char_classes[data[i]] : CL_END];
+    if (next == S_STOP || next >= S_FIRST_ACTION) {
+      // all characters so far were on the current line
+      lexer->content.data += i;
+      lexer->content.count -= i;
+      token.count += i;
+      if (next != S_STOP) state = next;
+      break;
     }
+    state = next;
+    i += 1;
   }
-  lexer_exit_err(lexer->loc, stderr, "Unclosed string literal");
+
+  TokenKind kind = accepts[state];
+  switch ((LexerState) state) {
+  case S_START: lexer_exit_err(lexer_loc(lexer, lexer->content.data), stderr, "Unknown token starts with '%c'", lexer->content.data[0]); break;
+  case S_IDENT: if (token.count >= 4 && token.count <= 13) kind = keyword_kind(token); break;
+  case S_NUMBER: kind = TK_LIT; lexer_consume_number_lit(lexer, &token); break;
+  case S_DOT:
+    kind = TK_ACCESS;
+    lexer_consume_char(lexer, &token); // .
+    if (lexer->content.count >= 2 && lexer->content.data[0] == '.' && lexer->content.data[1] == '.') {
+      kind = TK_NAME;
+      lexer_consume_char(lexer, &token); // .
+      lexer_consume_char(lexer, &token); // .
+    }
+    break;
+  case S_CHAR: kind = TK_LIT; lexer_consume_char_lit(lexer, &token); break;
+  case S_STRING: kind = TK_LIT; lexer_consume_string(lexer, &token); break;
+  case S_DIRECTIVE: kind = TK_DIRECTIVE; lexer_consume_directive(lexer, &token); break;
+  case S_LINE_COMMENT: kind = TK_COMMENT; lexer_consume_line_comment(lexer, &token); break;
+  case S_BLOCK_COMMENT: kind = TK_COMMENT; lexer_consume_block_comment(lexer, &token); break;
+  case S_STOP: case S_PAREN: case S_SEP: case S_OP: case S_OP_EQ: case S_MINUS: case S_MINUS_EQ:
+  case S_ARROW: case S_SLASH: case S_SLASH_EQ: case S_AMP: case S_PIPE: case S_DOUBLE: case S_COUNT:
+    break;
+  }
+
+  lexer->peek.has_value = true;
+  lexer->peek.token = (Token) {
+    .content = token,
+    .kind = kind,
+  };
+  return lexer->peek;
 }
 
 TokenOrEnd lexer_peek_token(Lexer *lexer) {
   if (lexer->peek.has_value) return lexer->peek;
   lexer->peek.has_value = false;
+  if (lexer->flags & LEXER_TABLE) return lexer_peek_token_table(lexer);
 
   lexer_remove_space(lexer);
   if (lexer->content.count == 0) return lexer->peek; // no value
@@ -155,7 +382,6 @@ TokenOrEnd lexer_peek_token(Lexer *lexer) {
     .count = 0,
     .data = lexer->content.data,
   };
-  const Location token_loc = lexer->loc;
   const char c = lexer->content.data[0];
   if (isspace(c)) {
     assert(0 && "unreachable: lexer_remove_space should have removed this");
@@ -174,7 +400,7 @@ TokenOrEnd lexer_peek_token(Lexer *lexer) {
       lexer_consume_char(lexer, &token); // .
       lexer_consume_char(lexer, &token); // .
     } else PRODUCE(TK_ACCESS);
-  } else if (c == '=' || c == '+' || c == '-' || c == '*' || c == '/' || c == '!' || c == '^' || c == '>' || c == '<') {
+  } else if (c == '=' || c == '+' || c == '-' || c == '*' || c == '/' || c == '!' || c == '^' || c == '>' || c == '<' || c == '%' || c == '~') {
     last_kind = TK_OP;
     lexer_consume_char(lexer, &token); // op
     SV_PEEK(lexer->content, 0, cc, if (cc == '=') lexer_consume_char(lexer, &token));
@@ -197,11 +423,7 @@ TokenOrEnd lexer_peek_token(Lexer *lexer) {
     SV_PEEK(lexer->content, 0, cc, if (cc == c || c == '=') lexer_consume_char(lexer, &token));
   } else if (c == '\'') {
     last_kind = TK_LIT;
-    lexer_consume_char(lexer, &token); // '
-    SV_PEEK(lexer->content, 0, cc, if (cc == '\\') lexer_consume_char(lexer, &token));
-    if (lexer->content.count <= 1 || lexer->content.data[1] != '\'') lexer_exit_err(lexer->loc, stderr, "Unclosed character literal");
-    lexer_consume_char(lexer, &token); // char
-    lexer_consume_char(lexer, &token); // '
+    lexer_consume_char_lit(lexer, &token);
   } else if (c == '"') {
     last_kind = TK_LIT;
     lexer_consume_string(lexer, &token);
@@ -209,7 +431,7 @@ TokenOrEnd lexer_peek_token(Lexer *lexer) {
     last_kind = TK_DIRECTIVE;
     lexer_consume_directive(lexer, &token);
   } else {
-    lexer_exit_err(lexer->loc, stderr, "Unknown token starts with '%c'", c);
+    lexer_exit_err(lexer_loc(lexer, lexer->content.data), stderr, "Unknown token starts with '%c'", c);
   }
 
   lexer->peek.has_value = true;
@@ -228,7 +450,6 @@ TokenOrEnd lexer_peek_token(Lexer *lexer) {
     }
   }
   lexer->peek.token = (Token) {
-    .loc = token_loc,
     .content = token,
     .kind = last_kind,
   };
@@ -244,10 +465,38 @@ TokenOrEnd lexer_get_token(Lexer *lexer) {
 Token lexer_expect_token(Lexer *lexer) {
   TokenOrEnd token = lexer_get_token(lexer);
   if (!token.has_value)
-    lexer_exit_err(lexer->loc, stderr, "Expected token but got end of file");
+    lexer_exit_err(lexer_loc(lexer, lexer->content.data), stderr, "Expected token but got end of file");
   return token.token;
 }
 
+Location lexer_loc(Lexer *lexer, const char *at) {
+  assert(at >= lexer->source.data && at <= lexer->source.data + lexer->source.count);
+  if (lexer->line_starts_count == 0) {
+    const char *data = lexer->source.data;
+    const size_t count = lexer->source.count;
+    ARRAY_PUSH(*lexer, line_starts, (size_t)0);
+    for (size_t i = scan_byte(data, count, '\n'); i < count; i += 1 + scan_byte(data + i + 1, count - i - 1, '\n'))
+      ARRAY_PUSH(*lexer, line_starts, i + 1);
+  }
+  // last line starting at or before `at`
+  const size_t offset = at - lexer->source.data;
+  size_t lo = 0, hi = lexer->line_starts_count;
+  while (hi - lo > 1) {
+    const size_t mid = lo + (hi - lo) / 2;
+    if (lexer->line_starts[mid] <= offset) lo = mid;
+    else hi = mid;
+  }
+  return (Location) {
+    .filename = lexer->filename,
+    .line = lo,
+    .col = offset - lexer->line_starts[lo],
+  };
+}
+
+Location lexer_token_loc(Lexer *lexer, Token token) {
+  return lexer_loc(lexer, token.content.data);
+}
+
 void lexer_dump_loc(Location loc, FILE *stream) {
   fprintf(stream, SV_Fmt ":%zu:%zu", SV_Arg(loc.filename), loc.line + 1, loc.col + 1);
 }
@@ -274,8 +523,8 @@ void lexer_dump_warn(Location loc, FILE *stream, char *fmt, ...) {
   fprintf(stream, "\n");
 }
 
-void lexer_dump_token(Token token, FILE *stream) {
-  lexer_dump_loc(token.loc, stream);
+void lexer_dump_token(Lexer *lexer, Token token, FILE *stream) {
+  lexer_dump_loc(lexer_token_loc(lexer, token), stream);
   fprintf(stream, ": ");
   switch (token.kind)
   {
@@ -295,3 +544,165 @@ void lexer_dump_token(Token token, FILE *stream) {
   }
   fprintf(stream, " " SV_Fmt "\n", SV_Arg(token.content));
 }
+
+static void tokens_push(TokenBuffer *tokens, uint32_t offset, uint32_t length, TokenKind kind) {
+  if (tokens->count == tokens->cap) {
+    tokens->cap = tokens->cap ? tokens->cap * 2 : ARRAY_INIT_CAP;
+    tokens->offsets = realloc(tokens->offsets, tokens->cap * sizeof(*tokens->offsets));
+    tokens->lengths = realloc(tokens->lengths, tokens->cap * sizeof(*tokens->lengths));
+    tokens->kinds = realloc(tokens->kinds, tokens->cap * sizeof(*tokens->kinds));
+    if (tokens->offsets == NULL || tokens->lengths == NULL || tokens->kinds == NULL) {
+      perror("realloc tokens_push");
+      exit(1);
+    }
+  }
+  tokens->offsets[tokens->count] = offset;
+  tokens->lengths[tokens->count] = length;
+  tokens->kinds[tokens->count] = kind;
+  tokens->count += 1;
+}
+
+TokenBuffer tokens_lex(String_View filename, String_View content) {
+  return tokens_lex_range(filename, content, 0, content.count);
+}
+
+TokenBuffer tokens_lex_range(String_View filename, String_View content, size_t start, size_t end) {
+  assert(start <= end && end <= content.count);
+  TokenBuffer tokens = { .lexer = lexer_create(filename, content) };
+  if (content.count > UINT32_MAX) {
+    fprintf(stderr, "ERROR: " SV_Fmt ": too large to lex (%zu bytes)\n", SV_Arg(filename), content.count);
+    exit(1);
+  }
+  tokens.lexer.content = sv_from_parts(content.data + start, end - start);
+  for (TokenOrEnd t = lexer_get_token(&tokens.lexer); t.has_value; t = lexer_get_token(&tokens.lexer))
+    tokens_push(&tokens, t.token.content.data - content.data, t.token.content.count, t.token.kind);
+  return tokens;
+}
+
+// end of a line consumed like lexer_consume_line, starting at `i`
+static size_t split_skip_line(const char *data, size_t count, size_t i) {
+  while (true) {
+    const size_t n = i + scan_byte(data + i, count - i, '\n');
+    if (n == count) return count;
+    const bool escaped = n > i && data[n - 1] == '\\';
+    i = n + 1;
+    if (!escaped) return i;
+  }
+}
+
+// end of a number literal like lexer_consume_number_lit, starting at its first digit `i`
+static size_t split_skip_number(const char *data, size_t count, size_t i) {
+  if (count - i >= 2 && data[i] == '0') {
+    const char t = toupper(data[i + 1]);
+    if (t == 'X') {
+      for (i += 2; i < count && is_hex_number(data[i]); ++i);
+    } else if (t == 'B') {
+      for (i += 2; i < count && is_bin_number(data[i]); ++i);
+    } else for (; i < count && is_oct_number(data[i]); ++i);
+    for (; i < count && is_number_suffix(data[i]); ++i);
+    return i;
+  }
+  for (; i < count && is_number(data[i]); ++i);
+  for (; i < count && is_number_suffix(data[i]); ++i);
+  return i;
+}
+
+size_t tokens_split(String_View content, size_t chunk, size_t *splits, size_t max) {
+  const char *data = content.data;
+  const size_t count = content.count;
+  size_t found = 0, last = 0, depth = 0;
+  size_t i = 0;
+  while (found < max && i < count) {
+    if (i > 0 && data[i - 1] == '\n' && i - last >= chunk && (depth == 0 || data[i] == '#'))
+      splits[found++] = last = i;
+    const char c = data[i];
+    switch ((CharClass) char_classes[(unsigned char)c]) {
+    case CL_SPACE: case CL_SEP: case CL_DOT: case CL_EQ: case CL_MINUS: case CL_GT: case CL_STAR:
+    case CL_AMP: case CL_PIPE: case CL_OP:
+      // the lexer joins some of these into one token, which never changes where the next one starts
+      i += 1;
+      break;
+    case CL_ALPHA:
+      // same as is_ident, without a call per character
+      while (++i < count && (char_classes[(unsigned char)data[i]] == CL_ALPHA || char_classes[(unsigned char)data[i]] == CL_DIGIT));
+      break;
+    case CL_DIGIT:
+      i = split_skip_number(data, count, i);
+      break;
+    case CL_PAREN:
+      if (c == '{') depth += 1;
+      if (c == '}' && depth-- == 0) return found; // left to collect_structs to report
+      i += 1;
+      break;
+    case CL_HASH:
+      i = split_skip_line(data, count, i + 1);
+      break;
+    case CL_SLASH:
+      i += 1;
+      if (i < count && data[i] == '=') i += 1;
+      if (i < count && data[i] == '/') {
+        i = split_skip_line(data, count, i + 1);
+      } else if (i < count && data[i] == '*') {
+        // like lexer_consume_block_comment, the opening star does not close it
+        size_t j = i + 1;
+        while ((j += scan_byte(data + j, count - j, '*')) < count && (j += 1) < count && data[j] != '/');
+        if (j >= count) return found; // unclosed, the rest of the file is comment
+        i = j + 1;
+      }
+      break;
+    case CL_DQUOTE: {
+      size_t j = i + 1;
+      while (j < count && (j += scan_byte2(data + j, count - j, '"', '\\')) < count && data[j] == '\\') j += 2;
+      if (j >= count) return found; // unclosed, an error at the end anyway
+      i = j + 1;
+    } break;
+    case CL_QUOTE: {
+      // like lexer_consume_char_lit, unclosed on its line is an error
+      size_t j = i + 1;
+      while (j < count && data[j] != '\'' && data[j] != '\n') j += data[j] == '\\' ? 2 : 1;
+      if (j >= count || data[j] != '\'') return found;
+      i = j + 1;
+    } break;
+    case CL_OTHER: case CL_END: case CL_COUNT:
+      return found; // unknown token, later pieces must not report errors before it
+    }
+  }
+  return found;
+}
+
+TokenBuffer tokens_join(TokenBuffer *chunks, size_t count) {
+  assert(count > 0);
+  TokenBuffer tokens = chunks[count - 1]; // its lexer reached the end of the source
+  size_t total = 0;
+  for (size_t i = 0; i < count; ++i) total += chunks[i].count;
+  tokens.offsets = malloc(total * sizeof(*tokens.offsets));
+  tokens.lengths = malloc(total * sizeof(*tokens.lengths));
+  tokens.kinds = malloc(total * sizeof(*tokens.kinds));
+  if (total > 0 && (tokens.offsets == NULL || tokens.lengths == NULL || tokens.kinds == NULL)) {
+    perror("malloc tokens_join");
+    exit(1);
+  }
+  tokens.count = tokens.cap = 0;
+  for (size_t i = 0; i < count; ++i) {
+    if (chunks[i].count > 0) {
+      memcpy(tokens.offsets + tokens.count, chunks[i].offsets, chunks[i].count * sizeof(*tokens.offsets));
+      memcpy(tokens.lengths + tokens.count, chunks[i].lengths, chunks[i].count * sizeof(*tokens.lengths));
+      memcpy(tokens.kinds + tokens.count, chunks[i].kinds, chunks[i].count * sizeof(*tokens.kinds));
+      tokens.count += chunks[i].count;
+    }
+    free(chunks[i].offsets);
+    free(chunks[i].lengths);
+    free(chunks[i].kinds);
+    if (i + 1 < count) lexer_free(&chunks[i].lexer);
+  }
+  tokens.cap = total;
+  return tokens;
+}
+
+void tokens_free(TokenBuffer *tokens) {
+  lexer_free(&tokens->lexer);
+  free(tokens->offsets);
+  free(tokens->lengths);
+  free(tokens->kinds);
+  *tokens = (TokenBuffer) {0};
+}
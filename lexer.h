@@ -1,6 +1,8 @@
 #pragma once
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
+#include "array.h"
 #include "sv.h"
 
 typedef struct {
@@ -23,8 +25,8 @@ typedef enum {
   TK_LIT,
   TK_ATTRIB,
 } TokenKind;
+// the location of a token is resolved from its content through `lexer_token_loc`
 typedef struct {
-  Location loc;
   String_View content;
   TokenKind kind;
 } Token;
@@ -33,18 +35,63 @@ typedef struct {
   Token token;
 } TokenOrEnd;
 
+typedef enum {
+  LEXER_TABLE = 1 << 0, // table-driven DFA instead of character comparisons, same tokens
+} LexerFlags;
+
 typedef struct {
-  Location loc;
-  String_View content;
+  String_View filename;
+  String_View source; // all content, positions are byte offsets into it
+  String_View content; // not yet lexed
   TokenOrEnd peek;
+  LexerFlags flags;
+  MAKE_ARRAY(size_t, line_starts) // built on the first lookup of a location
 } Lexer;
 
+// flags of lexers made by lexer_create, set before lexing starts
+extern LexerFlags lexer_default_flags;
+
 Lexer lexer_create(String_View filename, String_View content);
+void lexer_free(Lexer*);
 TokenOrEnd lexer_peek_token(Lexer*);
 TokenOrEnd lexer_get_token(Lexer*);
 Token lexer_expect_token(Lexer*);
+// line and column of `at`, which points into the source of the lexer
+Location lexer_loc(Lexer*, const char *at);
+Location lexer_token_loc(Lexer*, Token);
 void lexer_dump_loc(Location, FILE*);
 __attribute__((format(printf,3,4))) void lexer_dump_err(Location, FILE*, char *fmt, ...);
-#define lexer_exit_err(...) { lexer_dump_err(__VA_ARGS__); exit(1); } while(0)
+#define lexer_exit_err(...) do { lexer_dump_err(__VA_ARGS__); exit(1); } while(0)
 __attribute__((format(printf,3,4))) void lexer_dump_warn(Location, FILE*, char *fmt, ...);
-void lexer_dump_token(Token, FILE*);
+void lexer_dump_token(Lexer*, Token, FILE*);
+
+// All tokens of a source, lexed in one pass into parallel arrays: token `i` is
+// `source[offsets[i] .. offsets[i] + lengths[i]]` of kind `kinds[i]`
+typedef struct {
+  Lexer lexer; // keeps the source and resolves locations
+  uint32_t *offsets;
+  uint32_t *lengths; // comments and directives may be longer than 16 bits
+  uint8_t *kinds;
+  size_t count;
+  size_t cap;
+} TokenBuffer;
+
+TokenBuffer tokens_lex(String_View filename, String_View content);
+// tokens of `content[start .. end)`, offsets and locations still refer to all of `content`
+TokenBuffer tokens_lex_range(String_View filename, String_View content, size_t start, size_t end);
+// Finds up to `max` line starts in `content` where lexing can begin afresh, to lex the
+// pieces between them independently: no comment, string or directive is open there and
+// braces are balanced (or the line is a directive), each at least `chunk` bytes after the
+// previous one. Nothing after the first text the lexer could reject is split, so errors
+// are only ever met in the last piece. Returns the number of offsets written to `splits`.
+size_t tokens_split(String_View content, size_t chunk, size_t *splits, size_t max);
+// concatenates the tokens of consecutive ranges of one source (and frees them), the same
+// buffer as lexing all of it at once
+TokenBuffer tokens_join(TokenBuffer *chunks, size_t count);
+void tokens_free(TokenBuffer*);
+static inline Token tokens_at(const TokenBuffer *tokens, size_t i) {
+  return (Token) {
+    .content = sv_from_parts(tokens->lexer.source.data + tokens->offsets[i], tokens->lengths[i]),
+    .kind = (TokenKind)tokens->kinds[i],
+  };
+}
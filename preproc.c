@@ -0,0 +1,1158 @@
+#define _GNU_SOURCE
+#include <assert.h>
+#include <ctype.h>
+#include <glob.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "preproc.h"
+
+#define STRINGIFY(x) #x
+#define TOSTRING(x) STRINGIFY(x)
+#define MAX_INCLUDE_DEPTH 200
+#define MAX_EXPANSION_DEPTH 256
+
+// NOTE: this is not a complete preprocessor, it only needs to find out which lines of the
+// included headers are active. #if expressions are evaluated with intmax_t, unknown
+// identifiers and builtins (__has_builtin, ...) are 0, #error and #line are ignored.
+
+typedef struct {
+  char *text; // name, params and body point into this
+  String_View name;
+  MAKE_ARRAY(String_View, params)
+  String_View body;
+  bool function_like;
+  bool variadic;
+} Macro;
+
+typedef struct {
+  char *path;
+  char *dir;
+  String_View content; // data is NULL if the file does not exist
+  char *guard; // include guard macro, if the whole file is wrapped in one
+  bool system; // found in a system directory, marked as such in linemarkers
+  bool once;
+  bool entered;
+} SourceFile;
+
+typedef struct {
+  String_View key;
+  void *value; // NULL for removed entries (#undef)
+} PPEntry;
+typedef struct {
+  PPEntry *items;
+  size_t count;
+  size_t cap;
+} PPMap;
+
+typedef struct {
+  const PPConfig *config;
+  MAKE_ARRAY(char *, search)
+  PPMap macros;
+  PPMap files;
+  MAKE_ARRAY(Macro *, macro_list)
+  MAKE_ARRAY(SourceFile *, sources)
+  Macro *disabled[MAX_EXPANSION_DEPTH];
+  size_t disabled_count;
+  size_t depth;
+  StringBuilder out;
+} PP;
+
+typedef struct {
+  bool parent_active;
+  bool active;
+  bool taken;
+} Cond;
+
+
+static uint64_t pp_hash(String_View sv) {
+  uint64_t hash = 14695981039346656037ULL; // FNV-1a
+  for (size_t i = 0; i < sv.count; ++i) {
+    hash ^= (unsigned char)sv.data[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+static PPEntry *map_find(const PPMap *map, String_View key) {
+  if (map->cap == 0) return NULL;
+  const size_t mask = map->cap - 1;
+  for (size_t i = pp_hash(key) & mask;; i = (i + 1) & mask) {
+    PPEntry *entry = &map->items[i];
+    if (entry->key.data == NULL) return NULL;
+    if (sv_eq(entry->key, key)) return entry;
+  }
+}
+
+static void *map_get(const PPMap *map, String_View key) {
+  PPEntry *entry = map_find(map, key);
+  return entry ? entry->value : NULL;
+}
+
+// `key` has to stay valid as long as the map lives
+static void map_put(PPMap *map, String_View key, void *value) {
+  if ((map->count + 1) * 2 > map->cap) {
+    PPMap grown = { .cap = map->cap ? map->cap * 2 : 256 };
+    grown.items = calloc(grown.cap, sizeof(PPEntry));
+    if (grown.items == NULL) {
+      perror("calloc map_put");
+      exit(1);
+    }
+    for (size_t i = 0; i < map->cap; ++i) {
+      if (map->items[i].key.data) map_put(&grown, map->items[i].key, map->items[i].value);
+    }
+    free(map->items);
+    *map = grown;
+  }
+  const size_t mask = map->cap - 1;
+  for (size_t i = pp_hash(key) & mask;; i = (i + 1) & mask) {
+    PPEntry *entry = &map->items[i];
+    if (entry->key.data == NULL) {
+      entry->key = key;
+      map->count += 1;
+    } else if (!sv_eq(entry->key, key)) {
+      continue;
+    }
+    entry->value = value;
+    return;
+  }
+}
+
+
+static bool is_ident_start(char c) {
+  return isalpha((unsigned char)c) || c == '_';
+}
+
+static bool is_ident_char(char c) {
+  return isalnum((unsigned char)c) || c == '_';
+}
+
+static String_View take_ident(String_View *sv) {
+  size_t i = 0;
+  while (i < sv->count && is_ident_char(sv->data[i])) i += 1;
+  return sv_chop_left(sv, i);
+}
+
+static String_View take_number(String_View *sv) {
+  size_t i = 0;
+  while (i < sv->count) {
+    const char c = sv->data[i];
+    if ((c == '+' || c == '-') && i > 0 && strchr("eEpP", sv->data[i - 1])) i += 1;
+    else if (is_ident_char(c) || c == '.' || c == '\'') i += 1;
+    else break;
+  }
+  return sv_chop_left(sv, i);
+}
+
+// string or character literal, ends at the closing quote or the end of `sv`
+static String_View take_quoted(String_View *sv) {
+  const char quote = sv->data[0];
+  size_t i = 1;
+  while (i < sv->count && sv->data[i] != quote) {
+    if (sv->data[i] == '\\') i += 1;
+    i += 1;
+  }
+  if (i < sv->count) i += 1;
+  return sv_chop_left(sv, i);
+}
+
+// matching parenthesis group starting at sv->data[0] == '(', returns false if unbalanced
+static bool take_group(String_View *sv, String_View *group) {
+  size_t depth = 0;
+  String_View rest = *sv;
+  while (rest.count) {
+    const char c = rest.data[0];
+    if (c == '"' || c == '\'') {
+      take_quoted(&rest);
+      continue;
+    }
+    sv_chop_left(&rest, 1);
+    if (c == '(') depth += 1;
+    if (c == ')' && --depth == 0) {
+      *group = sv_from_parts(sv->data, rest.data - sv->data);
+      *sv = rest;
+      return true;
+    }
+  }
+  return false;
+}
+
+
+// logical line (backslash-newline continuations joined), counts physical lines in `lines`
+static String_View next_line(String_View *rest, size_t *lines) {
+  String_View line = sv_from_parts(rest->data, 0);
+  while (rest->count) {
+    String_View physical = sv_chop_by_delim(rest, '\n');
+    *lines += 1;
+    line.count = physical.data + physical.count - line.data;
+    if (physical.count && physical.data[physical.count - 1] == '\r') physical.count -= 1;
+    if (physical.count == 0 || physical.data[physical.count - 1] != '\\') break;
+  }
+  return line;
+}
+
+// returns whether a block comment is still open at the end of `line`
+static bool scan_comments(String_View line, bool in_comment) {
+  while (line.count) {
+    const char c = line.data[0];
+    const char n = line.count > 1 ? line.data[1] : 0;
+    if (in_comment) {
+      if (c == '*' && n == '/') {
+        in_comment = false;
+        sv_chop_left(&line, 1);
+      }
+    } else if (c == '/' && n == '*') {
+      in_comment = true;
+      sv_chop_left(&line, 1);
+    } else if (c == '/' && n == '/') {
+      return false;
+    } else if (c == '"' || c == '\'') {
+      take_quoted(&line);
+      continue;
+    }
+    sv_chop_left(&line, 1);
+  }
+  return in_comment;
+}
+
+// copies a directive without comments and line continuations, `in_comment` is set if a
+// block comment is left open
+static void clean_directive(String_View line, StringBuilder *sb, bool *in_comment) {
+  *in_comment = false;
+  while (line.count) {
+    const char c = line.data[0];
+    const char n = line.count > 1 ? line.data[1] : 0;
+    if (*in_comment) {
+      if (c == '*' && n == '/') {
+        *in_comment = false;
+        sv_chop_left(&line, 1);
+      }
+      sv_chop_left(&line, 1);
+    } else if (c == '\\' && (n == '\n' || n == '\r')) {
+      sv_chop_left(&line, 2);
+    } else if (c == '/' && n == '*') {
+      *in_comment = true;
+      sb_append(sb, " ", 1);
+      sv_chop_left(&line, 2);
+    } else if (c == '/' && n == '/') {
+      return;
+    } else if (c == '"' || c == '\'') {
+      String_View quoted = take_quoted(&line);
+      sb_append(sb, quoted.data, quoted.count);
+    } else {
+      sb_append(sb, c == '\n' || c == '\r' ? " " : &c, 1);
+      sv_chop_left(&line, 1);
+    }
+  }
+}
+
+
+static bool pp_defined(const PP *pp, String_View name) {
+  if (map_get(&pp->macros, name)) return true;
+  return sv_eq(name, SV("__has_include")) || sv_eq(name, SV("__has_include_next"));
+}
+
+static void pp_define(PP *pp, String_View definition) {
+  Macro *macro = calloc(1, sizeof(Macro));
+  char *text = strndup(definition.data, definition.count);
+  if (macro == NULL || text == NULL) {
+    perror("malloc pp_define");
+    exit(1);
+  }
+  macro->text = text;
+  String_View rest = sv_from_parts(text, definition.count);
+  macro->name = take_ident(&rest);
+  if (macro->name.count == 0) {
+    free(text);
+    free(macro);
+    return;
+  }
+  if (rest.count && rest.data[0] == '(') {
+    macro->function_like = true;
+    sv_chop_left(&rest, 1);
+    String_View params = sv_chop_by_delim(&rest, ')');
+    while (params.count) {
+      String_View param = sv_trim(sv_chop_by_delim(&params, ','));
+      if (sv_ends_with(param, SV("..."))) {
+        macro->variadic = true;
+        param = sv_trim(sv_from_parts(param.data, param.count - 3));
+        if (param.count == 0) param = SV("__VA_ARGS__");
+      }
+      if (param.count) ARRAY_PUSH(*macro, params, param);
+    }
+  }
+  macro->body = sv_trim(rest);
+  ARRAY_PUSH(*pp, macro_list, macro);
+  map_put(&pp->macros, macro->name, macro);
+}
+
+static void pp_undef(PP *pp, String_View name) {
+  PPEntry *entry = map_find(&pp->macros, name);
+  if (entry) entry->value = NULL;
+}
+
+static bool pp_disabled(const PP *pp, const Macro *macro) {
+  for (size_t i = 0; i < pp->disabled_count; ++i)
+    if (pp->disabled[i] == macro) return true;
+  return false;
+}
+
+static void pp_expand(PP *pp, String_View in, StringBuilder *out);
+
+static void pp_expand_macro(PP *pp, Macro *macro, String_View replacement, StringBuilder *out) {
+  // spaces keep the expansion from gluing to its surroundings (`-A` with `#define A -1`)
+  sb_append(out, " ", 1);
+  if (pp->disabled_count < MAX_EXPANSION_DEPTH) {
+    pp->disabled[pp->disabled_count++] = macro;
+    pp_expand(pp, replacement, out);
+    pp->disabled_count -= 1;
+  } else {
+    sb_append(out, replacement.data, replacement.count);
+  }
+  sb_append(out, " ", 1);
+}
+
+static long param_index(const Macro *macro, String_View name) {
+  for (size_t i = 0; i < macro->params_count; ++i)
+    if (sv_eq(macro->params[i], name)) return i;
+  return -1;
+}
+
+static void stringify(String_View arg, StringBuilder *out) {
+  sb_append(out, "\"", 1);
+  for (size_t i = 0; i < arg.count; ++i) {
+    if (arg.data[i] == '"' || arg.data[i] == '\\') sb_append(out, "\\", 1);
+    sb_append(out, &arg.data[i], 1);
+  }
+  sb_append(out, "\"", 1);
+}
+
+// replaces parameters in the body of `macro` by the arguments
+static void pp_substitute(PP *pp, const Macro *macro, const String_View *args, StringBuilder *out) {
+  String_View body = macro->body;
+  bool pasting = false;
+  while (body.count) {
+    const char c = body.data[0];
+    if (c == '#' && body.count > 1 && body.data[1] == '#') {
+      while (out->items_count && isspace((unsigned char)out->items[out->items_count - 1])) out->items_count -= 1;
+      sv_chop_left(&body, 2);
+      body = sv_trim_left(body);
+      pasting = true;
+    } else if (c == '#') {
+      sv_chop_left(&body, 1);
+      body = sv_trim_left(body);
+      String_View name = take_ident(&body);
+      long index = param_index(macro, name);
+      if (index >= 0) stringify(args[index], out);
+      else {
+        sb_append(out, "#", 1);
+        sb_append(out, name.data, name.count);
+      }
+      pasting = false;
+    } else if (is_ident_start(c)) {
+      String_View name = take_ident(&body);
+      long index = param_index(macro, name);
+      if (index < 0) sb_append(out, name.data, name.count);
+      else if (pasting || sv_starts_with(sv_trim_left(body), SV("##"))) sb_append(out, args[index].data, args[index].count);
+      else pp_expand(pp, args[index], out); // arguments are fully expanded before substitution
+      pasting = false;
+    } else if (c == '"' || c == '\'') {
+      String_View quoted = take_quoted(&body);
+      sb_append(out, quoted.data, quoted.count);
+      pasting = false;
+    } else {
+      sb_append(out, &c, 1);
+      sv_chop_left(&body, 1);
+      if (!isspace((unsigned char)c)) pasting = false;
+    }
+  }
+}
+
+// splits the group `(a, (b, c), d)` into arguments, the variadic rest is kept as one argument
+static String_View *split_args(const Macro *macro, String_View group) {
+  const size_t n = macro->params_count ? macro->params_count : 1;
+  String_View *args = calloc(n, sizeof(String_View));
+  if (args == NULL) {
+    perror("calloc split_args");
+    exit(1);
+  }
+  String_View rest = sv_from_parts(group.data + 1, group.count - 2); // without parens
+  size_t current = 0;
+  const char *start = rest.data;
+  size_t depth = 0;
+  while (true) {
+    const bool end = rest.count == 0;
+    const char c = end ? ',' : rest.data[0];
+    if (!end && (c == '"' || c == '\'')) {
+      take_quoted(&rest);
+      continue;
+    }
+    if (c == '(') depth += 1;
+    if (c == ')') depth -= 1;
+    const bool last = macro->variadic && current + 1 == n;
+    if (end || (c == ',' && depth == 0 && !last)) {
+      if (current < n) args[current++] = sv_trim(sv_from_parts(start, rest.data - start));
+      if (end) break;
+      start = rest.data + 1;
+    }
+    sv_chop_left(&rest, 1);
+  }
+  return args;
+}
+
+static void pp_expand(PP *pp, String_View in, StringBuilder *out) {
+  while (in.count) {
+    const char c = in.data[0];
+    if (is_ident_start(c)) {
+      String_View name = take_ident(&in);
+      sb_append(out, name.data, name.count);
+      if (sv_eq(name, SV("defined"))) {
+        // operand is never expanded
+        String_View operand = sv_trim_left(in);
+        String_View group;
+        if (operand.count && operand.data[0] == '(' && take_group(&operand, &group)) {
+          sb_append(out, group.data, group.count);
+          in = operand;
+        } else if (operand.count && is_ident_start(operand.data[0])) {
+          String_View ident = take_ident(&operand);
+          sb_append(out, " ", 1);
+          sb_append(out, ident.data, ident.count);
+          in = operand;
+        }
+        continue;
+      }
+      if (sv_eq(name, SV("__has_include")) || sv_eq(name, SV("__has_include_next"))) {
+        String_View operand = sv_trim_left(in);
+        String_View group;
+        if (operand.count && operand.data[0] == '(' && take_group(&operand, &group)) {
+          sb_append(out, group.data, group.count);
+          in = operand;
+        }
+        continue;
+      }
+      Macro *macro = map_get(&pp->macros, name);
+      if (macro == NULL || pp_disabled(pp, macro)) continue;
+      if (!macro->function_like) {
+        out->items_count -= name.count;
+        pp_expand_macro(pp, macro, macro->body, out);
+        continue;
+      }
+      String_View call = sv_trim_left(in);
+      String_View group;
+      if (!call.count || call.data[0] != '(' || !take_group(&call, &group)) continue; // just the name
+      in = call;
+      out->items_count -= name.count;
+      String_View *args = split_args(macro, group);
+      StringBuilder replacement = {0};
+      pp_substitute(pp, macro, args, &replacement);
+      pp_expand_macro(pp, macro, sv_from_parts(replacement.items, replacement.items_count), out);
+      free(replacement.items);
+      free(args);
+    } else if (isdigit((unsigned char)c)) {
+      String_View number = take_number(&in);
+      sb_append(out, number.data, number.count);
+    } else if (c == '"' || c == '\'') {
+      String_View quoted = take_quoted(&in);
+      sb_append(out, quoted.data, quoted.count);
+    } else {
+      sb_append(out, &c, 1);
+      sv_chop_left(&in, 1);
+    }
+  }
+}
+
+
+static char *path_join(const char *dir, String_View name) {
+  char *path = malloc(strlen(dir) + 1 + name.count + 1);
+  if (path == NULL) {
+    perror("malloc path_join");
+    exit(1);
+  }
+  const size_t n = strlen(dir);
+  if (strcmp(dir, ".") == 0) sprintf(path, SV_Fmt, SV_Arg(name)); // like `cc` names them
+  else sprintf(path, "%s%s" SV_Fmt, dir, n && dir[n - 1] == '/' ? "" : "/", SV_Arg(name));
+  return path;
+}
+
+// loads `path` (taking ownership) or returns the already known file
+static SourceFile *pp_source(PP *pp, char *path) {
+  SourceFile *file = map_get(&pp->files, sv_from_cstr(path));
+  if (file) {
+    free(path);
+    return file;
+  }
+  file = calloc(1, sizeof(SourceFile));
+  if (file == NULL) {
+    perror("calloc pp_source");
+    exit(1);
+  }
+  file->path = path;
+  FILE *f = fopen(path, "r");
+  if (f != NULL && fseek(f, 0, SEEK_END) == 0) {
+    long size = ftell(f);
+    char *data = size >= 0 ? malloc(size + 1) : NULL;
+    if (data && fseek(f, 0, SEEK_SET) == 0 && (size == 0 || fread(data, size, 1, f) == 1)) {
+      data[size] = 0;
+      file->content = sv_from_parts(data, size);
+      const char *slash = strrchr(path, '/');
+      file->dir = slash ? strndup(path, slash == path ? 1 : (size_t)(slash - path)) : strdup(".");
+    } else {
+      free(data);
+    }
+  }
+  if (f != NULL) fclose(f);
+  ARRAY_PUSH(*pp, sources, file);
+  map_put(&pp->files, sv_from_cstr(file->path), file);
+  return file;
+}
+
+// finds `name` like `cc` would: quoted includes next to the including file first, then
+// the search path (after the directory `from` was found in for #include_next)
+static SourceFile *pp_resolve(PP *pp, const SourceFile *from, size_t from_index, String_View name,
+    bool angled, bool next, size_t *index) {
+  if (name.count && name.data[0] == '/') {
+    *index = SIZE_MAX;
+    SourceFile *file = pp_source(pp, strndup(name.data, name.count));
+    return file->content.data ? file : NULL;
+  }
+  if (!angled && !next) {
+    SourceFile *file = pp_source(pp, path_join(from->dir, name));
+    if (file->content.data) {
+      *index = SIZE_MAX;
+      file->system = from->system;
+      return file;
+    }
+  }
+  for (size_t i = next && from_index != SIZE_MAX ? from_index + 1 : 0; i < pp->search_count; ++i) {
+    SourceFile *file = pp_source(pp, path_join(pp->search[i], name));
+    if (file->content.data) {
+      *index = i;
+      file->system = i >= pp->config->includes_count; // everything after -I
+      return file;
+    }
+  }
+  return NULL;
+}
+
+// parses `"name"` or `<name>`
+static bool parse_header_name(String_View spec, String_View *name, bool *angled) {
+  spec = sv_trim(spec);
+  if (spec.count < 2) return false;
+  const char close = spec.data[0] == '"' ? '"' : spec.data[0] == '<' ? '>' : 0;
+  if (!close) return false;
+  sv_chop_left(&spec, 1);
+  size_t end;
+  if (!sv_index_of(spec, close, &end)) return false;
+  *name = sv_from_parts(spec.data, end);
+  *angled = close == '>';
+  return true;
+}
+
+
+typedef struct {
+  PP *pp;
+  const SourceFile *file;
+  size_t index;
+  String_View in;
+} PPExpr;
+
+static intmax_t expr_ternary(PPExpr *e);
+
+static bool expr_op(PPExpr *e, const char *op) {
+  e->in = sv_trim_left(e->in);
+  const size_t n = strlen(op);
+  if (e->in.count < n || memcmp(e->in.data, op, n) != 0) return false;
+  if (n == 1 && e->in.count > 1) {
+    // do not match the start of a longer operator
+    const char next = e->in.data[1];
+    if (strchr("|&<>", op[0]) && next == op[0]) return false;
+    if (strchr("<>!=", op[0]) && next == '=') return false;
+  }
+  sv_chop_left(&e->in, n);
+  return true;
+}
+
+static intmax_t expr_char(String_View literal) {
+  if (literal.count < 3) return 0;
+  if (literal.data[1] != '\\') return (unsigned char)literal.data[1];
+  switch (literal.data[2]) {
+  case 'n': return '\n';
+  case 't': return '\t';
+  case 'r': return '\r';
+  case '0': return 0;
+  default: return (unsigned char)literal.data[2];
+  }
+}
+
+static intmax_t expr_primary(PPExpr *e) {
+  if (expr_op(e, "(")) {
+    intmax_t value = expr_ternary(e);
+    expr_op(e, ")");
+    return value;
+  }
+  if (e->in.count == 0) return 0;
+  const char c = e->in.data[0];
+  if (isdigit((unsigned char)c)) {
+    String_View number = take_number(&e->in);
+    char buf[64] = {0};
+    memcpy(buf, number.data, number.count < sizeof(buf) - 1 ? number.count : sizeof(buf) - 1);
+    return (intmax_t)strtoumax(buf, NULL, 0); // suffixes are ignored
+  }
+  if (c == '\'') return expr_char(take_quoted(&e->in));
+  if (!is_ident_start(c)) {
+    sv_chop_left(&e->in, 1);
+    return 0;
+  }
+  String_View name = take_ident(&e->in);
+  if (sv_eq(name, SV("defined"))) {
+    const bool paren = expr_op(e, "(");
+    e->in = sv_trim_left(e->in);
+    String_View macro = take_ident(&e->in);
+    if (paren) expr_op(e, ")");
+    return pp_defined(e->pp, macro);
+  }
+  if (sv_eq(name, SV("__has_include")) || sv_eq(name, SV("__has_include_next"))) {
+    e->in = sv_trim_left(e->in);
+    String_View group, header;
+    bool angled;
+    if (!e->in.count || e->in.data[0] != '(' || !take_group(&e->in, &group)) return 0;
+    if (!parse_header_name(sv_from_parts(group.data + 1, group.count - 2), &header, &angled)) return 0;
+    size_t index;
+    return pp_resolve(e->pp, e->file, e->index, header, angled, name.count > sizeof("__has_include") - 1, &index) != NULL;
+  }
+  if (sv_eq(name, SV("true"))) return 1;
+  // unknown identifiers are 0, including calls of builtins like __has_builtin(...)
+  String_View rest = sv_trim_left(e->in);
+  String_View group;
+  if (rest.count && rest.data[0] == '(' && take_group(&rest, &group)) e->in = rest;
+  return 0;
+}
+
+static intmax_t expr_unary(PPExpr *e) {
+  if (expr_op(e, "!")) return !expr_unary(e);
+  if (expr_op(e, "~")) return ~expr_unary(e);
+  if (expr_op(e, "-")) return -expr_unary(e);
+  if (expr_op(e, "+")) return expr_unary(e);
+  return expr_primary(e);
+}
+
+static intmax_t expr_mul(PPExpr *e) {
+  intmax_t value = expr_unary(e);
+  while (true) {
+    if (expr_op(e, "*")) value *= expr_unary(e);
+    else if (expr_op(e, "/")) {
+      intmax_t rhs = expr_unary(e);
+      value = rhs ? value / rhs : 0;
+    } else if (expr_op(e, "%")) {
+      intmax_t rhs = expr_unary(e);
+      value = rhs ? value % rhs : 0;
+    } else return value;
+  }
+}
+
+static intmax_t expr_add(PPExpr *e) {
+  intmax_t value = expr_mul(e);
+  while (true) {
+    if (expr_op(e, "+")) value += expr_mul(e);
+    else if (expr_op(e, "-")) value -= expr_mul(e);
+    else return value;
+  }
+}
+
+static intmax_t expr_shift(PPExpr *e) {
+  intmax_t value = expr_add(e);
+  while (true) {
+    if (expr_op(e, "<<")) value = (intmax_t)((uintmax_t)value << (expr_add(e) & 63));
+    else if (expr_op(e, ">>")) value >>= expr_add(e) & 63;
+    else return value;
+  }
+}
+
+static intmax_t expr_relational(PPExpr *e) {
+  intmax_t value = expr_shift(e);
+  while (true) {
+    if (expr_op(e, "<=")) value = value <= expr_shift(e);
+    else if (expr_op(e, ">=")) value = value >= expr_shift(e);
+    else if (expr_op(e, "<")) value = value < expr_shift(e);
+    else if (expr_op(e, ">")) value = value > expr_shift(e);
+    else return value;
+  }
+}
+
+static intmax_t expr_equality(PPExpr *e) {
+  intmax_t value = expr_relational(e);
+  while (true) {
+    if (expr_op(e, "==")) value = value == expr_relational(e);
+    else if (expr_op(e, "!=")) value = value != expr_relational(e);
+    else return value;
+  }
+}
+
+static intmax_t expr_bitand(PPExpr *e) {
+  intmax_t value = expr_equality(e);
+  while (expr_op(e, "&")) value &= expr_equality(e);
+  return value;
+}
+
+static intmax_t expr_bitxor(PPExpr *e) {
+  intmax_t value = expr_bitand(e);
+  while (expr_op(e, "^")) value ^= expr_bitand(e);
+  return value;
+}
+
+static intmax_t expr_bitor(PPExpr *e) {
+  intmax_t value = expr_bitxor(e);
+  while (expr_op(e, "|")) value |= expr_bitxor(e);
+  return value;
+}
+
+static intmax_t expr_and(PPExpr *e) {
+  intmax_t value = expr_bitor(e);
+  while (expr_op(e, "&&")) {
+    intmax_t rhs = expr_bitor(e);
+    value = value && rhs;
+  }
+  return value;
+}
+
+static intmax_t expr_or(PPExpr *e) {
+  intmax_t value = expr_and(e);
+  while (expr_op(e, "||")) {
+    intmax_t rhs = expr_and(e);
+    value = value || rhs;
+  }
+  return value;
+}
+
+static intmax_t expr_ternary(PPExpr *e) {
+  intmax_t cond = expr_or(e);
+  if (!expr_op(e, "?")) return cond;
+  intmax_t then = expr_ternary(e);
+  expr_op(e, ":");
+  intmax_t otherwise = expr_ternary(e);
+  return cond ? then : otherwise;
+}
+
+static bool pp_eval(PP *pp, const SourceFile *file, size_t index, String_View condition) {
+  StringBuilder expanded = {0};
+  pp_expand(pp, condition, &expanded);
+  PPExpr e = {
+    .pp = pp,
+    .file = file,
+    .index = index,
+    .in = sv_from_parts(expanded.items, expanded.items_count),
+  };
+  bool value = expr_ternary(&e) != 0;
+  free(expanded.items);
+  return value;
+}
+
+
+static void pp_linemarker(PP *pp, size_t line, const SourceFile *file, const char *flags) {
+  char buf[64];
+  int n = snprintf(buf, sizeof(buf), "# %zu \"", line);
+  sb_append(&pp->out, buf, n);
+  sb_append(&pp->out, file->path, strlen(file->path));
+  sb_append(&pp->out, "\"", 1);
+  sb_append(&pp->out, flags, strlen(flags));
+  if (file->system) sb_append(&pp->out, " 3 4", 4);
+  sb_append(&pp->out, "\n", 1);
+}
+
+// where the output of a file is
+typedef struct {
+  size_t line; // source line the next output line belongs to
+  bool newline; // the empty line of the last directive is due, `cc` drops it at the end of a file
+} OutPos;
+
+// moves the output to `line` of `file`, short gaps are filled with empty lines and longer
+// ones skipped by a linemarker, like `cc` does
+static void pp_sync(PP *pp, OutPos *pos, size_t line, const SourceFile *file) {
+  if (pos->newline) sb_append(&pp->out, "\n", 1);
+  pos->newline = false;
+  if (line - pos->line < 8) {
+    for (; pos->line < line; pos->line += 1) sb_append(&pp->out, "\n", 1);
+  } else {
+    pp_linemarker(pp, line, file, "");
+  }
+  pos->line = line;
+}
+
+// #define, #undef and #pragma as `cc -fdirectives-only` keeps them: parameters without
+// spaces and whitespace collapsed (`cc` also respaces around # and ##, which is not copied)
+static void pp_print_directive(PP *pp, String_View name, String_View args) {
+  sb_append(&pp->out, "#", 1);
+  sb_append(&pp->out, name.data, name.count);
+  sb_append(&pp->out, " ", 1);
+  if (!sv_eq(name, SV("pragma"))) {
+    String_View macro = take_ident(&args);
+    sb_append(&pp->out, macro.data, macro.count);
+    if (args.count && args.data[0] == '(') {
+      String_View params = sv_chop_by_delim(&args, ')');
+      for (size_t i = 0; i < params.count; ++i)
+        if (!isspace((unsigned char)params.data[i])) sb_append(&pp->out, &params.data[i], 1);
+      sb_append(&pp->out, ")", 1);
+    }
+    if (sv_eq(name, SV("define"))) sb_append(&pp->out, " ", 1);
+  }
+  if (!sv_eq(name, SV("undef"))) {
+    args = sv_trim(args);
+    while (args.count) {
+      if (args.data[0] == '"' || args.data[0] == '\'') {
+        String_View quoted = take_quoted(&args);
+        sb_append(&pp->out, quoted.data, quoted.count);
+      } else if (isspace((unsigned char)args.data[0])) {
+        sb_append(&pp->out, " ", 1);
+        args = sv_trim_left(args);
+      } else {
+        sb_append(&pp->out, args.data, 1);
+        sv_chop_left(&args, 1);
+      }
+    }
+  }
+  sb_append(&pp->out, "\n", 1);
+}
+
+static void pp_file(PP *pp, SourceFile *file, size_t index);
+
+// returns whether the file was entered, the output is then at the line after the #include
+static bool pp_include(PP *pp, const SourceFile *from, size_t from_index, size_t line,
+    String_View spec, bool next) {
+  StringBuilder expanded = {0};
+  String_View name;
+  bool angled;
+  if (!parse_header_name(spec, &name, &angled)) {
+    // computed include: #include MACRO
+    pp_expand(pp, spec, &expanded);
+    if (!parse_header_name(sv_from_parts(expanded.items, expanded.items_count), &name, &angled)) {
+      // fatal like in `cc`, the structs of the header would silently be missing otherwise
+      fprintf(stderr, "ERROR: %s:%zu: invalid include `" SV_Fmt "`\n", from->path, line, SV_Arg(spec));
+      exit(1);
+    }
+  }
+  size_t index;
+  SourceFile *file = pp_resolve(pp, from, from_index, name, angled, next, &index);
+  if (file == NULL) {
+    fprintf(stderr, "ERROR: %s:%zu: include `" SV_Fmt "` not found\n", from->path, line, SV_Arg(name));
+    exit(1);
+  }
+  free(expanded.items);
+  if (file->once && file->entered) return false;
+  if (file->guard && pp_defined(pp, sv_from_cstr(file->guard))) return false;
+  file->entered = true;
+  pp_file(pp, file, index);
+  pp_linemarker(pp, line + 1, from, " 2");
+  return true;
+}
+
+typedef enum {
+  GUARD_START, // nothing significant seen yet
+  GUARD_INSIDE, // inside the #ifndef that opened the file
+  GUARD_AFTER, // after its #endif
+  GUARD_NONE,
+} GuardState;
+
+static void pp_file(PP *pp, SourceFile *file, size_t index) {
+  if (pp->depth >= MAX_INCLUDE_DEPTH) {
+    fprintf(stderr, "ERROR: %s: #include nested too deeply\n", file->path);
+    exit(1);
+  }
+  pp->depth += 1;
+  pp_linemarker(pp, 1, file, pp->depth > 1 ? " 1" : "");
+
+  struct { MAKE_ARRAY(Cond, items) } conds = {0};
+  StringBuilder directive = {0};
+  bool active = true;
+  bool in_comment = false;
+  bool directive_comment = false; // block comment opened by a directive, not part of the output
+  GuardState guard = GUARD_START;
+  String_View guard_name = {0};
+  String_View rest = file->content;
+  size_t line_count = 0;
+  OutPos pos = { .line = 1 };
+  while (rest.count) {
+    const size_t line_no = line_count + 1;
+    String_View line = next_line(&rest, &line_count);
+    if (directive_comment) {
+      in_comment = directive_comment = scan_comments(line, true);
+      continue;
+    }
+    String_View trimmed = sv_trim(line);
+    if (in_comment || trimmed.count == 0 || trimmed.data[0] != '#') {
+      const bool blank = in_comment || trimmed.count == 0 || sv_starts_with(trimmed, SV("//")) || sv_starts_with(trimmed, SV("/*"));
+      if (!blank && guard != GUARD_INSIDE) guard = GUARD_NONE;
+      in_comment = scan_comments(line, in_comment);
+      if (active) {
+        pp_sync(pp, &pos, line_no, file);
+        sb_append(&pp->out, line.data, line.count);
+        sb_append(&pp->out, "\n", 1);
+        pos.line = line_count + 1;
+      }
+      continue;
+    }
+
+    directive.items_count = 0;
+    clean_directive(sv_from_parts(trimmed.data + 1, line.data + line.count - trimmed.data - 1), &directive, &directive_comment);
+    in_comment = directive_comment;
+    String_View args = sv_trim_left(sv_from_parts(directive.items, directive.items_count));
+    String_View name = take_ident(&args);
+    args = sv_trim(args);
+    const String_View operands = args;
+    const bool was_active = active;
+    const bool is_include = sv_eq(name, SV("include")) || sv_eq(name, SV("include_next"));
+    const bool is_kept = sv_eq(name, SV("define")) || sv_eq(name, SV("undef"))
+      || (sv_eq(name, SV("pragma")) && !sv_eq(args, SV("once")));
+
+    const bool is_ifndef = sv_eq(name, SV("ifndef"));
+    if (sv_eq(name, SV("if")) || sv_eq(name, SV("ifdef")) || is_ifndef) {
+      if (guard == GUARD_START && is_ifndef && conds.items_count == 0) {
+        guard = GUARD_INSIDE;
+        guard_name = args;
+        guard_name = take_ident(&guard_name);
+        guard_name.data = strndup(guard_name.data, guard_name.count); // directive buffer is reused
+      } else if (guard != GUARD_INSIDE) {
+        guard = GUARD_NONE;
+      }
+      Cond cond = { .parent_active = active };
+      if (active) {
+        if (sv_eq(name, SV("if"))) cond.active = pp_eval(pp, file, index, args);
+        else cond.active = pp_defined(pp, take_ident(&args)) != is_ifndef;
+      }
+      cond.taken = cond.active || !active;
+      ARRAY_PUSH(conds, items, cond);
+      active = cond.active;
+    } else if (sv_eq(name, SV("elif")) || sv_eq(name, SV("elifdef")) || sv_eq(name, SV("elifndef"))) {
+      if (conds.items_count == 0) {
+        fprintf(stderr, "WARNING: %s:%zu: #%.*s without #if\n", file->path, line_no, (int)name.count, name.data);
+        continue;
+      }
+      Cond *cond = &conds.items[conds.items_count - 1];
+      cond->active = false;
+      if (cond->parent_active && !cond->taken) {
+        if (sv_eq(name, SV("elif"))) cond->active = pp_eval(pp, file, index, args);
+        else cond->active = pp_defined(pp, take_ident(&args)) == sv_eq(name, SV("elifdef"));
+        cond->taken = cond->active;
+      }
+      active = cond->active;
+    } else if (sv_eq(name, SV("else"))) {
+      if (conds.items_count == 0) {
+        fprintf(stderr, "WARNING: %s:%zu: #else without #if\n", file->path, line_no);
+        continue;
+      }
+      Cond *cond = &conds.items[conds.items_count - 1];
+      cond->active = cond->parent_active && !cond->taken;
+      cond->taken = true;
+      active = cond->active;
+    } else if (sv_eq(name, SV("endif"))) {
+      if (conds.items_count == 0) {
+        fprintf(stderr, "WARNING: %s:%zu: #endif without #if\n", file->path, line_no);
+        continue;
+      }
+      active = conds.items[--conds.items_count].parent_active;
+      if (guard == GUARD_INSIDE && conds.items_count == 0) guard = GUARD_AFTER;
+    } else {
+      if (guard != GUARD_INSIDE) guard = GUARD_NONE;
+      if (!active) continue;
+      if (sv_eq(name, SV("define"))) pp_define(pp, args);
+      else if (sv_eq(name, SV("undef"))) pp_undef(pp, take_ident(&args));
+      else if (is_include) {
+        pp_sync(pp, &pos, line_no, file);
+        if (pp_include(pp, file, index, line_count, args, sv_eq(name, SV("include_next")))) {
+          pos.line = line_count + 1;
+        } else {
+          pos.line += 1;
+          pos.newline = true;
+        }
+      }
+      else if (sv_eq(name, SV("pragma")) && sv_eq(sv_trim(args), SV("once"))) file->once = true;
+      // everything else (#error, #warning, #line, other pragmas) does not matter for structs
+    }
+    // like in `cc`, a directive staying in active lines leaves an empty line (#define, #undef
+    // and #pragma are kept); directives of inactive lines, those lines themselves and comments
+    // opened by directives are skipped
+    if (was_active && !is_include) {
+      pp_sync(pp, &pos, line_no, file);
+      if (active) {
+        pos.line += 1;
+        if (is_kept) pp_print_directive(pp, name, operands);
+        else pos.newline = true;
+      }
+    }
+  }
+  if (conds.items_count) fprintf(stderr, "WARNING: %s: unterminated conditional\n", file->path);
+  if (guard == GUARD_AFTER && file->guard == NULL) file->guard = (char *)guard_name.data;
+  else free((void *)guard_name.data);
+  free(conds.items);
+  free(directive.items);
+  pp->depth -= 1;
+}
+
+
+// values of the predefined macros of the compiler cest was built with
+#define PREDEF(name) { #name, TOSTRING(name) },
+static const char *predefined[][2] = {
+#ifdef __STDC__
+  PREDEF(__STDC__)
+#endif
+#ifdef __STDC_VERSION__
+  PREDEF(__STDC_VERSION__)
+#endif
+#ifdef __STDC_HOSTED__
+  PREDEF(__STDC_HOSTED__)
+#endif
+#ifdef __GNUC__
+  PREDEF(__GNUC__)
+  PREDEF(__GNUC_MINOR__)
+  PREDEF(__GNUC_PATCHLEVEL__)
+#endif
+#ifdef __clang__
+  PREDEF(__clang__)
+  PREDEF(__clang_major__)
+  PREDEF(__clang_minor__)
+#endif
+#ifdef __x86_64__
+  PREDEF(__x86_64__)
+  PREDEF(__x86_64)
+  PREDEF(__amd64__)
+  PREDEF(__amd64)
+#endif
+#ifdef __i386__
+  PREDEF(__i386__)
+#endif
+#ifdef __aarch64__
+  PREDEF(__aarch64__)
+#endif
+#ifdef __arm__
+  PREDEF(__arm__)
+#endif
+#ifdef __linux__
+  PREDEF(__linux__)
+  PREDEF(__linux)
+  PREDEF(__gnu_linux__)
+#endif
+#ifdef __unix__
+  PREDEF(__unix__)
+  PREDEF(__unix)
+#endif
+#ifdef __ELF__
+  PREDEF(__ELF__)
+#endif
+#ifdef __LP64__
+  PREDEF(__LP64__)
+  PREDEF(_LP64)
+#endif
+#ifdef __CHAR_BIT__
+  PREDEF(__CHAR_BIT__)
+#endif
+#ifdef __CHAR_UNSIGNED__
+  PREDEF(__CHAR_UNSIGNED__)
+#endif
+#ifdef __SIZEOF_INT__
+  PREDEF(__SIZEOF_INT__)
+  PREDEF(__SIZEOF_LONG__)
+  PREDEF(__SIZEOF_LONG_LONG__)
+  PREDEF(__SIZEOF_SHORT__)
+  PREDEF(__SIZEOF_POINTER__)
+  PREDEF(__SIZEOF_FLOAT__)
+  PREDEF(__SIZEOF_DOUBLE__)
+  PREDEF(__SIZEOF_LONG_DOUBLE__)
+  PREDEF(__SIZEOF_SIZE_T__)
+  PREDEF(__SIZEOF_WCHAR_T__)
+  PREDEF(__SIZEOF_WINT_T__)
+  PREDEF(__SIZEOF_PTRDIFF_T__)
+#endif
+#ifdef __SIZEOF_INT128__
+  PREDEF(__SIZEOF_INT128__)
+#endif
+#ifdef __BYTE_ORDER__
+  PREDEF(__BYTE_ORDER__)
+  PREDEF(__ORDER_LITTLE_ENDIAN__)
+  PREDEF(__ORDER_BIG_ENDIAN__)
+  PREDEF(__ORDER_PDP_ENDIAN__)
+  PREDEF(__FLOAT_WORD_ORDER__)
+#endif
+#ifdef __SIZE_TYPE__
+  PREDEF(__SIZE_TYPE__)
+  PREDEF(__PTRDIFF_TYPE__)
+  PREDEF(__WCHAR_TYPE__)
+  PREDEF(__WINT_TYPE__)
+  PREDEF(__INTMAX_TYPE__)
+  PREDEF(__UINTMAX_TYPE__)
+#endif
+#ifdef __INT_MAX__
+  PREDEF(__SCHAR_MAX__)
+  PREDEF(__SHRT_MAX__)
+  PREDEF(__INT_MAX__)
+  PREDEF(__LONG_MAX__)
+  PREDEF(__LONG_LONG_MAX__)
+  PREDEF(__WCHAR_MAX__)
+  PREDEF(__WCHAR_MIN__)
+  PREDEF(__SIZE_MAX__)
+  PREDEF(__PTRDIFF_MAX__)
+  PREDEF(__INTMAX_MAX__)
+  PREDEF(__UINTMAX_MAX__)
+#endif
+};
+#undef PREDEF
+
+static void pp_search_glob(PP *pp, const char *pattern, bool last) {
+  glob_t g;
+  if (glob(pattern, 0, NULL, &g) == 0 && g.gl_pathc) {
+    // highest (compiler) version sorts last
+    char *dir = strdup(g.gl_pathv[last ? g.gl_pathc - 1 : 0]);
+    ARRAY_PUSH(*pp, search, dir);
+  }
+  globfree(&g);
+}
+
+String_View pp_builtin(const PPConfig *config, const char *dir, String_View source) {
+  PP pp = { .config = config };
+  for (size_t i = 0; i < config->includes_count; ++i) ARRAY_PUSH(pp, search, strdup(config->includes[i]));
+  for (size_t i = 0; i < config->system_includes_count; ++i) ARRAY_PUSH(pp, search, strdup(config->system_includes[i]));
+  // same order as gcc's default search path
+  pp_search_glob(&pp, "/usr/lib/gcc/*/*/include", true);
+  ARRAY_PUSH(pp, search, strdup("/usr/local/include"));
+  pp_search_glob(&pp, "/usr/include/*-linux-gnu", false);
+  ARRAY_PUSH(pp, search, strdup("/usr/include"));
+
+  StringBuilder definition = {0};
+  for (size_t i = 0; i < sizeof(predefined) / sizeof(predefined[0]); ++i) {
+    definition.items_count = 0;
+    sb_append(&definition, predefined[i][0], strlen(predefined[i][0]));
+    sb_append(&definition, " ", 1);
+    sb_append(&definition, predefined[i][1], strlen(predefined[i][1]));
+    pp_define(&pp, sv_from_parts(definition.items, definition.items_count));
+  }
+  free(definition.items);
+
+  SourceFile main = {
+    .path = "<stdin>",
+    .dir = (char *)dir,
+    .content = source,
+  };
+  pp_file(&pp, &main, SIZE_MAX);
+
+  for (size_t i = 0; i < pp.search_count; ++i) free(pp.search[i]);
+  free(pp.search);
+  for (size_t i = 0; i < pp.macro_list_count; ++i) {
+    free(pp.macro_list[i]->text);
+    free(pp.macro_list[i]->params);
+    free(pp.macro_list[i]);
+  }
+  free(pp.macro_list);
+  for (size_t i = 0; i < pp.sources_count; ++i) {
+    free(pp.sources[i]->path);
+    free(pp.sources[i]->dir);
+    free(pp.sources[i]->guard);
+    free((void *)pp.sources[i]->content.data);
+    free(pp.sources[i]);
+  }
+  free(pp.sources);
+  free(pp.macros.items);
+  free(pp.files.items);
+
+  sb_append(&pp.out, "", 1); // NUL-terminated like the other inputs
+  return sv_from_parts(pp.out.items, pp.out.items_count - 1);
+}
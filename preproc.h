@@ -0,0 +1,23 @@
+#pragma once
+#include <stddef.h>
+#include "array.h"
+#include "sv.h"
+
+typedef enum {
+  PP_ENGINE_CC,
+  PP_ENGINE_BUILTIN,
+} PPEngine;
+
+typedef struct {
+  PPEngine engine;
+  MAKE_ARRAY(const char *, includes) // -I, absolute
+  MAKE_ARRAY(const char *, system_includes) // -isystem, absolute
+} PPConfig;
+
+// Resolves all includes of `source` (as if it was a file in `dir`) in-process,
+// only keeping lines of active conditional blocks.
+// The result mimics `cc -fdirectives-only -E`: every entered file is announced by
+// a linemarker `# <line> "<path>"`, directives and inactive lines become empty lines
+// (or a linemarker after longer gaps), so copied text keeps the lines `cc` gives it.
+// A missing #include is fatal.
+String_View pp_builtin(const PPConfig *config, const char *dir, String_View source);
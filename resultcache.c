@@ -0,0 +1,370 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "resultcache.h"
+
+#define ENTRY_MAGIC "cest-cache 1\n"
+#define KEY_LENGTH 16
+
+uint64_t hash_bytes(uint64_t hash, const void *data, size_t count) {
+  // word at a time, good enough to tell file versions apart
+  const unsigned char *p = data;
+  for (; count >= 8; p += 8, count -= 8) {
+    uint64_t word;
+    memcpy(&word, p, 8);
+    hash = (hash ^ word) * 0x9E3779B97F4A7C15ULL;
+    hash ^= hash >> 29;
+  }
+  for (; count; ++p, --count) hash = (hash ^ *p) * 0x100000001B3ULL;
+  hash ^= hash >> 32;
+  hash *= 0xD6E8FEB86659FD93ULL;
+  return hash ^ (hash >> 32);
+}
+
+static bool read_whole(const char *path, String_View *content) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return false;
+  struct stat st;
+  char *data = NULL;
+  if (fstat(fd, &st) < 0 || (data = malloc(st.st_size + 1)) == NULL) {
+    close(fd);
+    return false;
+  }
+  size_t total = 0;
+  while (total < (size_t)st.st_size) {
+    ssize_t n = read(fd, data + total, st.st_size - total);
+    if (n <= 0) break;
+    total += n;
+  }
+  close(fd);
+  if (total != (size_t)st.st_size) {
+    free(data);
+    return false;
+  }
+  data[total] = 0;
+  *content = sv_from_parts(data, total);
+  return true;
+}
+
+static char *entry_path(const ResultCache *cache, const char *name) {
+  char *path = malloc(strlen(cache->dir) + 1 + strlen(name) + 1);
+  if (path == NULL) {
+    perror("malloc entry_path");
+    exit(1);
+  }
+  sprintf(path, "%s/%s", cache->dir, name);
+  return path;
+}
+
+static char *key_path(const ResultCache *cache, uint64_t key) {
+  char name[KEY_LENGTH + 1];
+  sprintf(name, "%016" PRIx64, key);
+  return entry_path(cache, name);
+}
+
+// headers are hashed once per run, even if many inputs include them
+static bool file_hash(ResultCache *cache, const char *path, uint64_t *hash) {
+  pthread_mutex_lock(&cache->lock);
+  for (size_t i = 0; i < cache->hashes_count; ++i) {
+    if (strcmp(cache->hashes[i].path, path) != 0) continue;
+    *hash = cache->hashes[i].hash;
+    pthread_mutex_unlock(&cache->lock);
+    return true;
+  }
+  pthread_mutex_unlock(&cache->lock);
+
+  String_View content;
+  if (!read_whole(path, &content)) return false;
+  FileHash fh = {
+    .path = strdup(path),
+    .hash = hash_bytes(0, content.data, content.count),
+  };
+  free((void *)content.data);
+  if (fh.path == NULL) {
+    perror("strdup file_hash");
+    exit(1);
+  }
+  pthread_mutex_lock(&cache->lock);
+  ARRAY_PUSH(*cache, hashes, fh);
+  pthread_mutex_unlock(&cache->lock);
+  *hash = fh.hash;
+  return true;
+}
+
+static int mkdir_p(const char *dir) {
+  char *path = strdup(dir);
+  if (path == NULL) return -1;
+  for (char *p = path + 1; *p; ++p) {
+    if (*p != '/') continue;
+    *p = 0;
+    if (mkdir(path, 0777) < 0 && errno != EEXIST) {
+      free(path);
+      return -1;
+    }
+    *p = '/';
+  }
+  int result = mkdir(path, 0777) < 0 && errno != EEXIST ? -1 : 0;
+  free(path);
+  return result;
+}
+
+void result_cache_init(ResultCache *cache, const char *dir, uint64_t max_size) {
+  *cache = (ResultCache) { .max_size = max_size };
+  pthread_mutex_init(&cache->lock, NULL);
+  if (mkdir_p(dir) < 0) {
+    // translating still works, just without cache
+    fprintf(stderr, "WARNING: could not create cache directory `%s`: %s\n", dir, strerror(errno));
+    return;
+  }
+  cache->dir = strdup(dir);
+}
+
+// entry: magic, one `<hash> <path>` line per header, an empty line, then the output
+static bool entry_output(ResultCache *cache, String_View entry, String_View *output, StringBuilder *deps) {
+  if (!sv_starts_with(entry, SV(ENTRY_MAGIC))) return false;
+  const size_t deps_start = deps ? deps->items_count : 0;
+  sv_chop_left(&entry, sizeof(ENTRY_MAGIC) - 1);
+  while (true) {
+    String_View line;
+    if (!sv_try_chop_by_delim(&entry, '\n', &line)) return false;
+    if (line.count == 0) break;
+    if (line.count < KEY_LENGTH + 2) return false;
+    char hex[KEY_LENGTH + 1] = {0};
+    memcpy(hex, line.data, KEY_LENGTH);
+    sv_chop_left(&line, KEY_LENGTH + 1);
+    char *path = strndup(line.data, line.count);
+    uint64_t hash;
+    bool same = path && file_hash(cache, path, &hash) && hash == strtoull(hex, NULL, 16);
+    free(path);
+    if (!same) {
+      if (deps) deps->items_count = deps_start;
+      return false;
+    }
+    if (deps) {
+      sb_append(deps, line.data, line.count);
+      sb_append(deps, "", 1);
+    }
+  }
+  *output = entry;
+  return true;
+}
+
+bool result_cache_lookup(ResultCache *cache, uint64_t key, String_View *output, StringBuilder *deps) {
+  if (cache->dir == NULL) return false;
+  char *path = key_path(cache, key);
+  String_View entry;
+  bool hit = false;
+  if (read_whole(path, &entry)) {
+    String_View out;
+    hit = entry_output(cache, entry, &out, deps);
+    if (hit) {
+      char *data = (char *)entry.data;
+      memmove(data, out.data, out.count);
+      *output = sv_from_parts(data, out.count);
+      utimensat(AT_FDCWD, path, NULL, 0); // mark as recently used
+    } else {
+      free((void *)entry.data);
+    }
+  }
+  free(path);
+  pthread_mutex_lock(&cache->lock);
+  if (hit) cache->hits += 1;
+  else cache->misses += 1;
+  pthread_mutex_unlock(&cache->lock);
+  return hit;
+}
+
+void result_cache_store(ResultCache *cache, uint64_t key, char *const *deps, size_t deps_count, String_View output) {
+  if (cache->dir == NULL) return;
+  StringBuilder sb = {0};
+  sb_append(&sb, ENTRY_MAGIC, sizeof(ENTRY_MAGIC) - 1);
+  for (size_t i = 0; i < deps_count; ++i) {
+    uint64_t hash;
+    if (!file_hash(cache, deps[i], &hash)) {
+      free(sb.items); // a header vanished while translating, do not cache
+      return;
+    }
+    char line[KEY_LENGTH + 2];
+    sprintf(line, "%016" PRIx64 " ", hash);
+    sb_append(&sb, line, KEY_LENGTH + 1);
+    sb_append(&sb, deps[i], strlen(deps[i]));
+    sb_append(&sb, "\n", 1);
+  }
+  sb_append(&sb, "\n", 1);
+  sb_append(&sb, output.data, output.count);
+
+  pthread_mutex_lock(&cache->lock);
+  size_t n = cache->stores++;
+  pthread_mutex_unlock(&cache->lock);
+  char name[64];
+  snprintf(name, sizeof(name), "tmp.%ld.%zu", (long)getpid(), n);
+  char *tmp = entry_path(cache, name);
+  char *path = key_path(cache, key);
+  // written completely before it becomes visible, concurrent runs may store the same key
+  int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+  bool ok = fd >= 0;
+  for (size_t written = 0; ok && written < sb.items_count;) {
+    ssize_t w = write(fd, sb.items + written, sb.items_count - written);
+    ok = w > 0;
+    written += ok ? w : 0;
+  }
+  if (fd >= 0) ok = close(fd) == 0 && ok;
+  if (!ok || rename(tmp, path) < 0) {
+    fprintf(stderr, "WARNING: could not write cache entry `%s`: %s\n", path, strerror(errno));
+    unlink(tmp);
+  }
+  free(tmp);
+  free(path);
+  free(sb.items);
+}
+
+typedef struct {
+  char *path;
+  off_t size;
+  struct timespec mtime;
+} Entry;
+
+static int entry_older(const void *a, const void *b) {
+  const Entry *ea = a, *eb = b;
+  if (ea->mtime.tv_sec != eb->mtime.tv_sec) return ea->mtime.tv_sec < eb->mtime.tv_sec ? -1 : 1;
+  if (ea->mtime.tv_nsec != eb->mtime.tv_nsec) return ea->mtime.tv_nsec < eb->mtime.tv_nsec ? -1 : 1;
+  return 0;
+}
+
+static bool is_entry_name(const char *name) {
+  if (strlen(name) != KEY_LENGTH) return false;
+  for (const char *c = name; *c; ++c)
+    if (!strchr("0123456789abcdef", *c)) return false;
+  return true;
+}
+
+// calls `fn` for every entry, returns the total size
+static uint64_t list_entries(const char *dir, void (*fn)(Entry, void *), void *arg) {
+  DIR *d = opendir(dir);
+  if (d == NULL) return 0;
+  uint64_t total = 0;
+  struct dirent *de;
+  while ((de = readdir(d)) != NULL) {
+    if (!is_entry_name(de->d_name)) continue;
+    struct stat st;
+    if (fstatat(dirfd(d), de->d_name, &st, 0) < 0) continue;
+    total += st.st_size;
+    if (fn == NULL) continue;
+    Entry entry = { .size = st.st_size, .mtime = st.st_mtim };
+    entry.path = malloc(strlen(dir) + 1 + KEY_LENGTH + 1);
+    if (entry.path == NULL) {
+      perror("malloc list_entries");
+      exit(1);
+    }
+    sprintf(entry.path, "%s/%s", dir, de->d_name);
+    fn(entry, arg);
+  }
+  closedir(d);
+  return total;
+}
+
+typedef struct {
+  MAKE_ARRAY(Entry, items)
+} Entries;
+
+static void push_entry(Entry entry, void *arg) {
+  Entries *entries = arg;
+  ARRAY_PUSH(*entries, items, entry);
+}
+
+// removes least recently used entries until the cache is below 90% of its limit
+static void evict(const ResultCache *cache) {
+  Entries entries = {0};
+  uint64_t total = list_entries(cache->dir, push_entry, &entries);
+  if (total > cache->max_size) {
+    qsort(entries.items, entries.items_count, sizeof(Entry), entry_older);
+    for (size_t i = 0; i < entries.items_count && total > cache->max_size / 10 * 9; ++i) {
+      if (unlink(entries.items[i].path) == 0) total -= entries.items[i].size;
+    }
+  }
+  for (size_t i = 0; i < entries.items_count; ++i) free(entries.items[i].path);
+  free(entries.items);
+}
+
+// adds to the counters in `<dir>/stats` (if `hits` or `misses` is non-zero)
+static bool update_stats(const char *dir, size_t *hits, size_t *misses) {
+  char *path = malloc(strlen(dir) + sizeof("/stats"));
+  if (path == NULL) {
+    perror("malloc update_stats");
+    exit(1);
+  }
+  sprintf(path, "%s/stats", dir);
+  const bool dirty = *hits || *misses;
+  int fd = open(path, (dirty ? O_RDWR | O_CREAT : O_RDONLY) | O_CLOEXEC, 0666);
+  free(path);
+  if (fd < 0) return false;
+  flock(fd, dirty ? LOCK_EX : LOCK_SH);
+  char buf[128] = {0};
+  size_t old_hits = 0, old_misses = 0;
+  if (pread(fd, buf, sizeof(buf) - 1, 0) > 0) sscanf(buf, "hits %zu misses %zu", &old_hits, &old_misses);
+  *hits += old_hits;
+  *misses += old_misses;
+  if (dirty) {
+    int n = snprintf(buf, sizeof(buf), "hits %zu misses %zu\n", *hits, *misses);
+    if (pwrite(fd, buf, n, 0) != n || ftruncate(fd, n) < 0) {
+      // statistics are informational only
+    }
+  }
+  close(fd); // releases the lock
+  return true;
+}
+
+void result_cache_finish(ResultCache *cache) {
+  if (cache->dir) {
+    size_t hits = cache->hits, misses = cache->misses;
+    update_stats(cache->dir, &hits, &misses);
+    if (cache->stores) evict(cache);
+  }
+  for (size_t i = 0; i < cache->hashes_count; ++i) free(cache->hashes[i].path);
+  free(cache->hashes);
+  free(cache->dir);
+  pthread_mutex_destroy(&cache->lock);
+}
+
+static void count_entry(Entry entry, void *arg) {
+  *(size_t *)arg += 1;
+  free(entry.path);
+}
+
+void result_cache_print_stats(const char *dir, FILE *stream) {
+  size_t hits = 0, misses = 0, entries = 0;
+  update_stats(dir, &hits, &misses);
+  uint64_t size = list_entries(dir, count_entry, &entries);
+  fprintf(stream, "cache directory  %s\n", dir);
+  fprintf(stream, "hits             %zu\n", hits);
+  fprintf(stream, "misses           %zu\n", misses);
+  if (hits + misses) fprintf(stream, "hit rate         %.1f%%\n", 100.0 * hits / (hits + misses));
+  fprintf(stream, "entries          %zu\n", entries);
+  fprintf(stream, "size             %.1f KiB\n", size / 1024.0);
+}
+
+char *result_cache_default_dir(void) {
+  const char *dir = getenv("CEST_CACHE_DIR");
+  if (dir && *dir) return strdup(dir);
+  const char *base = getenv("XDG_CACHE_HOME");
+  const char *suffix = "/cest";
+  if (base == NULL || *base == 0) {
+    base = getenv("HOME");
+    suffix = "/.cache/cest";
+  }
+  if (base == NULL || *base == 0) base = "/tmp";
+  char *path = malloc(strlen(base) + strlen(suffix) + 1);
+  if (path == NULL) {
+    perror("malloc result_cache_default_dir");
+    exit(1);
+  }
+  sprintf(path, "%s%s", base, suffix);
+  return path;
+}
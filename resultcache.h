@@ -0,0 +1,43 @@
+#pragma once
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "array.h"
+#include "sv.h"
+
+#define DEFAULT_CACHE_SIZE (64 * 1024 * 1024)
+
+typedef struct {
+  char *path;
+  uint64_t hash;
+} FileHash;
+
+// On-disk cache of complete translations, one entry per input:
+// `<dir>/<key>` holds the hashes of all headers the input included and the output.
+// An entry is only used if none of these headers changed.
+typedef struct {
+  char *dir;
+  uint64_t max_size;
+  pthread_mutex_t lock;
+  MAKE_ARRAY(FileHash, hashes) // headers hashed in this run
+  size_t hits;
+  size_t misses;
+  size_t stores;
+} ResultCache;
+
+uint64_t hash_bytes(uint64_t hash, const void *data, size_t count);
+
+// `dir` is created if it does not exist
+void result_cache_init(ResultCache *cache, const char *dir, uint64_t max_size);
+// returns the cached output for `key` (to be freed by the caller), if it is still valid
+// the paths of the headers it depends on are appended to `deps` (if not NULL), each followed by a NUL
+bool result_cache_lookup(ResultCache *cache, uint64_t key, String_View *output, StringBuilder *deps);
+void result_cache_store(ResultCache *cache, uint64_t key, char *const *deps, size_t deps_count, String_View output);
+// adds this run's hits and misses to the statistics, evicts least recently used entries
+// above the size limit and frees `cache`
+void result_cache_finish(ResultCache *cache);
+void result_cache_print_stats(const char *dir, FILE *stream);
+// `$CEST_CACHE_DIR`, `$XDG_CACHE_HOME/cest` or `~/.cache/cest`, to be freed by the caller
+char *result_cache_default_dir(void);
@@ -0,0 +1,180 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "scan.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+#define SCAN_X86
+#include <immintrin.h>
+#endif
+
+static bool is_space(char c) {
+  return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+static size_t scan_space_scalar(const char *data, size_t count) {
+  size_t i = 0;
+  while (i < count && is_space(data[i])) i += 1;
+  return i;
+}
+
+static size_t scan_byte_scalar(const char *data, size_t count, char c) {
+  const char *found = memchr(data, c, count);
+  return found ? (size_t)(found - data) : count;
+}
+
+static size_t scan_byte2_scalar(const char *data, size_t count, char a, char b) {
+  size_t i = 0;
+  while (i < count && data[i] != a && data[i] != b) i += 1;
+  return i;
+}
+
+#ifdef SCAN_X86
+// only whole vectors are loaded, the tails are left to the scalar kernels
+
+static inline __m128i sse2_space_mask(__m128i v) {
+  // '\t'..'\r' are contiguous: v - '\t' <= 4 (unsigned)
+  const __m128i t = _mm_sub_epi8(v, _mm_set1_epi8('\t'));
+  const __m128i range = _mm_cmpeq_epi8(_mm_min_epu8(t, _mm_set1_epi8(4)), t);
+  return _mm_or_si128(range, _mm_cmpeq_epi8(v, _mm_set1_epi8(' ')));
+}
+
+static size_t scan_space_sse2(const char *data, size_t count) {
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    const unsigned mask = _mm_movemask_epi8(sse2_space_mask(_mm_loadu_si128((const __m128i *)(data + i))));
+    if (mask != 0xFFFF) return i + __builtin_ctz(~mask);
+  }
+  return i + scan_space_scalar(data + i, count - i);
+}
+
+static size_t scan_byte_sse2(const char *data, size_t count, char c) {
+  const __m128i needle = _mm_set1_epi8(c);
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    const __m128i v = _mm_loadu_si128((const __m128i *)(data + i));
+    const unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, needle));
+    if (mask) return i + __builtin_ctz(mask);
+  }
+  return i + scan_byte2_scalar(data + i, count - i, c, c);
+}
+
+static size_t scan_byte2_sse2(const char *data, size_t count, char a, char b) {
+  const __m128i na = _mm_set1_epi8(a), nb = _mm_set1_epi8(b);
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    const __m128i v = _mm_loadu_si128((const __m128i *)(data + i));
+    const unsigned mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, na), _mm_cmpeq_epi8(v, nb)));
+    if (mask) return i + __builtin_ctz(mask);
+  }
+  return i + scan_byte2_scalar(data + i, count - i, a, b);
+}
+
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 static size_t scan_space_avx2(const char *data, size_t count) {
+  const __m256i tab = _mm256_set1_epi8('\t'), four = _mm256_set1_epi8(4), space = _mm256_set1_epi8(' ');
+  size_t i = 0;
+  for (; i + 32 <= count; i += 32) {
+    const __m256i v = _mm256_loadu_si256((const __m256i *)(data + i));
+    const __m256i t = _mm256_sub_epi8(v, tab);
+    const __m256i ws = _mm256_or_si256(_mm256_cmpeq_epi8(_mm256_min_epu8(t, four), t), _mm256_cmpeq_epi8(v, space));
+    const uint32_t mask = _mm256_movemask_epi8(ws);
+    if (mask != 0xFFFFFFFF) return i + __builtin_ctz(~mask);
+  }
+  return i + scan_space_sse2(data + i, count - i);
+}
+
+AVX2 static size_t scan_byte_avx2(const char *data, size_t count, char c) {
+  const __m256i needle = _mm256_set1_epi8(c);
+  size_t i = 0;
+  for (; i + 32 <= count; i += 32) {
+    const __m256i v = _mm256_loadu_si256((const __m256i *)(data + i));
+    const uint32_t mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, needle));
+    if (mask) return i + __builtin_ctz(mask);
+  }
+  return i + scan_byte_sse2(data + i, count - i, c);
+}
+
+AVX2 static size_t scan_byte2_avx2(const char *data, size_t count, char a, char b) {
+  const __m256i na = _mm256_set1_epi8(a), nb = _mm256_set1_epi8(b);
+  size_t i = 0;
+  for (; i + 32 <= count; i += 32) {
+    const __m256i v = _mm256_loadu_si256((const __m256i *)(data + i));
+    const uint32_t mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, na), _mm256_cmpeq_epi8(v, nb)));
+    if (mask) return i + __builtin_ctz(mask);
+  }
+  return i + scan_byte2_sse2(data + i, count - i, a, b);
+}
+#endif // SCAN_X86
+
+typedef struct {
+  size_t (*space)(const char *, size_t);
+  size_t (*byte)(const char *, size_t, char);
+  size_t (*byte2)(const char *, size_t, char, char);
+} Kernels;
+
+static const Kernels kernels[] = {
+  [SCAN_SCALAR] = { scan_space_scalar, scan_byte_scalar, scan_byte2_scalar },
+#ifdef SCAN_X86
+  [SCAN_SSE2] = { scan_space_sse2, scan_byte_sse2, scan_byte2_sse2 },
+  [SCAN_AVX2] = { scan_space_avx2, scan_byte_avx2, scan_byte2_avx2 },
+#endif // SCAN_X86
+};
+static ScanImpl current = SCAN_SCALAR;
+
+size_t scan_space(const char *data, size_t count) {
+  return kernels[current].space(data, count);
+}
+
+size_t scan_byte(const char *data, size_t count, char c) {
+  return kernels[current].byte(data, count, c);
+}
+
+size_t scan_byte2(const char *data, size_t count, char a, char b) {
+  return kernels[current].byte2(data, count, a, b);
+}
+
+bool scan_supported(ScanImpl impl) {
+  switch (impl) {
+  case SCAN_SCALAR: return true;
+#ifdef SCAN_X86
+  case SCAN_SSE2: return true;
+  case SCAN_AVX2:
+    __builtin_cpu_init(); // may run before libgcc's own constructor
+    return __builtin_cpu_supports("avx2");
+#else
+  case SCAN_SSE2:
+  case SCAN_AVX2: return false;
+#endif // SCAN_X86
+  }
+  return false;
+}
+
+bool scan_use(ScanImpl impl) {
+  if (!scan_supported(impl)) return false;
+  current = impl;
+  return true;
+}
+
+ScanImpl scan_current(void) {
+  return current;
+}
+
+const char *scan_name(ScanImpl impl) {
+  switch (impl) {
+  case SCAN_SCALAR: return "scalar";
+  case SCAN_SSE2: return "sse2";
+  case SCAN_AVX2: return "avx2";
+  }
+  return "?";
+}
+
+// runs before main, so worker threads never see the selection change
+__attribute__((constructor)) static void scan_init(void) {
+  const char *env = getenv("CEST_SCAN");
+  for (ScanImpl impl = SCAN_AVX2;; --impl) {
+    if ((env == NULL || strcmp(env, scan_name(impl)) == 0) && scan_use(impl)) return;
+    if (impl == SCAN_SCALAR) return;
+  }
+}
@@ -0,0 +1,26 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+
+// Byte scanning kernels for the lexer's hot loops, the best implementation the CPU supports
+// is selected at startup ($CEST_SCAN=scalar|sse2|avx2 overrides it).
+// All return `count` if nothing was found.
+
+typedef enum {
+  SCAN_SCALAR,
+  SCAN_SSE2,
+  SCAN_AVX2,
+} ScanImpl;
+
+// index of the first byte that is not whitespace (in the sense of `isspace`)
+size_t scan_space(const char *data, size_t count);
+// index of the first `c`
+size_t scan_byte(const char *data, size_t count, char c);
+// index of the first `a` or `b`
+size_t scan_byte2(const char *data, size_t count, char a, char b);
+
+bool scan_supported(ScanImpl impl);
+// returns false (and keeps the current one) if `impl` is not supported
+bool scan_use(ScanImpl impl);
+ScanImpl scan_current(void);
+const char *scan_name(ScanImpl impl);
@@ -0,0 +1,253 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <linux/perf_event.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include "array.h"
+#include "stats.h"
+
+static const char *phase_names[PHASE_COUNT] = {
+  [PHASE_FILE] = "file",
+  [PHASE_PREPROCESS] = "preprocess",
+  [PHASE_LEX] = "lex",
+  [PHASE_STRUCTS] = "structs",
+  [PHASE_INHERITS] = "inherits",
+  [PHASE_EMIT] = "emit",
+};
+
+static const char *counter_names[COUNT_COUNT] = {
+  [COUNT_BYTES_READ] = "bytes read",
+  [COUNT_TOKENS] = "tokens lexed",
+  [COUNT_STRUCTS] = "structs indexed",
+  [COUNT_CHILDREN] = "children resolved",
+  [COUNT_BYTES_EMITTED] = "bytes emitted",
+};
+
+static const struct {
+  const char *name;
+  uint32_t type;
+  uint64_t config;
+} perf_events[PERF_COUNT] = {
+  [PERF_TASK_CLOCK] = { "task-clock", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK },
+  [PERF_CYCLES] = { "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+  [PERF_INSTRUCTIONS] = { "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+  [PERF_BRANCH_MISSES] = { "branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+  [PERF_L1D_MISSES] = { "L1d-misses", PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D
+      | PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16 },
+  [PERF_LLC_MISSES] = { "LLC-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+  [PERF_PAGE_FAULTS] = { "page-faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS },
+};
+
+// the counters of one thread, read all at once through the group leader (task-clock)
+struct PerfGroup {
+  const Stats *owner;
+  int fds[PERF_COUNT]; // -1 if not available
+  size_t slots[PERF_COUNT]; // position of each counter in what the leader reads
+  size_t opened;
+};
+
+static _Thread_local PerfGroup *thread_group;
+
+static int perf_open(PerfCounter counter, int leader) {
+  struct perf_event_attr attr = {
+    .size = sizeof(attr),
+    .type = perf_events[counter].type,
+    .config = perf_events[counter].config,
+    .read_format = PERF_FORMAT_GROUP,
+    // only what this process does in user space, allowed with perf_event_paranoid <= 2
+    .exclude_kernel = 1,
+    .exclude_hv = 1,
+  };
+  return syscall(SYS_perf_event_open, &attr, 0, -1, leader, PERF_FLAG_FD_CLOEXEC);
+}
+
+static PerfGroup *perf_group(Stats *stats) {
+  if (thread_group && thread_group->owner == stats) return thread_group;
+  PerfGroup *group = malloc(sizeof(PerfGroup));
+  if (group == NULL) {
+    perror("malloc perf group");
+    exit(1);
+  }
+  group->owner = stats;
+  group->opened = 0;
+  int err = 0;
+  for (size_t i = 0; i < PERF_COUNT; ++i) {
+    // the leader is a software event, so hardware counters may be missing on their own
+    group->fds[i] = group->opened || i == PERF_TASK_CLOCK ? perf_open(i, i == PERF_TASK_CLOCK ? -1 : group->fds[PERF_TASK_CLOCK]) : -1;
+    if (group->fds[i] < 0 && err == 0) err = errno;
+    if (group->fds[i] >= 0) group->slots[i] = group->opened++;
+  }
+  pthread_mutex_lock(&stats->lock);
+  for (size_t i = 0; i < PERF_COUNT; ++i) stats->perf_missing[i] |= group->fds[i] < 0;
+  if (err && !stats->perf_warned) {
+    stats->perf_warned = true;
+    fprintf(stderr, "Some performance counters are not available (%s): not supported by the CPU or hypervisor,"
+            " or restricted by /proc/sys/kernel/perf_event_paranoid\n", strerror(err));
+  }
+  ARRAY_PUSH(*stats, perf_groups, group);
+  pthread_mutex_unlock(&stats->lock);
+  thread_group = group;
+  return group;
+}
+
+static void perf_read(Stats *stats, uint64_t values[PERF_COUNT]) {
+  PerfGroup *group = perf_group(stats);
+  if (group->opened == 0) return;
+  uint64_t data[1 + PERF_COUNT]; // number of counters, then their values
+  if (read(group->fds[PERF_TASK_CLOCK], data, sizeof(data)) < 0) return;
+  for (size_t i = 0; i < PERF_COUNT; ++i)
+    if (group->fds[i] >= 0) values[i] = data[1 + group->slots[i]];
+}
+
+static double clock_seconds(clockid_t clock) {
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+StatsMark stats_now(Stats *stats) {
+  StatsMark mark = {
+    .wall = clock_seconds(CLOCK_MONOTONIC),
+    .cpu = clock_seconds(CLOCK_THREAD_CPUTIME_ID),
+  };
+  if (stats->perf) perf_read(stats, mark.perf);
+  return mark;
+}
+
+// one event per write, so the events of concurrent threads and processes do not interleave
+static void trace_write(int fd, const StringBuilder *sb) {
+  if (write(fd, sb->items, sb->items_count) < 0) perror("write trace");
+}
+
+static void json_escape(StringBuilder *sb, const char *str) {
+  for (; *str; ++str) {
+    char esc[8];
+    if (*str == '"' || *str == '\\') {
+      esc[0] = '\\';
+      esc[1] = *str;
+      sb_append(sb, esc, 2);
+    } else if ((unsigned char)*str < 0x20) {
+      sb_append(sb, esc, snprintf(esc, sizeof(esc), "\\u%04x", *str));
+    } else {
+      sb_append(sb, str, 1);
+    }
+  }
+}
+
+void stats_init(Stats *stats, const char *trace, bool perf) {
+  *stats = (Stats) { .trace = -1, .perf = perf };
+  int err = pthread_mutex_init(&stats->lock, NULL);
+  if (err != 0) {
+    fprintf(stderr, "pthread_mutex_init stats: %s\n", strerror(err));
+    exit(1);
+  }
+  if (trace == NULL) return;
+  stats->trace = open(trace, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+  struct stat st;
+  if (stats->trace < 0 || fstat(stats->trace, &st) < 0) {
+    fprintf(stderr, "Could not open trace `%s`: %s\n", trace, strerror(errno));
+    exit(1);
+  }
+  // JSON array format: the closing `]` is optional, so runs can keep appending events
+  StringBuilder sb = {0};
+  if (st.st_size == 0) sb_append(&sb, "[\n", 2);
+  char line[128];
+  sb_append(&sb, line, snprintf(line, sizeof(line),
+      "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"cest\"}},\n", (int)getpid()));
+  trace_write(stats->trace, &sb);
+  free(sb.items);
+}
+
+void stats_free(Stats *stats) {
+  if (stats->trace >= 0) close(stats->trace);
+  for (size_t i = 0; i < stats->perf_groups_count; ++i) {
+    for (size_t c = 0; c < PERF_COUNT; ++c)
+      if (stats->perf_groups[i]->fds[c] >= 0) close(stats->perf_groups[i]->fds[c]);
+    free(stats->perf_groups[i]);
+  }
+  free(stats->perf_groups);
+  thread_group = NULL; // worker threads and their groups are gone already
+  for (size_t i = 0; i < stats->perf_files_count; ++i) free(stats->perf_files[i].file);
+  free(stats->perf_files);
+  pthread_mutex_destroy(&stats->lock);
+}
+
+void stats_phase_end(Stats *stats, Phase phase, StatsMark start, const char *file) {
+  StatsMark end = stats_now(stats);
+  uint64_t perf[PERF_COUNT];
+  for (size_t i = 0; i < PERF_COUNT; ++i) perf[i] = end.perf[i] - start.perf[i];
+  pthread_mutex_lock(&stats->lock);
+  stats->wall[phase] += end.wall - start.wall;
+  stats->cpu[phase] += end.cpu - start.cpu;
+  stats->spans[phase] += 1;
+  for (size_t i = 0; i < PERF_COUNT; ++i) stats->perf_totals[phase][i] += perf[i];
+  if (stats->perf && phase == PHASE_FILE) {
+    PerfFile entry = { .file = strdup(file) };
+    memcpy(entry.values, perf, sizeof(perf));
+    ARRAY_PUSH(*stats, perf_files, entry);
+  }
+  pthread_mutex_unlock(&stats->lock);
+  if (stats->trace < 0) return;
+
+  StringBuilder sb = {0};
+  char line[256];
+  sb_append(&sb, line, snprintf(line, sizeof(line),
+      "{\"name\":\"%s\",\"cat\":\"cest\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d,\"args\":{\"file\":\"",
+      phase_names[phase], start.wall * 1e6, (end.wall - start.wall) * 1e6, (int)getpid(), (int)gettid()));
+  json_escape(&sb, file);
+  sb_append(&sb, "\"", 1);
+  for (size_t i = 0; stats->perf && i < PERF_COUNT; ++i) {
+    if (stats->perf_missing[i]) continue;
+    sb_append(&sb, line, snprintf(line, sizeof(line), ",\"%s\":%" PRIu64, perf_events[i].name, perf[i]));
+  }
+  sb_append(&sb, "}},\n", 4);
+  trace_write(stats->trace, &sb);
+  free(sb.items);
+}
+
+void stats_add_count(Stats *stats, Counter counter, size_t n) {
+  pthread_mutex_lock(&stats->lock);
+  stats->counts[counter] += n;
+  pthread_mutex_unlock(&stats->lock);
+}
+
+void stats_print(const Stats *stats, FILE *stream) {
+  fprintf(stream, "%-12s %12s %12s %8s\n", "phase", "wall ms", "cpu ms", "count");
+  for (size_t i = 0; i < PHASE_COUNT; ++i) {
+    fprintf(stream, "%s%-*s %12.3f %12.3f %8zu\n", i == PHASE_FILE ? "" : "  ", i == PHASE_FILE ? 12 : 10,
+            phase_names[i], stats->wall[i] * 1e3, stats->cpu[i] * 1e3, stats->spans[i]);
+  }
+  for (size_t i = 0; i < COUNT_COUNT; ++i) fprintf(stream, "%-18s %12zu\n", counter_names[i], stats->counts[i]);
+}
+
+static void print_perf_row(const Stats *stats, FILE *stream, const char *name, const uint64_t values[PERF_COUNT]) {
+  fprintf(stream, "%-24s", name);
+  for (size_t i = 0; i < PERF_COUNT; ++i) {
+    if (stats->perf_missing[i]) fprintf(stream, " %14s", "n/a");
+    else fprintf(stream, " %14" PRIu64, values[i]);
+  }
+  if (stats->perf_missing[PERF_CYCLES] || stats->perf_missing[PERF_INSTRUCTIONS] || values[PERF_CYCLES] == 0)
+    fprintf(stream, " %6s\n", "n/a");
+  else
+    fprintf(stream, " %6.2f\n", (double)values[PERF_INSTRUCTIONS] / values[PERF_CYCLES]);
+}
+
+static void print_perf_header(FILE *stream, const char *name) {
+  fprintf(stream, "%-24s", name);
+  for (size_t i = 0; i < PERF_COUNT; ++i) fprintf(stream, " %14s", perf_events[i].name);
+  fprintf(stream, " %6s\n", "IPC");
+}
+
+void stats_print_perf(const Stats *stats, FILE *stream) {
+  print_perf_header(stream, "phase");
+  for (size_t i = 0; i < PHASE_COUNT; ++i) print_perf_row(stats, stream, phase_names[i], stats->perf_totals[i]);
+  print_perf_header(stream, "input");
+  for (size_t i = 0; i < stats->perf_files_count; ++i)
+    print_perf_row(stats, stream, stats->perf_files[i].file, stats->perf_files[i].values);
+}
@@ -0,0 +1,97 @@
+#pragma once
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "array.h"
+
+typedef enum {
+  PHASE_FILE, // translation of one input as a whole, including the phases below
+  PHASE_PREPROCESS,
+  PHASE_LEX,
+  PHASE_STRUCTS, // structs of included headers
+  PHASE_INHERITS, // structs of the input and their parents
+  PHASE_EMIT,
+  PHASE_COUNT,
+} Phase;
+
+typedef enum {
+  COUNT_BYTES_READ,
+  COUNT_TOKENS,
+  COUNT_STRUCTS,
+  COUNT_CHILDREN,
+  COUNT_BYTES_EMITTED,
+  COUNT_COUNT,
+} Counter;
+
+// counters of the measuring thread read with perf_event_open, only with --perf-counters
+typedef enum {
+  PERF_TASK_CLOCK, // nanoseconds on the CPU, always available unless perf_event_open is forbidden
+  PERF_CYCLES,
+  PERF_INSTRUCTIONS,
+  PERF_BRANCH_MISSES,
+  PERF_L1D_MISSES,
+  PERF_LLC_MISSES,
+  PERF_PAGE_FAULTS,
+  PERF_COUNT,
+} PerfCounter;
+
+typedef struct {
+  char *file;
+  uint64_t values[PERF_COUNT];
+} PerfFile;
+
+typedef struct PerfGroup PerfGroup;
+
+// Time spent per phase and sizes of what was processed, summed over all worker threads
+// (--stats), hardware counters per phase and input (--perf-counters), and every phase as
+// an event of a Chrome trace (--trace).
+// All functions take NULL for disabled statistics and then do nothing.
+typedef struct {
+  pthread_mutex_t lock;
+  double wall[PHASE_COUNT]; // seconds
+  double cpu[PHASE_COUNT]; // seconds of the measuring thread, preprocessor processes are not included
+  size_t spans[PHASE_COUNT];
+  size_t counts[COUNT_COUNT];
+  int trace; // -1 without --trace
+  bool perf; // --perf-counters
+  bool perf_missing[PERF_COUNT]; // could not be opened, the kernel or the CPU does not support them
+  bool perf_warned;
+  uint64_t perf_totals[PHASE_COUNT][PERF_COUNT];
+  MAKE_ARRAY(PerfFile, perf_files) // per input, in order of completion
+  MAKE_ARRAY(PerfGroup *, perf_groups) // one per thread
+} Stats;
+
+typedef struct {
+  double wall;
+  double cpu;
+  uint64_t perf[PERF_COUNT];
+} StatsMark;
+
+// `trace` (may be NULL) is appended to, so several runs can be collected in one file
+void stats_init(Stats *stats, const char *trace, bool perf);
+void stats_free(Stats *stats);
+void stats_print(const Stats *stats, FILE *stream);
+void stats_print_perf(const Stats *stats, FILE *stream);
+
+StatsMark stats_now(Stats *stats);
+void stats_phase_end(Stats *stats, Phase phase, StatsMark start, const char *file);
+
+static inline StatsMark stats_begin(Stats *stats) {
+  if (stats == NULL) return (StatsMark) {0};
+  return stats_now(stats);
+}
+
+// ends the phase begun at `start`, `file` names the input it belongs to
+static inline void stats_end(Stats *stats, Phase phase, StatsMark start, const char *file) {
+  if (stats == NULL) return;
+  stats_phase_end(stats, phase, start, file);
+}
+
+void stats_add_count(Stats *stats, Counter counter, size_t n);
+
+static inline void stats_count(Stats *stats, Counter counter, size_t n) {
+  if (stats == NULL) return;
+  stats_add_count(stats, counter, n);
+}
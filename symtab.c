@@ -0,0 +1,89 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "symtab.h"
+
+static uint64_t symtab_hash(String_View name) {
+  uint64_t hash = 14695981039346656037ULL; // FNV-1a
+  for (size_t i = 0; i < name.count; ++i) {
+    hash ^= (unsigned char)name.data[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+SymbolTable symtab_extend(const SymbolTable *parent) {
+  return (SymbolTable) {
+    .parent = parent,
+    .base = parent ? symtab_end(parent) : NO_SYMBOL + 1,
+  };
+}
+
+static Symbol symtab_find_local(const SymbolTable *table, String_View name, uint64_t hash) {
+  if (table->entries_cap == 0) return NO_SYMBOL;
+  const size_t mask = table->entries_cap - 1;
+  for (size_t i = hash & mask;; i = (i + 1) & mask) {
+    const SymbolEntry *entry = &table->entries[i];
+    if (entry->symbol == NO_SYMBOL) return NO_SYMBOL;
+    if (sv_eq(entry->name, name)) return entry->symbol;
+  }
+}
+
+static Symbol symtab_find_hashed(const SymbolTable *table, String_View name, uint64_t hash) {
+  for (; table; table = table->parent) {
+    Symbol symbol = symtab_find_local(table, name, hash);
+    if (symbol != NO_SYMBOL) return symbol;
+  }
+  return NO_SYMBOL;
+}
+
+Symbol symtab_find(const SymbolTable *table, String_View name) {
+  return symtab_find_hashed(table, name, symtab_hash(name));
+}
+
+static void symtab_insert(SymbolTable *table, SymbolEntry entry, uint64_t hash) {
+  const size_t mask = table->entries_cap - 1;
+  size_t i = hash & mask;
+  while (table->entries[i].symbol != NO_SYMBOL) i = (i + 1) & mask;
+  table->entries[i] = entry;
+}
+
+Symbol symtab_intern(SymbolTable *table, String_View name) {
+  const uint64_t hash = symtab_hash(name);
+  Symbol symbol = symtab_find_hashed(table, name, hash);
+  if (symbol != NO_SYMBOL) return symbol;
+
+  if ((table->names_count + 1) * 2 > table->entries_cap) {
+    SymbolEntry *old = table->entries;
+    size_t old_cap = table->entries_cap;
+    table->entries_cap = old_cap ? old_cap * 2 : 64;
+    table->entries = calloc(table->entries_cap, sizeof(SymbolEntry));
+    if (table->entries == NULL) {
+      perror("calloc symtab_intern");
+      exit(1);
+    }
+    for (size_t i = 0; i < old_cap; ++i)
+      if (old[i].symbol != NO_SYMBOL) symtab_insert(table, old[i], symtab_hash(old[i].name));
+    free(old);
+  }
+  if (table->base == NO_SYMBOL) table->base = NO_SYMBOL + 1; // zero-initialized root table
+  symbol = table->base + table->names_count;
+  ARRAY_PUSH(*table, names, name);
+  symtab_insert(table, (SymbolEntry) { .name = name, .symbol = symbol }, hash);
+  return symbol;
+}
+
+String_View symtab_name(const SymbolTable *table, Symbol symbol) {
+  while (table && symbol < table->base) table = table->parent;
+  if (table == NULL || symbol == NO_SYMBOL) return SV_NULL;
+  return table->names[symbol - table->base];
+}
+
+Symbol symtab_end(const SymbolTable *table) {
+  return (table->base == NO_SYMBOL ? NO_SYMBOL + 1 : table->base) + table->names_count;
+}
+
+void symtab_free(SymbolTable *table) {
+  free(table->entries);
+  free(table->names);
+  *table = symtab_extend(table->parent);
+}
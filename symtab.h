@@ -0,0 +1,34 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include "array.h"
+#include "sv.h"
+
+typedef uint32_t Symbol;
+#define NO_SYMBOL 0
+
+typedef struct {
+  String_View name;
+  Symbol symbol;
+} SymbolEntry;
+
+// Interns names to small integers, so they can be compared and used as indices directly.
+// A table may extend a `parent` without modifying it: names already known to the parent
+// keep their symbol, new names get symbols starting at `base`.
+typedef struct SymbolTable {
+  const struct SymbolTable *parent;
+  Symbol base;
+  SymbolEntry *entries; // open addressing, `entries_cap` is a power of two
+  size_t entries_cap;
+  MAKE_ARRAY(String_View, names) // names[symbol - base]
+} SymbolTable;
+
+SymbolTable symtab_extend(const SymbolTable *parent);
+// names are not copied, they have to outlive the table
+Symbol symtab_intern(SymbolTable *table, String_View name);
+// NO_SYMBOL if `name` was never interned
+Symbol symtab_find(const SymbolTable *table, String_View name);
+String_View symtab_name(const SymbolTable *table, Symbol symbol);
+// all symbols are below this
+Symbol symtab_end(const SymbolTable *table);
+void symtab_free(SymbolTable *table);
@@ -0,0 +1,60 @@
+#include "../test.h"
+#include "../../array.h"
+
+#define SV_IMPLEMENTATION
+#include "../../sv.h"
+
+typedef struct {
+  int tag;
+  MAKE_SMALL_ARRAY(size_t, items, 3)
+} Node;
+
+int main() {
+  // items stay inline up to the inline capacity
+  Node node = {0};
+  assert(SMALL_ARRAY_INLINE_CAP(node, items) == 3);
+  for (size_t i = 0; i < 3; ++i) SMALL_ARRAY_PUSH(NULL, node, items, i * 10);
+  assert(node.items_cap == 0 && "Expected items to be inline");
+  assert(SMALL_ARRAY_ITEMS(node, items) == node.items_inline);
+
+  // copies of the struct see their own inline items
+  Node copy = node;
+  SMALL_ARRAY_ITEMS(copy, items)[0] = 99;
+  assert(SMALL_ARRAY_ITEMS(node, items)[0] == 0);
+
+  // outgrowing them moves all items to the heap
+  for (size_t i = 3; i < 20; ++i) SMALL_ARRAY_PUSH(NULL, node, items, i * 10);
+  assert(node.items_cap >= 20 && node.items_count == 20);
+  for (size_t i = 0; i < 20; ++i) assert(SMALL_ARRAY_ITEMS(node, items)[i] == i * 10);
+
+  // shrinking releases unused capacity, and moves items back inline once they fit
+  SMALL_ARRAY_SHRINK(NULL, node, items);
+  assert(node.items_cap == 20);
+  node.items_count = 2;
+  SMALL_ARRAY_SHRINK(NULL, node, items);
+  assert(node.items_cap == 0 && SMALL_ARRAY_ITEMS(node, items)[1] == 10);
+  SMALL_ARRAY_RESERVE(NULL, node, items, 10);
+  assert(node.items_cap >= 12 && SMALL_ARRAY_ITEMS(node, items)[1] == 10);
+  SMALL_ARRAY_FREE(node, items);
+  assert(node.items_count == 0 && node.items_cap == 0);
+
+  // the same in an arena
+  Arena arena = {0};
+  for (size_t i = 0; i < 100; ++i) SMALL_ARRAY_PUSH(&arena, node, items, i);
+  for (size_t i = 0; i < 100; ++i) assert(SMALL_ARRAY_ITEMS(node, items)[i] == i);
+  node.items_count = 3;
+  SMALL_ARRAY_SHRINK(&arena, node, items);
+  assert(node.items_cap == 0 && SMALL_ARRAY_ITEMS(node, items)[2] == 2);
+  arena_free(&arena);
+
+  // elements are sized by the array, not by what is pushed
+  struct { MAKE_ARRAY(size_t, items) } wide = {0};
+  int small = 7;
+  for (size_t i = 0; i < 1000; ++i) ARRAY_PUSH(wide, items, small);
+  assert(wide.items_count == 1000 && wide.items[999] == 7);
+  ARRAY_EXTEND(wide, items, 5000);
+  assert(wide.items_cap >= 6000);
+  ARRAY_SHRINK(wide, items);
+  assert(wide.items_cap == 1000 && wide.items[999] == 7);
+  free(wide.items);
+}
@@ -0,0 +1,39 @@
+#include "cesttest.h"
+
+#define INPUT                                          \
+  "#include <stddef.h>\n"                              \
+  "struct base { int a; };\n"                          \
+  "struct child (struct base) { int b; };\n"           \
+  "struct action (struct sigaction) { int c; };\n"     \
+  "CEST_MACROS_HERE\n"
+
+#define CLEAN_INPUT                                    \
+  "struct base { int a; };\n"                          \
+  "struct child (struct base) { int b; };\n"           \
+  "CEST_MACROS_HERE\n"
+
+int main() {
+  setup();
+  write_test_file("a.h.in", INPUT);
+  write_test_file("b.h.in", CLEAN_INPUT);
+
+  // diagnostics are printed on every run, a translation with them is not answered from the cache
+  for (int run = 0; run < 2; ++run) {
+    assert(RUN_CEST("--cache-dir", test_path("cache"), test_path("a.h.in"), test_path("a.h")) == 0);
+    char *out = read_test_file("a.h");
+    char *err = read_test_file("stderr");
+    assert(strstr(out, "struct child{ int a;  int b; };") != NULL && "Expected the translation");
+    assert(strstr(err, "no parent `sigaction` known") != NULL && "Expected the error on every run");
+    free(out);
+    free(err);
+  }
+
+  // translations without diagnostics still are
+  for (int run = 0; run < 2; ++run) {
+    assert(RUN_CEST("--cache-dir", test_path("cache"), "--cache-stats", test_path("b.h.in"), test_path("b.h")) == 0);
+  }
+  char *err = read_test_file("stderr");
+  assert(strstr(err, "hits             1\n") != NULL && "Expected the second run to be a hit");
+  free(err);
+  cleanup();
+}
@@ -0,0 +1,80 @@
+#define _GNU_SOURCE
+#include <ftw.h>
+#include "../test.h"
+#define NO_MAIN
+#include "../../cest.c"
+
+// scratch directory of a test, removed again by `cleanup`
+static char test_dir[] = "/tmp/cest-test-XXXXXX";
+
+static void setup(void) {
+  if (mkdtemp(test_dir) == NULL) {
+    perror(TESTC ": mkdtemp");
+    exit(1);
+  }
+}
+
+static int remove_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw) {
+  (void)st; (void)flag; (void)ftw;
+  return remove(path);
+}
+
+static void cleanup(void) {
+  nftw(test_dir, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+// path of `name` in the scratch directory, valid until the 8th call after this one
+static char *test_path(const char *name) {
+  static char paths[8][256];
+  static size_t next = 0;
+  char *path = paths[next++ % 8];
+  snprintf(path, sizeof(paths[0]), "%s/%s", test_dir, name);
+  return path;
+}
+
+static void write_test_file(const char *name, const char *content) {
+  FILE *f = fopen(test_path(name), "w");
+  if (f == NULL || fputs(content, f) < 0 || fclose(f) != 0) {
+    perror(TESTC ": write test file");
+    exit(1);
+  }
+}
+
+// contents of a file of the scratch directory, NULL if it does not exist
+static char *read_test_file(const char *name) {
+  FILE *f = fopen(test_path(name), "r");
+  if (f == NULL) return NULL;
+  StringBuilder sb = {0};
+  char buf[4096];
+  for (size_t n; (n = fread(buf, 1, sizeof(buf), f)) > 0;) sb_append(&sb, buf, n);
+  sb_append(&sb, "", 1);
+  fclose(f);
+  return sb.items;
+}
+
+// runs cest with the NULL-terminated `args` in a child process, its stdout goes to `stdout`
+// and its stderr to `stderr` of the scratch directory; returns the exit status
+static int run_cest_args(const char **args) {
+  pid_t pid = fork();
+  if (pid < 0) {
+    perror(TESTC ": fork");
+    exit(1);
+  }
+  if (pid == 0) {
+    int out = open(test_path("stdout"), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    int err = open(test_path("stderr"), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out < 0 || err < 0 || dup2(out, STDOUT_FILENO) < 0 || dup2(err, STDERR_FILENO) < 0) exit(99);
+    int argc = 0;
+    while (args[argc]) argc += 1;
+    IncludeCache cache;
+    include_cache_init(&cache);
+    int status = run_cest(argc, (char **)args, &cache);
+    fflush(NULL);
+    exit(status);
+  }
+  int status;
+  waitpid(pid, &status, 0);
+  assert(WIFEXITED(status) && "Expected cest to exit");
+  return WEXITSTATUS(status);
+}
+#define RUN_CEST(...) run_cest_args((const char *[]) { "cest", __VA_ARGS__, NULL })
@@ -0,0 +1,36 @@
+#include "cesttest.h"
+
+#define INPUT                                 \
+  "#include <stddef.h>\n"                     \
+  "#if 0\n"                                   \
+  "struct base { int wrong; };\n"             \
+  "#else\n"                                   \
+  "struct base { int right; };\n"             \
+  "#endif\n"                                  \
+  "#ifdef NOT_DEFINED\n"                      \
+  "typedef struct other { int wrong; } other;\n" \
+  "#endif\n"                                  \
+  "struct child (struct base) { int c; };\n"  \
+  "typedef struct child2 (other) { int d; } child2;\n" \
+  "CEST_MACROS_HERE\n"
+
+int main() {
+  setup();
+  write_test_file("a.h.in", INPUT);
+  const char *engines[] = { "--preprocessor=cc", "--preprocessor=builtin" };
+  for (size_t i = 0; i < 2; ++i) {
+    for (int stream = 0; stream < 2; ++stream) {
+      if (stream) assert(RUN_CEST("--no-cache", engines[i], "--stream-includes", test_path("a.h.in"), test_path("a.h")) == 0);
+      else assert(RUN_CEST("--no-cache", engines[i], test_path("a.h.in"), test_path("a.h")) == 0);
+      char *out = read_test_file("a.h");
+      char *err = read_test_file("stderr");
+      // structs in inactive conditionals are not known, the active one is inherited from
+      assert(strstr(out, "struct child{ int right;  int c; };") != NULL && "Expected the members of the active struct");
+      assert(strstr(out, "struct child{ int wrong;") == NULL && "Expected no members of the struct under #if 0");
+      assert(strstr(err, "no parent `other` known") != NULL && "Expected the typedef under #ifdef to be unknown");
+      free(out);
+      free(err);
+    }
+  }
+  cleanup();
+}
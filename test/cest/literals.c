@@ -0,0 +1,30 @@
+#include "cesttest.h"
+
+#define HEADER                                \
+  "static const int l = L'{';\n"              \
+  "static const int u = u'{';\n"              \
+  "static const int u32 = U'{';\n"            \
+  "static const int u8 = u8'{';\n"            \
+  "static const int n = 1'000, m = 0x1'f;\n"  \
+  "struct base { int x; };\n"
+
+#define INPUT                                  \
+  "#include \"b.h\"\n"                         \
+  "struct child (struct base) { int c; };\n"   \
+  "CEST_MACROS_HERE\n"
+
+int main() {
+  setup();
+  write_test_file("b.h", HEADER);
+  write_test_file("a.h.in", INPUT);
+  const char *engines[] = { "--preprocessor=cc", "--preprocessor=builtin" };
+  for (size_t i = 0; i < 2; ++i) {
+    // braces in character literals with an encoding prefix do not open blocks, digit
+    // separators start no literal
+    assert(RUN_CEST("--no-cache", engines[i], "--stream-includes", test_path("a.h.in"), test_path("a.h")) == 0);
+    char *out = read_test_file("a.h");
+    assert(strstr(out, "struct child{ int x;  int c; };") != NULL && "Expected the struct after the literals");
+    free(out);
+  }
+  cleanup();
+}
@@ -0,0 +1,42 @@
+#include "cesttest.h"
+
+#define INPUT                                       \
+  "struct base { int a; };\n"                       \
+  "struct child (struct base) { int b; };\n"        \
+  "struct other (struct base) { int c; };\n"        \
+  "typedef struct top { int t; } top;\n"            \
+  "typedef struct sub (top) { int s; } sub;\n"      \
+  "CEST_MACROS_HERE\n"
+
+#define USE                                                    \
+  "int f(struct child *c) {\n"                                 \
+  "  char a = '\\x41', b = '\\012', q = '\\'', m = 'ab';\n"    \
+  "  return CEST_AS_struct_base(*c).a + CEST_AS_top(0);\n"     \
+  "}\n"                                                        \
+  "int g(void) { return CEST_AS_struct_nope(0); }\n"           \
+  "int h(void) { return CEST_AS_struct_nope(1); }\n"
+
+int main() {
+  setup();
+  write_test_file("a.h.in", INPUT);
+  write_test_file("use.c", USE);
+  assert(RUN_CEST("--no-cache", "--used-by", test_path("use.c"), test_path("a.h.in"), test_path("a.h")) == 0);
+  char *out = read_test_file("a.h");
+  char *err = read_test_file("stderr");
+  assert(out != NULL && "Expected the output to be written");
+
+  // only the referenced macros, with associations for the types the consumer names
+  assert(strstr(out, "#define CEST_AS_struct_base(T) _Generic((T), struct base: (T), struct child: *(struct base*)&(T))\n") != NULL
+    && "Expected the used macro without `struct other`");
+  assert(strstr(out, "#define CEST_AS_top(T) _Generic((T), top: (T))\n") != NULL && "Expected the used macro without `struct sub`");
+  assert(strstr(out, "CEST_AS_struct_baseS") == NULL && "Expected no unused pointer macro");
+  assert(strstr(out, "CEST_AS_struct_top") == NULL && "Expected no unused struct macro");
+
+  // the first use of a macro nothing generates is reported
+  assert(strstr(err, "use.c:5:22: `CEST_AS_struct_nope` is not generated") != NULL && "Expected a warning at the first use");
+  assert(strstr(err, "use.c:6:") == NULL && "Expected the warning only once");
+  assert(strstr(err, "character literal") == NULL && "Expected the consumer to scan cleanly");
+  free(out);
+  free(err);
+  cleanup();
+}
@@ -0,0 +1,29 @@
+#include "lexertest.h"
+
+#define INPUT                                        \
+  "#include <stdio.h>\n"                             \
+  "typedef struct a (struct b) { int x; } a;\n"     \
+  "/* comment */ char *s = \"string\"; // line\n"
+
+int main() {
+  Lexer lexer = lexer_create(TEST, SV(INPUT));
+  TokenBuffer tokens = tokens_lex(TEST, SV(INPUT));
+
+  // the buffer holds exactly the tokens of the lexer
+  for (size_t i = 0; i < tokens.count; ++i) {
+    Token token = lexer_expect_token(&lexer);
+    Token buffered = tokens_at(&tokens, i);
+    assert(buffered.kind == token.kind && "Expected same token kind in buffer");
+    assert(buffered.content.data == token.content.data && buffered.content.count == token.content.count && "Expected same token content in buffer");
+  }
+  EXPECT_EMPTY;
+
+  // locations resolve from the buffered content
+  Location loc = lexer_token_loc(&tokens.lexer, tokens_at(&tokens, 1));
+  assert(loc.line == 1 && loc.col == 0 && "Expected typedef at the start of the second line");
+  tokens_free(&tokens);
+
+  tokens = tokens_lex(TEST, SV(""));
+  assert(tokens.count == 0 && "Expected no tokens");
+  tokens_free(&tokens);
+}
@@ -0,0 +1,89 @@
+#include "lexertest.h"
+
+#define INPUT                                           \
+  "# 1 \"a.h\"\n"                                       \
+  "typedef struct a { int x; } a;\n"                    \
+  "/* block\n"                                          \
+  "   } { still comment */ int y = 1'000;\n"            \
+  "// line \\\n"                                        \
+  "   continued { \n"                                   \
+  "#define M(x) \\\n"                                   \
+  "  { x }\n"                                           \
+  "char *s = \"string { \\\" \\\n"                      \
+  "on two lines\";\n"                                   \
+  "struct b {\n"                                        \
+  "# 3 \"b.h\"\n"                                       \
+  "  char c = '{', d = '\\'';\n"                        \
+  "};\n"                                                \
+  "int z = a /= 2; /=/ comment after the operator\n"    \
+  "int w = 0x1'f; /*/ not closed yet */\n"              \
+  "struct c { a v; };\n"
+
+static void expect_joined(String_View input, size_t chunk) {
+  TokenBuffer whole = tokens_lex(TEST, input);
+  size_t splits[64];
+  const size_t count = tokens_split(input, chunk, splits, 63);
+  TokenBuffer chunks[64];
+  for (size_t i = 0; i <= count; ++i) {
+    const size_t start = i == 0 ? 0 : splits[i - 1];
+    const size_t end = i == count ? input.count : splits[i];
+    assert((start < end || input.count == 0) && "Expected splits in increasing order");
+    assert((i == 0 || input.data[start - 1] == '\n') && "Expected splits at line starts");
+    chunks[i] = tokens_lex_range(TEST, input, start, end);
+  }
+  TokenBuffer joined = tokens_join(chunks, count + 1);
+
+  // the pieces lex to exactly the tokens of the whole
+  assert(joined.count == whole.count && "Expected same number of tokens");
+  for (size_t i = 0; i < whole.count; ++i) {
+    assert(joined.offsets[i] == whole.offsets[i] && "Expected same token offsets");
+    assert(joined.lengths[i] == whole.lengths[i] && "Expected same token lengths");
+    assert(joined.kinds[i] == whole.kinds[i] && "Expected same token kinds");
+  }
+  if (joined.count > 0) {
+    Location a = lexer_token_loc(&joined.lexer, tokens_at(&joined, joined.count - 1));
+    Location b = lexer_token_loc(&whole.lexer, tokens_at(&whole, whole.count - 1));
+    assert(a.line == b.line && a.col == b.col && "Expected same locations");
+  }
+  tokens_free(&joined);
+  tokens_free(&whole);
+}
+
+int main() {
+  for (int table = 0; table < 2; ++table) {
+    lexer_default_flags = table ? LEXER_TABLE : 0;
+    expect_joined(SV(INPUT), 1);
+    expect_joined(SV(INPUT), 40);
+    expect_joined(SV(INPUT), 1 << 20);
+    expect_joined(SV(""), 1);
+  }
+
+  // only line starts outside of braces, comments, strings and directives
+  size_t splits[64];
+  size_t count = tokens_split(SV(INPUT), 1, splits, 64);
+  const size_t expected[] = {
+    sizeof("# 1 \"a.h\"\n") - 1,
+    sizeof("# 1 \"a.h\"\ntypedef struct a { int x; } a;\n") - 1,
+  };
+  assert(count > 2 && "Expected several splits");
+  assert(splits[0] == expected[0] && splits[1] == expected[1] && "Expected splits after a linemarker and a declaration");
+  for (size_t i = 0; i < count; ++i) {
+    String_View rest = sv_from_parts(INPUT + splits[i], sizeof(INPUT) - 1 - splits[i]);
+    assert(!sv_starts_with(rest, SV("   }")) && !sv_starts_with(rest, SV("   continued")) && "Expected no split in comments");
+    assert(!sv_starts_with(rest, SV("  { x }")) && !sv_starts_with(rest, SV("on two lines")) && "Expected no split in directives or strings");
+    assert(!sv_starts_with(rest, SV("  char")) && !sv_starts_with(rest, SV("};")) && "Expected no split inside braces");
+  }
+
+  // at most `max` and each at least `chunk` apart
+  assert(tokens_split(SV(INPUT), 1, splits, 1) == 1 && "Expected the number of splits to be bounded");
+  count = tokens_split(SV(INPUT), 100, splits, 64);
+  for (size_t i = 0; i < count; ++i) assert(splits[i] >= (i ? splits[i - 1] : 0) + 100 && "Expected splits to be chunk apart");
+
+  // nothing is split after text the lexer rejects, or after an unclosed string or comment
+  assert(tokens_split(SV("int a;\n@\nint b;\nint c;\n"), 1, splits, 64) == 1 && "Expected no split after an unknown token");
+  assert(tokens_split(SV("int a;\n'ab\nint b;\n"), 1, splits, 64) == 1 && "Expected no split after a broken character literal");
+  assert(tokens_split(SV("int a;\n'ab' '\\x41' '\\''\nint b;\n"), 1, splits, 64) == 2 && "Expected splits after character literals");
+  assert(tokens_split(SV("int a;\n\"open\nint b;\n"), 1, splits, 64) == 1 && "Expected no split in an unclosed string");
+  assert(tokens_split(SV("int a;\n/* open\nint b;\n"), 1, splits, 64) == 1 && "Expected no split in an unclosed comment");
+  assert(tokens_split(SV("int a;\n}\nint b;\n"), 1, splits, 64) == 1 && "Expected no split after an unbalanced brace");
+}
@@ -0,0 +1,62 @@
+#include <stdlib.h>
+#include <string.h>
+#include "lexertest.h"
+#include "../../array.h"
+#include "../../scan.h"
+
+#define INPUT                                                     \
+  "#define LONG_MACRO(a, b) do { a; b; } while (0) /* padding */ \\\n" \
+  "  continued_line_of_a_directive_longer_than_one_vector\n"      \
+  "   \t  \r\n\n          \v\f   struct s { int x; };\n"          \
+  "/* a block comment with * stars ** and\n newlines \n **/\n"    \
+  "char *s = \"string with \\\" escapes \\\\ and \\n more text\";\n" \
+  "// line comment that goes on for more than thirty-two bytes\n"   \
+  "typedef struct t (struct s) { char c; } t;\n"
+
+static void expect_same_tokens(String_View input) {
+  ScanImpl impl = scan_current();
+  Lexer expected = lexer_create(TEST, input);
+  scan_use(SCAN_SCALAR);
+  struct { MAKE_ARRAY(Token, items) } tokens = {0};
+  for (TokenOrEnd t = lexer_get_token(&expected); t.has_value; t = lexer_get_token(&expected)) ARRAY_PUSH(tokens, items, t.token);
+  scan_use(impl);
+  Lexer lexer = lexer_create(TEST, input);
+  for (size_t i = 0; i < tokens.items_count; ++i) {
+    Token token = lexer_expect_token(&lexer);
+    assert(token.kind == tokens.items[i].kind && "Expected same token kind for all kernels");
+    assert(sv_eq(token.content, tokens.items[i].content) && "Expected same token content for all kernels");
+    assert(token.content.data == tokens.items[i].content.data && "Expected same location for all kernels");
+  }
+  EXPECT_EMPTY;
+  free(tokens.items);
+}
+
+int main() {
+  Lexer lexer;
+  char buf[256];
+
+  for (ScanImpl impl = SCAN_SCALAR; impl <= SCAN_AVX2; ++impl) {
+    if (!scan_use(impl)) continue;
+
+    // kernels, with matches at every position around the vector widths
+    for (size_t n = 0; n < 80; ++n) {
+      memset(buf, ' ', n);
+      buf[n] = 'x';
+      buf[n + 1] = '\n';
+      assert(scan_space(buf, n + 2) == n && "Expected space to end at x");
+      assert(scan_space(buf, n) == n && "Expected all spaces");
+      assert(scan_byte(buf, n + 2, 'x') == n && "Expected to find x");
+      assert(scan_byte(buf, n, 'x') == n && "Expected not to find x");
+      assert(scan_byte2(buf, n + 2, '\n', 'x') == n && "Expected to find x first");
+    }
+
+    // the lexer suites must not depend on the kernel
+    expect_same_tokens(SV(INPUT));
+    expect_same_tokens(SV(INPUT INPUT INPUT));
+
+    lexer = lexer_create(TEST, SV("/* unclosed comment that is longer than a vector"));
+    EXPECT_TOKEN(TK_COMMENT, "/* unclosed comment that is longer than a vector"); EXPECT_EMPTY;
+    lexer = lexer_create(TEST, SV("\"unclosed string that is longer than a vector"));
+    EXPECT_ERROR;
+  }
+}
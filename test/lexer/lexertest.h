@@ -8,17 +8,17 @@
 #define SV_IMPLEMENTATION
 #include "../../sv.h"
 
-#define EXPECT_TOKEN(knd, cnd)  {                                                         \
+#define EXPECT_TOKEN(knd, cnd) do {                                                       \
     TokenOrEnd token = lexer_get_token(&lexer);                                           \
     assert(token.has_value && "Expected token to have value");                            \
     assert(token.token.kind == knd && "Expected token to have kind " #knd);               \
     assert(sv_eq(token.token.content, SV(cnd)) && "Expected token to have content " cnd); \
   } while (0)
-#define EXPECT_EMPTY  {                                    \
+#define EXPECT_EMPTY do {                                  \
     TokenOrEnd token = lexer_get_token(&lexer);            \
     assert(!token.has_value && "Expected no more tokens"); \
   } while (0)
-#define EXPECT_ERROR {                                                                       \
+#define EXPECT_ERROR do {                                                                    \
     pid_t pid = fork();                                                                      \
     if (pid < 0)                                                                             \
       perror(TESTC ": fork");                                                                \
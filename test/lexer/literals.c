@@ -34,10 +34,14 @@ int main() {
   EXPECT_TOKEN(TK_LIT, "'\\a'"); EXPECT_EMPTY;
   lexer = lexer_create(TEST, SV("'\\''"));
   EXPECT_TOKEN(TK_LIT, "'\\''"); EXPECT_EMPTY;
+  lexer = lexer_create(TEST, SV("'\\x41' '\\012'"));
+  EXPECT_TOKEN(TK_LIT, "'\\x41'"); EXPECT_TOKEN(TK_LIT, "'\\012'"); EXPECT_EMPTY;
   lexer = lexer_create(TEST, SV("'ab'"));
-  EXPECT_ERROR;
+  EXPECT_TOKEN(TK_LIT, "'ab'"); EXPECT_EMPTY;
   lexer = lexer_create(TEST, SV("'a"));
   EXPECT_ERROR;
+  lexer = lexer_create(TEST, SV("'a\n'"));
+  EXPECT_ERROR;
 
   // string literals
   lexer = lexer_create(TEST, SV("\"a\""));
@@ -0,0 +1,36 @@
+#include "lexertest.h"
+
+#define EXPECT_LOC(at, ln, cl) do {                                    \
+    Location loc = lexer_loc(&lexer, at);                              \
+    assert(loc.line == ln && "Expected location to be on line " #ln);  \
+    assert(loc.col == cl && "Expected location to be in column " #cl); \
+  } while (0)
+
+int main() {
+  Lexer lexer;
+  Token t;
+
+  lexer = lexer_create(TEST, SV("a\n  b /* c\n d */ e\n\n#define f \\\n g\nh"));
+  t = lexer_expect_token(&lexer); EXPECT_LOC(t.content.data, 0, 0); // a
+  t = lexer_expect_token(&lexer); EXPECT_LOC(t.content.data, 1, 2); // b
+  t = lexer_expect_token(&lexer); EXPECT_LOC(t.content.data, 1, 4); // /* c d */
+  t = lexer_expect_token(&lexer); EXPECT_LOC(t.content.data, 2, 6); // e
+  t = lexer_expect_token(&lexer); EXPECT_LOC(t.content.data, 4, 0); // #define
+  t = lexer_expect_token(&lexer); EXPECT_LOC(t.content.data, 6, 0); // h
+  EXPECT_LOC(lexer.content.data, 6, 1); // end of input
+  EXPECT_EMPTY;
+  assert(sv_eq(lexer_token_loc(&lexer, t).filename, lexer.filename) && "Expected location in the lexed file");
+  lexer_free(&lexer);
+
+  // the index is built once, later lookups only search it
+  lexer = lexer_create(TEST, SV("\n\nx"));
+  EXPECT_LOC(lexer.content.data, 0, 0);
+  EXPECT_LOC(lexer.content.data + 2, 2, 0);
+  EXPECT_LOC(lexer.content.data + 1, 1, 0);
+  assert(lexer.line_starts_count == 3 && "Expected one line start per line");
+  lexer_free(&lexer);
+
+  lexer = lexer_create(TEST, SV(""));
+  EXPECT_LOC(lexer.content.data, 0, 0);
+  lexer_free(&lexer);
+}
@@ -0,0 +1,76 @@
+#include <stdlib.h>
+#include "lexertest.h"
+#include "../../array.h"
+
+#define INPUT                                                            \
+  "#include <stdio.h>\n#define M(a) \\\n  (a)\n"                         \
+  "typedef struct __attribute__((packed)) s (struct t) { const int x; } s;\n" \
+  "enum e { A = 0x1F, B = 1'000, C = 1.5e3f, D = 'a', E = '\\'', F = '\\x41', G = 'ab' };\n"  \
+  "bool b = true || false && !x; y ^= z;\n"                              \
+  "p->x = q.y; r-=>s; a /= b; c &= d |= e; f(...);\n"                    \
+  "a+=b-=c*=d<=e>=f==g!=h<i>j?k:l; m %= n % ~o;\n"                       \
+  "/* block\n comment */ // line comment\n"                              \
+  "char *s = \"str \\\" ing\"; typedefs structs enums trues consts\n"
+
+static void expect_same_tokens(String_View input) {
+  Lexer expected = lexer_create(TEST, input);
+  struct { MAKE_ARRAY(Token, items) } tokens = {0};
+  for (TokenOrEnd t = lexer_get_token(&expected); t.has_value; t = lexer_get_token(&expected)) ARRAY_PUSH(tokens, items, t.token);
+  Lexer lexer = lexer_create(TEST, input);
+  lexer.flags |= LEXER_TABLE;
+  for (size_t i = 0; i < tokens.items_count; ++i) {
+    Token token = lexer_expect_token(&lexer);
+    assert(token.kind == tokens.items[i].kind && "Expected same token kind in both modes");
+    assert(sv_eq(token.content, tokens.items[i].content) && "Expected same token content in both modes");
+    assert(token.content.data == tokens.items[i].content.data && "Expected same location in both modes");
+  }
+  EXPECT_EMPTY;
+  free(tokens.items);
+}
+
+int main() {
+  Lexer lexer;
+
+  expect_same_tokens(SV(INPUT));
+  expect_same_tokens(SV("a"));
+  expect_same_tokens(SV("-"));
+  expect_same_tokens(SV("..a"));
+  expect_same_tokens(SV("// unterminated"));
+
+  lexer_default_flags = LEXER_TABLE;
+  lexer = lexer_create(TEST, SV("typedef struct enum true false const __attribute__ typedeff _struct"));
+  EXPECT_TOKEN(TK_TYPEDF, "typedef");
+  EXPECT_TOKEN(TK_STRUCT, "struct");
+  EXPECT_TOKEN(TK_ENUM, "enum");
+  EXPECT_TOKEN(TK_LIT, "true");
+  EXPECT_TOKEN(TK_LIT, "false");
+  EXPECT_TOKEN(TK_ATTRIB, "const");
+  EXPECT_TOKEN(TK_ATTRIB, "__attribute__");
+  EXPECT_TOKEN(TK_NAME, "typedeff");
+  EXPECT_TOKEN(TK_NAME, "_struct");
+  EXPECT_EMPTY;
+
+  lexer = lexer_create(TEST, SV("a->b -=> c"));
+  EXPECT_TOKEN(TK_NAME, "a");
+  EXPECT_TOKEN(TK_ACCESS, "->");
+  EXPECT_TOKEN(TK_NAME, "b");
+  EXPECT_TOKEN(TK_ACCESS, "-=>");
+  EXPECT_TOKEN(TK_NAME, "c");
+  EXPECT_EMPTY;
+
+  lexer = lexer_create(TEST, SV("a % b %= ~c"));
+  EXPECT_TOKEN(TK_NAME, "a");
+  EXPECT_TOKEN(TK_OP, "%");
+  EXPECT_TOKEN(TK_NAME, "b");
+  EXPECT_TOKEN(TK_OP, "%=");
+  EXPECT_TOKEN(TK_OP, "~");
+  EXPECT_TOKEN(TK_NAME, "c");
+  EXPECT_EMPTY;
+
+  lexer = lexer_create(TEST, SV("@"));
+  EXPECT_ERROR;
+  lexer = lexer_create(TEST, SV("'ab' '\\x41' '\\''"));
+  EXPECT_TOKEN(TK_LIT, "'ab'"); EXPECT_TOKEN(TK_LIT, "'\\x41'"); EXPECT_TOKEN(TK_LIT, "'\\''"); EXPECT_EMPTY;
+  lexer = lexer_create(TEST, SV("'a"));
+  EXPECT_ERROR;
+}
@@ -0,0 +1,41 @@
+#include "preproctest.h"
+
+int main() {
+  PPConfig config = { .engine = PP_ENGINE_BUILTIN };
+  String_View out;
+
+  // ifdef and defines
+  out = PREPROCESS("#define A\n#ifdef A\nyes\n#else\nno\n#endif\n");
+  EXPECT_LINE(out, "yes"); EXPECT_NO_LINE(out, "no");
+  out = PREPROCESS("#define A\n#undef A\n#ifndef A\nyes\n#endif\n");
+  EXPECT_LINE(out, "yes");
+
+  // expressions
+  out = PREPROCESS("#define V 3\n#if V * 2 == 6 && !defined(W)\nyes\n#endif\n");
+  EXPECT_LINE(out, "yes");
+  out = PREPROCESS("#define F(x, y) ((x) << (y))\n#if F(1, 4) > 15 ? 0 : 1\nno\n#elif F(1, 4) == 16\nyes\n#endif\n");
+  EXPECT_LINE(out, "yes"); EXPECT_NO_LINE(out, "no");
+  out = PREPROCESS("#if __has_builtin(x) || UNKNOWN\nno\n#else\nyes\n#endif\n");
+  EXPECT_LINE(out, "yes"); EXPECT_NO_LINE(out, "no");
+
+  // nested inactive blocks are never taken
+  out = PREPROCESS("#if 0\n#if 1\nno\n#else\nno2\n#endif\n#elif 1\nyes\n#else\nno3\n#endif\n");
+  EXPECT_LINE(out, "yes"); EXPECT_NO_LINE(out, "no"); EXPECT_NO_LINE(out, "no2"); EXPECT_NO_LINE(out, "no3");
+
+  // directives in comments and continued lines
+  out = PREPROCESS("/*\n#define A\n*/\n#ifdef A\nno\n#endif\n#define B \\\n  1\n#if B\nyes\n#endif\n");
+  EXPECT_LINE(out, "yes"); EXPECT_NO_LINE(out, "no");
+
+  // includes
+  out = PREPROCESS("#include <stddef.h>\n#ifdef NULL\nyes\n#endif\n");
+  EXPECT_LINE(out, "yes");
+
+  // lines like `cc -fdirectives-only`: directives and inactive lines stay empty lines (or a
+  // linemarker after long gaps), #define and #pragma are kept
+  out = PREPROCESS(
+    "a\n#if 0\nx\n#endif\nb\n#define  F( x )  ( x )   + 1\n#ifdef F\n#else\nno\n#endif\nc\n"
+    "#if 0\n1\n2\n3\n4\n5\n6\n7\n8\n#endif\nd\n#pragma  GCC  visibility push(default)\n#if 1\n#endif\n");
+  assert(strcmp(out.data,
+    "# 1 \"<stdin>\"\na\n\n\n\nb\n#define F(x) ( x ) + 1\n\n\n\n\nc\n"
+    "# 22 \"<stdin>\"\nd\n#pragma GCC visibility push(default)\n\n") == 0 && "Expected the lines of cc");
+}
@@ -0,0 +1,89 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "preproctest.h"
+
+static char dir[] = "/tmp/cest-preproc-XXXXXX";
+
+static const char *test_path(const char *name) {
+  static char paths[4][256];
+  static size_t next = 0;
+  char *path = paths[next++ % 4];
+  snprintf(path, sizeof(paths[0]), "%s/%s", dir, name);
+  return path;
+}
+
+static void write_header(const char *name, const char *content) {
+  FILE *f = fopen(test_path(name), "w");
+  assert(f != NULL && "Expected to create the header");
+  fputs(content, f);
+  fclose(f);
+}
+
+static size_t count_lines(String_View out, const char *line) {
+  size_t count = 0;
+  for (const char *at = out.data; (at = strstr(at, line)) != NULL; at += 1) count += 1;
+  return count;
+}
+
+int main() {
+  assert(mkdtemp(dir) != NULL && "Expected a scratch directory");
+  mkdir(test_path("a"), 0755);
+  mkdir(test_path("b"), 0755);
+  write_header("a/guarded.h", "/* comment */\n#ifndef GUARDED_H\n#define GUARDED_H\nint guarded;\n#endif // GUARDED_H\n");
+  write_header("a/unguarded.h", "#ifndef UNGUARDED_H\n#define UNGUARDED_H\n#endif\nint unguarded;\n");
+  write_header("a/once.h", "#pragma once\nint once;\n");
+  write_header("a/next.h", "int first;\n#include_next <next.h>\n");
+  write_header("b/next.h", "int second;\n");
+
+  const char *includes[] = { strdup(test_path("a")), strdup(test_path("b")) };
+  PPConfig config = {
+    .engine = PP_ENGINE_BUILTIN,
+    .includes = includes,
+    .includes_count = 2,
+  };
+  String_View out;
+
+  // include guards skip the file again, unless the guard was undefined; text after the
+  // #endif is no guard
+  out = PREPROCESS("#include <guarded.h>\n#include <guarded.h>\n");
+  assert(count_lines(out, "\nint guarded;\n") == 1 && "Expected a guarded header once");
+  out = PREPROCESS("#include <guarded.h>\n#undef GUARDED_H\n#include <guarded.h>\n");
+  assert(count_lines(out, "\nint guarded;\n") == 2 && "Expected a guarded header again after #undef");
+  out = PREPROCESS("#include <unguarded.h>\n#include <unguarded.h>\n");
+  assert(count_lines(out, "\nint unguarded;\n") == 2 && "Expected a header with text after #endif twice");
+
+  // #pragma once
+  out = PREPROCESS("#include <once.h>\n#include <once.h>\n");
+  assert(count_lines(out, "\nint once;\n") == 1 && "Expected a #pragma once header once");
+
+  // #include_next continues the search after the directory of the including file
+  out = PREPROCESS("#include <next.h>\n");
+  EXPECT_LINE(out, "int first;"); EXPECT_LINE(out, "int second;");
+  assert(strstr(out.data, "int first;") < strstr(out.data, "int second;") && "Expected the next header after the first");
+
+  // a missing include is fatal, like in `cc`
+  pid_t pid = fork();
+  if (pid == 0) {
+    freopen("/dev/null", "w", stderr);
+    PREPROCESS("#include \"does not exist.h\"\nyes\n");
+    exit(0);
+  }
+  int status;
+  waitpid(pid, &status, 0);
+  assert(WIFEXITED(status) && WEXITSTATUS(status) == 1 && "Expected a missing include to fail");
+
+  remove(test_path("a/guarded.h"));
+  remove(test_path("a/unguarded.h"));
+  remove(test_path("a/once.h"));
+  remove(test_path("a/next.h"));
+  remove(test_path("b/next.h"));
+  remove(test_path("a"));
+  remove(test_path("b"));
+  remove(dir);
+  free((void *)includes[0]);
+  free((void *)includes[1]);
+}
@@ -0,0 +1,14 @@
+#include <string.h>
+#include "../test.h"
+#include "../../preproc.h"
+
+#define SV_IMPLEMENTATION
+#include "../../sv.h"
+
+#define PREPROCESS(src) pp_builtin(&config, ".", SV(src))
+#define EXPECT_LINE(out, line) do {                                                               \
+    assert(strstr((out).data, "\n" line "\n") != NULL && "Expected output to contain " line);     \
+  } while (0)
+#define EXPECT_NO_LINE(out, line) do {                                                            \
+    assert(strstr((out).data, "\n" line "\n") == NULL && "Expected output to not contain " line); \
+  } while (0)
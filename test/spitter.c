@@ -1,18 +1,315 @@
+#define _GNU_SOURCE
+#include <stdarg.h>
 #include <stdio.h>
+#include <time.h>
 #include "../lexer.h"
 #define NO_MAIN
 #include "../cest.c"
 
+// Usage: spitter.exe <file>
+//          dumps every token of <file>
+//        spitter.exe --bench [options] [<preprocessed file>...]
+//          times the lexers on buffers of different profiles (and on the given files),
+//          and the String_View primitives of hot paths; one tab-separated line each
+//   --rounds <n>       repetitions, the best is reported (default: 5)
+//   --save <file>      write the results as thresholds, with some margin
+//   --margin <percent> margin of saved thresholds (default: 25)
+//   --check <file>     fail if any result takes more ns/byte than its threshold in <file>
+
+#define PROFILE_SIZE (4 * 1024 * 1024)
+#define ROUND_TIME 0.05 // seconds, a round repeats passes over its buffer at least this long
+#define PREPROCESSED_HEADERS \
+  "#include <stdio.h>\n#include <stdlib.h>\n#include <string.h>\n#include <pthread.h>\n" \
+  "#include <signal.h>\n#include <time.h>\n#include <sys/socket.h>\n"
+
+typedef struct {
+  char name[64];
+  size_t bytes;
+  size_t count; // tokens or operations
+  double seconds; // per pass, of the best round
+} Result;
+
+typedef struct {
+  const char *name;
+  String_View text;
+  bool mapped; // a file given on the command line
+} Profile;
+
+static volatile size_t sink; // keeps results of timed loops alive
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void append_fmt(StringBuilder *sb, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+static void append_fmt(StringBuilder *sb, const char *fmt, ...) {
+  char line[512];
+  va_list args;
+  va_start(args, fmt);
+  int n = vsnprintf(line, sizeof(line), fmt, args);
+  va_end(args);
+  sb_append(sb, line, n);
+}
+
+static String_View finish(StringBuilder *sb) {
+  ARRAY_PUSH(*sb, items, 0);
+  return sv_from_parts(sb->items, sb->items_count - 1);
+}
+
+static String_View profile_ident(void) {
+  StringBuilder sb = {0};
+  for (size_t i = 0; sb.items_count < PROFILE_SIZE; ++i)
+    append_fmt(&sb, "  unsigned long long field_%zu; struct node_%zu *next_node_%zu, *prev; size_t count_%zu;\n", i, i % 97, i, i % 13);
+  return finish(&sb);
+}
+
+static String_View profile_comment(void) {
+  StringBuilder sb = {0};
+  for (size_t i = 0; sb.items_count < PROFILE_SIZE; ++i) {
+    append_fmt(&sb, "/* Block comment number %zu, describing the field below in a few words,\n"
+                    " * spread over multiple lines as is common in library headers. */\n", i);
+    append_fmt(&sb, "int value_%zu; // line comment trailing the declaration %zu\n", i, i);
+  }
+  return finish(&sb);
+}
+
+static String_View profile_define(void) {
+  StringBuilder sb = {0};
+  for (size_t i = 0; sb.items_count < PROFILE_SIZE; ++i) {
+    append_fmt(&sb, "#define MACRO_%zu(a, b, c) do { \\\n    if ((a) > (b)) { (c) = (a) - (b); } \\\n"
+                    "    else { (c) = (b) - (a) + %zu; } \\\n    some_function_call((a), (b), (c), \"text\"); \\\n  } while (0)\n", i, i);
+  }
+  return finish(&sb);
+}
+
+static String_View profile_string(void) {
+  StringBuilder sb = {0};
+  for (size_t i = 0; sb.items_count < PROFILE_SIZE; ++i)
+    append_fmt(&sb, "const char *message_%zu = \"value %%d of \\\"%zu\\\" is out of range\\n\"; char c_%zu = '\\\\';\n", i, i, i);
+  return finish(&sb);
+}
+
+// real `cc -fdirectives-only -E` output, repeated to the size of the other profiles
+static String_View profile_preprocessed(void) {
+  PPConfig config = {0};
+  String_View once = preprocess_prelude(&config, ".", SV(PREPROCESSED_HEADERS), NULL);
+  StringBuilder sb = {0};
+  while (sb.items_count < PROFILE_SIZE) sb_append(&sb, once.data, once.count);
+  free((void *)once.data);
+  return finish(&sb);
+}
+
+static void bench_lexer(Result *r, String_View input, LexerFlags flags, int rounds) {
+  LexerFlags saved = lexer_default_flags;
+  lexer_default_flags = flags;
+  r->bytes = input.count;
+  r->seconds = 1e30;
+  for (int round = 0; round < rounds; ++round) {
+    double start = now(), t;
+    size_t passes = 0;
+    do {
+      TokenBuffer tokens = tokens_lex(SV("bench"), input);
+      r->count = tokens.count;
+      tokens_free(&tokens);
+      passes += 1;
+    } while ((t = now() - start) < ROUND_TIME);
+    if (t / passes < r->seconds) r->seconds = t / passes;
+  }
+  lexer_default_flags = saved;
+}
+
+static bool is_space(char c) {
+  return isspace((unsigned char)c);
+}
+
+static bool is_not_space(char c) {
+  return !isspace((unsigned char)c);
+}
+
+typedef enum {
+  SV_CHOP_BY_DELIM,
+  SV_CHOP_LEFT_WHILE,
+  SV_CHOP_BY_SV,
+  SV_EQ,
+} SvOp;
+
+static size_t run_sv(SvOp op, String_View text, const String_View *words, size_t words_count) {
+  size_t count = 0;
+  switch (op) {
+  case SV_CHOP_BY_DELIM:
+    while (text.count) count += sv_chop_by_delim(&text, '\n').count > 0;
+    break;
+  case SV_CHOP_LEFT_WHILE:
+    while (text.count) {
+      sv_chop_left_while(&text, is_space);
+      count += sv_chop_left_while(&text, is_not_space).count > 0;
+    }
+    break;
+  case SV_CHOP_BY_SV:
+    while (text.count) count += sv_chop_by_sv(&text, SV("struct")).count > 0;
+    break;
+  case SV_EQ:
+    // neighbouring identifiers, mostly of equal length, as in symbol lookups
+    for (size_t i = 1; i < words_count; ++i) count += sv_eq(words[i - 1], words[i]);
+    break;
+  }
+  return count;
+}
+
+static void bench_sv(Result *r, SvOp op, String_View text, const String_View *words, size_t words_count, int rounds) {
+  r->bytes = text.count;
+  if (op == SV_EQ) {
+    r->bytes = 0;
+    for (size_t i = 1; i < words_count; ++i) r->bytes += words[i].count;
+  }
+  r->seconds = 1e30;
+  for (int round = 0; round < rounds; ++round) {
+    double start = now(), t;
+    size_t passes = 0;
+    do {
+      size_t count = run_sv(op, text, words, words_count);
+      sink += count;
+      r->count = op == SV_EQ ? words_count - 1 : count;
+      passes += 1;
+    } while ((t = now() - start) < ROUND_TIME);
+    if (t / passes < r->seconds) r->seconds = t / passes;
+  }
+}
+
+static double ns_per_byte(const Result *r) {
+  return r->seconds * 1e9 / r->bytes;
+}
+
+static bool check(const Result *results, size_t count, const char *path) {
+  FILE *f = fopen(path, "r");
+  if (f == NULL) {
+    perror(path);
+    exit(1);
+  }
+  bool ok = true;
+  char line[256], name[64];
+  double threshold;
+  while (fgets(line, sizeof(line), f)) {
+    if (line[0] == '#' || sscanf(line, "%63s %lf", name, &threshold) != 2) continue;
+    for (size_t i = 0; i < count; ++i) {
+      if (strcmp(results[i].name, name) != 0) continue;
+      if (ns_per_byte(&results[i]) > threshold) {
+        fprintf(stderr, "REGRESSION %s: %.3f ns/byte, threshold %.3f\n", name, ns_per_byte(&results[i]), threshold);
+        ok = false;
+      }
+    }
+  }
+  fclose(f);
+  return ok;
+}
+
+static int bench(int argc, char *argv[]) {
+  int rounds = 5;
+  double margin = 0.25;
+  const char *save = NULL;
+  const char *thresholds = NULL;
+  struct { MAKE_ARRAY(const char *, items) } files = {0};
+  for (int i = 2; i < argc; ++i) {
+    if (strcmp(argv[i], "--rounds") == 0) {
+      rounds = atoi(next_arg(argc, argv, &i));
+      if (rounds < 1) rounds = 1;
+    } else if (strcmp(argv[i], "--save") == 0) {
+      save = next_arg(argc, argv, &i);
+    } else if (strcmp(argv[i], "--margin") == 0) {
+      margin = atof(next_arg(argc, argv, &i)) / 100;
+    } else if (strcmp(argv[i], "--check") == 0) {
+      thresholds = next_arg(argc, argv, &i);
+    } else {
+      ARRAY_PUSH(files, items, argv[i]);
+    }
+  }
+
+  Profile profiles[16];
+  size_t profiles_count = 0;
+  profiles[profiles_count++] = (Profile) { "ident", profile_ident(), false };
+  profiles[profiles_count++] = (Profile) { "comment", profile_comment(), false };
+  profiles[profiles_count++] = (Profile) { "define", profile_define(), false };
+  profiles[profiles_count++] = (Profile) { "string", profile_string(), false };
+  const Profile *preprocessed = &profiles[profiles_count];
+  profiles[profiles_count++] = (Profile) { "preprocessed", profile_preprocessed(), false };
+  for (size_t i = 0; i < files.items_count && profiles_count < sizeof(profiles) / sizeof(*profiles); ++i) {
+    const char *base = strrchr(files.items[i], '/');
+    profiles[profiles_count++] = (Profile) { base ? base + 1 : files.items[i], load_file(files.items[i], true), true };
+  }
+
+  Result results[sizeof(profiles) / sizeof(*profiles) * 2 + 4];
+  size_t results_count = 0;
+  static const struct { const char *name; LexerFlags flags; } lexers[] = {
+    { "classic", 0 },
+    { "table", LEXER_TABLE },
+  };
+  for (size_t p = 0; p < profiles_count; ++p) {
+    for (size_t l = 0; l < sizeof(lexers) / sizeof(*lexers); ++l) {
+      Result *r = &results[results_count++];
+      snprintf(r->name, sizeof(r->name), "lex/%s/%s", lexers[l].name, profiles[p].name);
+      bench_lexer(r, profiles[p].text, lexers[l].flags, rounds);
+    }
+  }
+
+  // the primitives on real preprocessor output, sv_eq on its identifiers
+  String_View text = preprocessed->text;
+  TokenBuffer tokens = tokens_lex(SV("bench"), text);
+  struct { MAKE_ARRAY(String_View, items) } words = {0};
+  for (size_t i = 0; i < tokens.count; ++i)
+    if (tokens.kinds[i] == TK_NAME) ARRAY_PUSH(words, items, tokens_at(&tokens, i).content);
+  static const struct { const char *name; SvOp op; } ops[] = {
+    { "sv/chop_by_delim", SV_CHOP_BY_DELIM },
+    { "sv/chop_left_while", SV_CHOP_LEFT_WHILE },
+    { "sv/chop_by_sv", SV_CHOP_BY_SV },
+    { "sv/eq", SV_EQ },
+  };
+  for (size_t o = 0; o < sizeof(ops) / sizeof(*ops); ++o) {
+    Result *r = &results[results_count++];
+    snprintf(r->name, sizeof(r->name), "%s", ops[o].name);
+    bench_sv(r, ops[o].op, text, words.items, words.items_count, rounds);
+  }
+  free(words.items);
+  tokens_free(&tokens);
+
+  FILE *saved = save ? fopen(save, "w") : NULL;
+  if (save && saved == NULL) {
+    perror(save);
+    exit(1);
+  }
+  if (saved) fprintf(saved, "# benchmark\tmax_ns_per_byte\n");
+  printf("benchmark\tbytes\tcount\tns_per_byte\tcount_per_s\n");
+  for (size_t i = 0; i < results_count; ++i) {
+    const Result *r = &results[i];
+    printf("%s\t%zu\t%zu\t%.3f\t%.0f\n", r->name, r->bytes, r->count, ns_per_byte(r), r->count / r->seconds);
+    if (saved) fprintf(saved, "%s\t%.3f\n", r->name, ns_per_byte(r) * (1 + margin));
+  }
+  if (saved && fclose(saved) != 0) {
+    perror(save);
+    exit(1);
+  }
+  bool ok = thresholds == NULL || check(results, results_count, thresholds);
+
+  for (size_t p = 0; p < profiles_count; ++p) {
+    if (profiles[p].mapped) unload_file(profiles[p].text);
+    else free((void *)profiles[p].text.data);
+  }
+  free((void *)files.items);
+  return ok ? 0 : 1;
+}
+
 int main(int argc, char *argv[]) {
-  if (argc < 1) {
+  if (argc < 2) {
     fprintf(stderr, "too few arguments provided!\n");
     exit(1);
   }
-  String_View file = load_file(argv[1]);
-  Lexer lexer = (Lexer) { .content = file, .loc = { .filename = sv_from_cstr(argv[1]) } };
+  if (strcmp(argv[1], "--bench") == 0) return bench(argc, argv);
+  String_View file = load_file(argv[1], false);
+  Lexer lexer = lexer_create(sv_from_cstr(argv[1]), file);
   TokenOrEnd token = lexer_get_token(&lexer);
   while (token.has_value) {
-    lexer_dump_token(token.token, stdout);
+    lexer_dump_token(&lexer, token.token, stdout);
     token = lexer_get_token(&lexer);
   }
   return 0;
@@ -0,0 +1,46 @@
+#include "../test.h"
+#include "../../symtab.h"
+
+#define SV_IMPLEMENTATION
+#include "../../sv.h"
+
+int main() {
+  SymbolTable table = symtab_extend(NULL);
+
+  // interning the same name gives the same symbol
+  Symbol a = symtab_intern(&table, SV("a"));
+  Symbol b = symtab_intern(&table, SV("b"));
+  assert(a != NO_SYMBOL && b != NO_SYMBOL && a != b);
+  assert(symtab_intern(&table, SV("a")) == a);
+  assert(symtab_find(&table, SV("b")) == b);
+  assert(symtab_find(&table, SV("c")) == NO_SYMBOL);
+  assert(sv_eq(symtab_name(&table, b), SV("b")));
+
+  // growing keeps all symbols
+  char names[1000][8];
+  for (int i = 0; i < 1000; ++i) {
+    sprintf(names[i], "n%d", i);
+    symtab_intern(&table, sv_from_cstr(names[i]));
+  }
+  assert(symtab_find(&table, SV("a")) == a);
+  assert(symtab_end(&table) == a + 1002);
+
+  // extensions see the parent's symbols, but do not modify it
+  SymbolTable ext = symtab_extend(&table);
+  assert(symtab_intern(&ext, SV("n500")) == symtab_find(&table, SV("n500")));
+  Symbol c = symtab_intern(&ext, SV("c"));
+  assert(c == symtab_end(&table));
+  assert(symtab_find(&table, SV("c")) == NO_SYMBOL);
+  assert(sv_eq(symtab_name(&ext, c), SV("c")));
+  assert(sv_eq(symtab_name(&ext, a), SV("a")));
+
+  symtab_free(&ext);
+  symtab_free(&table);
+
+  // zero-initialized tables never hand out NO_SYMBOL
+  SymbolTable zero = {0};
+  assert(symtab_end(&zero) == NO_SYMBOL + 1);
+  assert(symtab_intern(&zero, SV("a")) != NO_SYMBOL);
+  assert(symtab_find(&zero, SV("b")) == NO_SYMBOL);
+  symtab_free(&zero);
+}